@@ -0,0 +1,308 @@
+/*
+    atlas.c
+    packs textures into atlas pages for the game
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+#include "texture.h"
+#include "atlas.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+#define ATL_MAX_PAGE            65535       // largest page the entries can describe
+
+// one image to be placed, level l of body b
+struct atl_image_s              {
+                                    int         size;
+                                    uint8_t     *pixels;
+
+                                    int         page;
+                                    int         x;          // top left of the padding
+                                    int         y;
+                                };
+typedef struct atl_image_s atl_image_type;
+
+// everything the threads of an export share
+struct atl_job_s                {
+                                    uint32_t    **textures;
+                                    uint32_t    *body_first;    // a texture using each body
+                                    int         tex_size;
+                                    int         levels;
+                                    int         padding;
+                                    int         page_size;
+
+                                    atl_image_type  *images;    // levels per body, in order
+                                    uint8_t     *pages;
+                                };
+typedef struct atl_job_s atl_job_type;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// halves a size x size image into dest, each texel being the palette colour closest to the
+// average of the 2 x 2 block above it
+static void Halve_Image( const uint8_t *src, int size, uint8_t *dest )
+{
+    int half = size / 2, x, y, i, sum[3];
+    uint8_t rgb[3];
+    const uint8_t *block;
+
+    for( y = 0; y < half; y++ )
+    {
+        for( x = 0; x < half; x++ )
+        {
+            block = &src[y * 2 * size + x * 2];
+            sum[0] = sum[1] = sum[2] = 0;
+
+            for( i = 0; i < 4; i++ )
+            {
+                GRA_Get_Palette_RGB( block[( i >> 1 ) * size + ( i & 1 )], &rgb[0], &rgb[1], &rgb[2] );
+                sum[0] += rgb[0];
+                sum[1] += rgb[1];
+                sum[2] += rgb[2];
+            }
+
+            dest[y * half + x] = GRA_Nearest_Palette_Index( ( sum[0] + 2 ) / 4, ( sum[1] + 2 ) / 4,
+                                                            ( sum[2] + 2 ) / 4 );
+        }
+    }
+
+    return;
+}
+
+
+// makes the images of every level of one body, on one of the export threads
+static int Build_Levels( int body, void *data )
+{
+    atl_job_type *job = data;
+    atl_image_type *image = &job->images[body * job->levels];
+    uint32_t *texels = job->textures[job->body_first[body]];
+
+    int i, level;
+    for( i = 0; i < job->tex_size * job->tex_size; i++ )
+    {
+        image[0].pixels[i] = texels[i];
+    }
+
+    for( level = 1; level < job->levels; level++ )
+    {
+        Halve_Image( image[level - 1].pixels, image[level - 1].size, image[level].pixels );
+    }
+
+    return 1;
+}
+
+
+// copies one image and its padding onto its page, on one of the export threads. each row of
+// padding repeats the nearest row of the image and each column the nearest column
+static int Place_Image( int index, void *data )
+{
+    atl_job_type *job = data;
+    atl_image_type *image = &job->images[index];
+
+    int size = image->size, pad = job->padding, r, src_row;
+    uint8_t *dest, *src;
+
+    for( r = 0; r < size + pad * 2; r++ )
+    {
+        src_row = r - pad;
+        src_row = ( src_row < 0 ) ? 0 : ( src_row >= size ) ? size - 1 : src_row;
+        src = &image->pixels[src_row * size];
+
+        dest = &job->pages[(size_t)image->page * job->page_size * job->page_size +
+                           (size_t)( image->y + r ) * job->page_size + image->x];
+
+        memset( dest, src[0], pad );
+        memcpy( &dest[pad], src, size );
+        memset( &dest[pad + size], src[size - 1], pad );
+    }
+
+    return 1;
+}
+
+
+// packs the images into shelves, rows of images along the top of the page with the next row
+// below the tallest one. images come largest first, so shelves fill evenly. returns the
+// number of pages used
+static int Pack_Images( atl_image_type *images, int count, int page_size, int padding )
+{
+    int i, cell, page = 0, x = 0, y = 0, shelf_h = 0;
+    for( i = 0; i < count; i++ )
+    {
+        cell = images[i].size + padding * 2;
+
+        if( x + cell > page_size )
+        {
+            x = 0;
+            y += shelf_h;
+            shelf_h = 0;
+        }
+
+        if( y + cell > page_size )
+        {
+            page++;
+            x = y = shelf_h = 0;
+        }
+
+        images[i].page = page;
+        images[i].x = x;
+        images[i].y = y;
+
+        x += cell;
+        shelf_h = ( cell > shelf_h ) ? cell : shelf_h;
+    }
+
+    return page + 1;
+}
+
+
+// returns the order images are packed in, largest first: every body's level 0, then level 1...
+static int Image_Order( int i, int bodies, int levels )
+{
+    return( i % bodies ) * levels + i / bodies;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// packs count tex_size x tex_size textures into atlas pages and writes them to filename
+int ATL_Export( char *filename, uint32_t **textures, int count, int tex_size, int page_size,
+                int padding, int mips )
+{
+    if( page_size > ATL_MAX_PAGE || padding < 0 || tex_size + padding * 2 > page_size )
+    {
+        UTI_Print_Error( "Textures and their padding don't fit on an atlas page" );
+        return 0;
+    }
+
+    atl_job_type job = { textures, NULL, tex_size, 1, padding, page_size, NULL, NULL };
+
+    if( mips )
+    {
+        while( ( tex_size >> job.levels ) > 0 )
+        {
+            job.levels++;
+        }
+    }
+
+    // identical textures are packed once
+    uint32_t *index = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * count );
+    job.body_first = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * count );
+    int bodies = TXR_Find_Duplicates( textures, count, index, job.body_first );
+
+    int images = bodies * job.levels, i, level, size;
+    job.images = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( atl_image_type ) * images );
+
+    for( i = 0; i < images; i++ )
+    {
+        job.images[i].size = tex_size >> ( i % job.levels );
+        job.images[i].pixels = UTI_EC_Tag_Malloc( UTI_MEM_FILE,
+                                                  job.images[i].size * job.images[i].size );
+    }
+
+    THR_Parallel_For( bodies, Build_Levels, &job );
+
+    // pack in size order, then put the places back with their images
+    atl_image_type *sorted = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( atl_image_type ) * images );
+    for( i = 0; i < images; i++ )
+    {
+        sorted[i] = job.images[Image_Order( i, bodies, job.levels )];
+    }
+
+    int page_count = Pack_Images( sorted, images, page_size, padding );
+
+    for( i = 0; i < images; i++ )
+    {
+        job.images[Image_Order( i, bodies, job.levels )] = sorted[i];
+    }
+    UTI_EC_Free( sorted );
+
+    size_t page_bytes = (size_t)page_size * page_size;
+    job.pages = UTI_EC_Tag_Malloc( UTI_MEM_FILE, page_bytes * page_count );
+    memset( job.pages, 0, page_bytes * page_count );
+
+    THR_Parallel_For( images, Place_Image, &job );
+
+    // the header and table, padded so the pages start aligned
+    atl_header_type header = { { 'A', 'T', 'L', '1' }, ATL_VERSION, page_size, page_count, count,
+                               job.levels, padding, 0 };
+
+    size_t table_bytes = sizeof( atl_header_type ) + sizeof( atl_entry_type ) * count * job.levels;
+    header.pages_offset = ( table_bytes + ATL_ALIGN - 1 ) / ATL_ALIGN * ATL_ALIGN;
+
+    uint8_t *table = UTI_EC_Tag_Malloc( UTI_MEM_FILE, header.pages_offset );
+    memset( table, 0, header.pages_offset );
+    memcpy( table, &header, sizeof( atl_header_type ) );
+
+    atl_entry_type *entries = (atl_entry_type *)&table[sizeof( atl_header_type )], *e;
+    atl_image_type *image;
+    for( i = 0; i < count; i++ )
+    {
+        for( level = 0; level < job.levels; level++ )
+        {
+            image = &job.images[index[i] * job.levels + level];
+            size = image->size;
+            e = &entries[i * job.levels + level];
+
+            e->page = image->page;
+            e->x = image->x + padding;
+            e->y = image->y + padding;
+            e->size = size;
+            e->u0 = (float)e->x / page_size;
+            e->v0 = (float)e->y / page_size;
+            e->u1 = (float)( e->x + size ) / page_size;
+            e->v1 = (float)( e->y + size ) / page_size;
+        }
+    }
+
+    int ok = 1;
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create atlas file" );
+        ok = 0;
+    }
+    else
+    {
+        if( fwrite( table, header.pages_offset, 1, file ) != 1 ||
+            fwrite( job.pages, page_bytes, page_count, file ) != page_count )
+        {
+            UTI_Print_Error( "Unable to write atlas file" );
+            ok = 0;
+        }
+
+        if( fclose( file ) != 0 && ok )
+        {
+            UTI_Print_Error( "Unable to write atlas file" );
+            ok = 0;
+        }
+    }
+
+    printf( "Packed %d textures (%d distinct, %d levels) into %d %dx%d pages\n", count, bodies,
+            job.levels, page_count, page_size, page_size );
+
+    for( i = 0; i < images; i++ )
+    {
+        UTI_EC_Free( job.images[i].pixels );
+    }
+    UTI_EC_Free( job.images );
+    UTI_EC_Free( job.pages );
+    UTI_EC_Free( table );
+    UTI_EC_Free( job.body_first );
+    UTI_EC_Free( index );
+
+    return ok;
+}
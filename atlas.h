@@ -0,0 +1,77 @@
+/*
+    atlas.h
+    packs a set of textures (and optionally their mipmaps) into large square pages for the
+    game, so it can load them straight into memory rather than build an atlas itself.
+
+    file format, all values in machine byte order, made to be mapped into memory as it is:
+        atl_header_type
+        atl_entry_type[texture_count * levels]  - entry for texture t, mip level l is at
+                                                  t * levels + l, level 0 being full size
+        page_count pages from pages_offset      - page_size x page_size uint8_t palette
+                                                  indices each, rows top to bottom
+
+    every image is surrounded by padding texels copied from its nearest edge, so filtering or
+    rounding at the edges never picks up a neighbouring image. textures with the same content
+    are stored once and share entries
+*/
+
+#ifndef __atlas_h__
+#define __atlas_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define ATL_VERSION             1
+
+#define ATL_PAGE_SIZE           1024        // default page width and height in texels
+#define ATL_PADDING             2           // default padding around each image
+
+#define ATL_ALIGN               64          // pages start on a multiple of this many bytes
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+struct atl_header_s             {
+                                    char        magic[4];       // "ATL1"
+                                    uint32_t    version;
+                                    uint32_t    page_size;
+                                    uint32_t    page_count;
+                                    uint32_t    texture_count;
+                                    uint32_t    levels;         // mip levels per texture
+                                    uint32_t    padding;
+                                    uint32_t    pages_offset;   // bytes from the start of the file
+                                };
+typedef struct atl_header_s atl_header_type;
+
+// where one image is. x, y and size are in texels, not counting the padding, and the uvs are
+// the same rectangle as fractions of the page
+struct atl_entry_s              {
+                                    uint16_t    page;
+                                    uint16_t    x;
+                                    uint16_t    y;
+                                    uint16_t    size;
+
+                                    float       u0;
+                                    float       v0;
+                                    float       u1;
+                                    float       v1;
+                                };
+typedef struct atl_entry_s atl_entry_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// packs count tex_size x tex_size textures into page_size pages with padding texels around
+// each image and writes them to filename. with mips set every texture also gets mipmaps down
+// to 1 x 1, made by averaging in colour and matching back to the palette
+int ATL_Export( char *filename, uint32_t **textures, int count, int tex_size, int page_size,
+                int padding, int mips );
+
+#endif  // __atlas_h__
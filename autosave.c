@@ -0,0 +1,199 @@
+/*
+    autosave.c
+    timed background saves of a snapshot of the texture set
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+#include "texture.h"
+#include "autosave.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// everything below is shared with the autosave thread and protected by save_lock
+static SDL_mutex            *save_lock          = NULL;
+static SDL_cond             *save_wake          = NULL;         // signalled when there is work
+static thr_thread_type      *save_thread        = NULL;
+static int                  save_running        = 0;
+
+static char                 *save_filename      = NULL;
+static txr_set_type         save_snapshot;
+static int                  save_pending        = 0;            // snapshot waiting to be written
+static int                  save_busy           = 0;            // snapshot being written
+static int                  save_failed         = 0;            // a write failed since ASV_Failed
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// writes one snapshot and logs how long it took
+static int Write_Snapshot( txr_set_type *snapshot )
+{
+    struct stat info;
+    uint32_t start = GRA_Get_Ticks();
+
+    if( TXR_Save_File( save_filename, snapshot ) == 0 )
+    {
+        UTI_Print_Error( "Autosave failed" );
+        return 0;
+    }
+
+    long bytes = ( stat( save_filename, &info ) == 0 ) ? (long)info.st_size : -1;
+
+    UTI_Log( UTI_LOG_DEBUG, "Autosaved %d textures to '%s', %ld bytes in %ums", snapshot->count,
+             save_filename, bytes, GRA_Get_Ticks() - start );
+
+    return 1;
+}
+
+
+// autosave thread, writes each snapshot it is given and sleeps in between. a snapshot handed
+// over just before stopping is still written
+static int Save_Thread( void *data )
+{
+    txr_set_type snapshot;
+    int ok;
+
+    SDL_LockMutex( save_lock );
+    while( save_running || save_pending )
+    {
+        if( !save_pending )
+        {
+            SDL_CondWait( save_wake, save_lock );
+            continue;
+        }
+
+        snapshot = save_snapshot;
+        save_pending = 0;
+        save_busy = 1;
+
+        // the edit thread doesn't touch a snapshot once it is handed over, so it can be
+        // written without holding the lock
+        SDL_UnlockMutex( save_lock );
+        ok = Write_Snapshot( &snapshot );
+        TXR_Free_Set( &snapshot );
+        SDL_LockMutex( save_lock );
+
+        save_busy = 0;
+        save_failed |= !ok;
+    }
+    SDL_UnlockMutex( save_lock );
+
+    return 0;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// starts the autosave thread, autosaves of filename go to "filename.autosave"
+int ASV_Start( char *filename )
+{
+    save_filename = UTI_EC_Tag_Malloc( UTI_MEM_FILE, strlen( filename ) + 10 );
+    sprintf( save_filename, "%s.autosave", filename );
+
+    save_lock = SDL_CreateMutex();
+    save_wake = SDL_CreateCond();
+    if( save_lock == NULL || save_wake == NULL )
+    {
+        UTI_Print_Error( "Unable to create autosave lock" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    save_running = 1;
+    save_thread = THR_Create_Thread( Save_Thread, "autosave", NULL );
+    if( save_thread == NULL )
+    {
+        save_running = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// waits for any autosave in progress and stops the thread, removing the autosave file if asked
+void ASV_Stop( int remove_file )
+{
+    if( save_thread != NULL )
+    {
+        SDL_LockMutex( save_lock );
+        save_running = 0;
+        SDL_CondSignal( save_wake );
+        SDL_UnlockMutex( save_lock );
+
+        THR_Wait_Thread( save_thread );
+        save_thread = NULL;
+    }
+
+    SDL_DestroyCond( save_wake );
+    save_wake = NULL;
+    SDL_DestroyMutex( save_lock );
+    save_lock = NULL;
+
+    if( remove_file && save_filename != NULL )
+    {
+        unlink( save_filename );
+    }
+
+    UTI_EC_Free( save_filename );
+    save_filename = NULL;
+
+    return;
+}
+
+
+// hands a snapshot to the autosave thread, returns 0 if the last one is still being written
+int ASV_Save( txr_set_type *snapshot )
+{
+    if( save_thread == NULL )
+    {
+        return 0;
+    }
+
+    int taken = 0;
+
+    SDL_LockMutex( save_lock );
+    if( !save_pending && !save_busy )
+    {
+        save_snapshot = *snapshot;
+        save_pending = 1;
+        taken = 1;
+        SDL_CondSignal( save_wake );
+    }
+    SDL_UnlockMutex( save_lock );
+
+    return taken;
+}
+
+
+// returns 1 if an autosave failed to be written since the last call
+int ASV_Failed()
+{
+    if( save_thread == NULL )
+    {
+        return 0;
+    }
+
+    SDL_LockMutex( save_lock );
+    int failed = save_failed;
+    save_failed = 0;
+    SDL_UnlockMutex( save_lock );
+
+    return failed;
+}
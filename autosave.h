@@ -0,0 +1,37 @@
+/*
+    autosave.h
+    timed background saves. the edit thread hands over a snapshot of the texture set (made
+    with TXR_Snapshot, so it only shares the texel arrays) and carries on editing while the
+    snapshot is written out on the autosave thread
+*/
+
+#ifndef __autosave_h__
+#define __autosave_h__
+
+#include "texture.h"
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// starts the autosave thread, autosaves of filename go to "filename.autosave"
+int ASV_Start( char *filename );
+
+
+// waits for any autosave in progress and stops the thread. if remove_file is set the autosave
+// file is deleted, for when the real file has just been saved
+void ASV_Stop( int remove_file );
+
+
+// hands a snapshot to the autosave thread, which releases it once written. returns 0 without
+// taking the snapshot if the last autosave is still being written
+int ASV_Save( txr_set_type *snapshot );
+
+
+// returns 1 if a snapshot handed over since the last call failed to be written, in which case
+// the edits it held still need saving, otherwise 0
+int ASV_Failed();
+
+#endif  // __autosave_h__
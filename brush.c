@@ -0,0 +1,339 @@
+/*
+    brush.c
+    sized and shaped brushes for the pencil, drawn as precomputed spans
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utility.h"
+#include "raster.h"
+#include "brush.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// 4x4 ordered dither thresholds. a texel is drawn at dither level d if its threshold is
+// below 16 - 4d, so each level leaves out a quarter more of them, spread evenly
+static const uint8_t            bayer[4][4] = { {  0,  8,  2, 10 },
+                                                { 12,  4, 14,  6 },
+                                                {  3, 11,  1,  9 },
+                                                { 15,  7, 13,  5 } };
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// makes sure the span list can hold count spans
+static void Reserve_Spans( brs_brush_type *brush, int count )
+{
+    brush->spans = UTI_EC_Tag_Realloc( UTI_MEM_GENERAL, brush->spans, sizeof( brs_span_type ) * count );
+
+    return;
+}
+
+
+// adds a span to the list and widens the brush's reach to cover it
+static void Add_Span( brs_brush_type *brush, int dy, int x1, int x2, int src )
+{
+    brs_span_type *span = &brush->spans[brush->span_count++];
+    span->dy = dy;
+    span->x1 = x1;
+    span->x2 = x2;
+    span->src = src;
+
+    brush->left = ( x1 < brush->left ) ? x1 : brush->left;
+    brush->right = ( x2 > brush->right ) ? x2 : brush->right;
+    brush->top = ( dy < brush->top ) ? dy : brush->top;
+    brush->bottom = ( dy > brush->bottom ) ? dy : brush->bottom;
+
+    return;
+}
+
+
+// works out the spans of the brush's shape, centred on the middle texel, or the one up and
+// to the left of the middle for even sizes
+static void Build_Spans( brs_brush_type *brush )
+{
+    int size = brush->size, c = ( size - 1 ) / 2, x, y;
+
+    brush->span_count = 0;
+    brush->left = brush->top = brush->right = brush->bottom = 0;
+
+    switch( brush->shape )
+    {
+        case BRS_SQUARE:
+            Reserve_Spans( brush, size );
+            for( y = 0; y < size; y++ )
+            {
+                Add_Span( brush, y - c, -c, size - 1 - c, -1 );
+            }
+            break;
+
+        case BRS_ROUND:
+        {
+            // texel centres within the circle, pulled in a little so small brushes don't
+            // come out square
+            float mid = ( size - 1 ) / 2.0f, r = size / 2.0f, limit = r * r - r / 2.0f, dy, dx;
+
+            Reserve_Spans( brush, size );
+            for( y = 0; y < size; y++ )
+            {
+                dy = y - mid;
+                for( x = 0; x <= mid; x++ )
+                {
+                    dx = x - mid;
+                    if( dx * dx + dy * dy <= limit )
+                    {
+                        break;
+                    }
+                }
+
+                if( x <= mid )
+                {
+                    Add_Span( brush, y - c, x - c, size - 1 - x - c, -1 );
+                }
+            }
+            break;
+        }
+
+        case BRS_STAMP:
+        {
+            // one span for each run of texels that aren't see through
+            int w = brush->stamp_w, h = brush->stamp_h, cx = ( w - 1 ) / 2, cy = ( h - 1 ) / 2, start;
+            const uint32_t *row;
+
+            Reserve_Spans( brush, h * ( ( w + 1 ) / 2 ) );
+            for( y = 0; y < h; y++ )
+            {
+                row = &brush->stamp[y * w];
+                for( x = 0; x < w; )
+                {
+                    for( ; x < w && row[x] == RAS_KEEP; x++ );
+                    for( start = x; x < w && row[x] != RAS_KEEP; x++ );
+
+                    if( x > start )
+                    {
+                        Add_Span( brush, y - cy, start - cx, x - 1 - cx, y * w + start );
+                    }
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// makes a one texel square brush
+brs_brush_type *BRS_Create()
+{
+    brs_brush_type *brush = UTI_EC_Tag_Malloc( UTI_MEM_GENERAL, sizeof( brs_brush_type ) );
+    memset( brush, 0, sizeof( brs_brush_type ) );
+
+    brush->row = UTI_EC_Tag_Malloc( UTI_MEM_GENERAL, sizeof( uint32_t ) * BRS_MAX_STAMP );
+
+    BRS_Set_Shape( brush, BRS_SQUARE, 1 );
+
+    return brush;
+}
+
+
+// frees the brush with its stamp and pattern
+void BRS_Free( brs_brush_type *brush )
+{
+    if( brush == NULL )
+    {
+        return;
+    }
+
+    UTI_EC_Free( brush->stamp );
+    UTI_EC_Free( brush->pattern );
+    UTI_EC_Free( brush->spans );
+    UTI_EC_Free( brush->row );
+    UTI_EC_Free( brush );
+
+    return;
+}
+
+
+// changes the brush's shape and size, and works out its spans again
+int BRS_Set_Shape( brs_brush_type *brush, int shape, int size )
+{
+    if( shape == BRS_STAMP && brush->stamp == NULL )
+    {
+        UTI_Print_Error( "Select a region and take a stamp from it first" );
+        return 0;
+    }
+
+    brush->shape = shape;
+    brush->size = ( size < 1 ) ? 1 : ( size > BRS_MAX_SIZE ) ? BRS_MAX_SIZE : size;
+
+    Build_Spans( brush );
+
+    return 1;
+}
+
+
+// copies a region of a texture to be the stamp, with the transparent texels marked RAS_KEEP
+int BRS_Take_Stamp( brs_brush_type *brush, const uint32_t *texels, int size, int x, int y,
+                    int w, int h, uint32_t transparent )
+{
+    if( w > BRS_MAX_STAMP || h > BRS_MAX_STAMP )
+    {
+        UTI_Print_Error( "Region is too big for a brush stamp" );
+        return 0;
+    }
+
+    brush->stamp = UTI_EC_Tag_Realloc( UTI_MEM_TEXTURE, brush->stamp, sizeof( uint32_t ) * w * h );
+    brush->stamp_w = w;
+    brush->stamp_h = h;
+
+    int r, i;
+    const uint32_t *src;
+    for( r = 0; r < h; r++ )
+    {
+        src = &texels[( y + r ) * size + x];
+        for( i = 0; i < w; i++ )
+        {
+            brush->stamp[r * w + i] = ( src[i] == transparent ) ? RAS_KEEP : src[i];
+        }
+    }
+
+    return BRS_Set_Shape( brush, BRS_STAMP, brush->size );
+}
+
+
+// copies texels to be tiled in place of the drawing colour, or goes back to the colour
+void BRS_Set_Pattern( brs_brush_type *brush, const uint32_t *texels, int w, int h )
+{
+    if( texels == NULL )
+    {
+        UTI_EC_Free( brush->pattern );
+        brush->pattern = NULL;
+        brush->pattern_w = brush->pattern_h = 0;
+        return;
+    }
+
+    brush->pattern = UTI_EC_Tag_Realloc( UTI_MEM_TEXTURE, brush->pattern, sizeof( uint32_t ) * w * h );
+    memcpy( brush->pattern, texels, sizeof( uint32_t ) * w * h );
+    brush->pattern_w = w;
+    brush->pattern_h = h;
+
+    return;
+}
+
+
+// sets how much the dither mask leaves out
+void BRS_Set_Dither( brs_brush_type *brush, int dither )
+{
+    brush->dither = ( dither < 0 ) ? 0 : ( dither >= BRS_DITHER_LEVELS ) ? BRS_DITHER_LEVELS - 1 : dither;
+
+    return;
+}
+
+
+// draws the brush centred on texel (x, y). a plain brush fills its spans with the colour,
+// anything else first gathers each span's texels into row, with RAS_KEEP where the stamp is
+// see through or the dither mask leaves a texel out. patterns and the mask are lined up with
+// the texture rather than the brush
+void BRS_Dab( brs_brush_type *brush, uint32_t *texels, int size, int x, int y, uint32_t color )
+{
+    int plain = ( brush->shape != BRS_STAMP && brush->pattern == NULL && brush->dither == 0 );
+    int limit = 16 - brush->dither * 4, s, ty, x1, x2, tx, i;
+    const brs_span_type *span = brush->spans;
+    const uint32_t *pattern_row = NULL, *stamp_row = NULL;
+    const uint8_t *mask;
+    uint32_t *row = brush->row;
+
+    // nothing reaches the texture
+    if( x + brush->right < 0 || x + brush->left >= size || y + brush->bottom < 0 || y + brush->top >= size )
+    {
+        return;
+    }
+
+    for( s = 0; s < brush->span_count; s++, span++ )
+    {
+        ty = y + span->dy;
+        x1 = x + span->x1;
+        x2 = x + span->x2;
+
+        if( ty < 0 || ty >= size || x2 < 0 || x1 >= size )
+        {
+            continue;
+        }
+
+        if( plain )
+        {
+            RAS_Span( texels, size, size, x1, x2, ty, color );
+            continue;
+        }
+
+        // only the part of the span on the texture is gathered
+        if( span->src >= 0 )
+        {
+            stamp_row = &brush->stamp[span->src - x1];
+        }
+        if( brush->pattern != NULL )
+        {
+            pattern_row = &brush->pattern[( ty % brush->pattern_h ) * brush->pattern_w];
+        }
+
+        x1 = ( x1 < 0 ) ? 0 : x1;
+        x2 = ( x2 >= size ) ? size - 1 : x2;
+        mask = bayer[ty & 3];
+
+        for( tx = x1, i = 0; tx <= x2; tx++, i++ )
+        {
+            row[i] = ( span->src >= 0 ) ? stamp_row[tx] : ( pattern_row != NULL ) ?
+                     pattern_row[tx % brush->pattern_w] : color;
+            row[i] = ( mask[tx & 3] < limit ) ? row[i] : RAS_KEEP;
+        }
+
+        RAS_Copy_Span( texels, size, size, x1, x2, ty, row );
+    }
+
+    return;
+}
+
+
+// dabs the brush along a line with bresenham's algorithm, leaving out the first texel
+void BRS_Line( brs_brush_type *brush, uint32_t *texels, int size, int x1, int y1, int x2, int y2,
+               uint32_t color )
+{
+    int dx = abs( x2 - x1 ), sx = ( x1 < x2 ) ? 1 : -1;
+    int dy = -abs( y2 - y1 ), sy = ( y1 < y2 ) ? 1 : -1;
+    int err = dx + dy, e2;
+
+    while( x1 != x2 || y1 != y2 )
+    {
+        e2 = 2 * err;
+        if( e2 >= dy )
+        {
+            err += dy;
+            x1 += sx;
+        }
+        if( e2 <= dx )
+        {
+            err += dx;
+            y1 += sy;
+        }
+
+        BRS_Dab( brush, texels, size, x1, y1, color );
+    }
+
+    return;
+}
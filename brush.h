@@ -0,0 +1,116 @@
+/*
+    brush.h
+    brushes for the pencil. a brush is a square or round block of texels, or a stamp taken
+    from a region of a texture, and lays down the drawing colour or a pattern tiled across
+    the texture. either can go through an ordered dither mask, which is also fixed to the
+    texture so overlapping dabs line up.
+
+    the shape is worked out once, whenever it changes, as a list of horizontal spans around
+    the texel the brush is centred on. a dab is then one clipped span write per row, so it
+    costs the texels it covers and nothing more however big the brush is
+*/
+
+#ifndef __brush_h__
+#define __brush_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define BRS_MAX_SIZE            64          // widest square or round brush
+#define BRS_MAX_STAMP           256         // widest and tallest stamp
+#define BRS_DITHER_LEVELS       4           // none, then 3/4, 1/2 and 1/4 of the texels drawn
+
+// brush shapes
+enum    {
+            BRS_SQUARE,
+            BRS_ROUND,
+            BRS_STAMP,                  // needs a stamp taken with BRS_Take_Stamp first
+            BRS_SHAPES
+        };
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// a run of texels from (x1, dy) to (x2, dy) around the centre of the brush
+struct brs_span_s               {
+                                    int         dy;
+                                    int         x1;
+                                    int         x2;
+                                    int         src;        // stamp texel at x1, -1 if no stamp
+                                };
+typedef struct brs_span_s brs_span_type;
+
+struct brs_brush_s              {
+                                    int         shape;
+                                    int         size;       // width of square and round brushes
+                                    int         dither;     // 0 to BRS_DITHER_LEVELS - 1
+
+                                    uint32_t    *stamp;     // stamp_w x stamp_h texels, or NULL
+                                    int         stamp_w;
+                                    int         stamp_h;
+
+                                    uint32_t    *pattern;   // pattern_w x pattern_h texels, NULL
+                                    int         pattern_w;  // for the drawing colour
+                                    int         pattern_h;
+
+                                    // spans of the current shape, and the furthest they reach
+                                    // from the centre on each side
+                                    brs_span_type   *spans;
+                                    int         span_count;
+                                    int         left;
+                                    int         top;
+                                    int         right;
+                                    int         bottom;
+
+                                    uint32_t    *row;       // one span's texels, while dabbing
+                                };
+typedef struct brs_brush_s brs_brush_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// makes a one texel square brush with no pattern or dither, which draws like a plain pencil
+brs_brush_type *BRS_Create();
+
+
+// frees the brush with its stamp and pattern
+void BRS_Free( brs_brush_type *brush );
+
+
+// changes the brush to one of the BRS_ shapes, size is the width of square and round brushes
+// and is kept from 1 to BRS_MAX_SIZE
+int BRS_Set_Shape( brs_brush_type *brush, int shape, int size );
+
+
+// copies the w x h region at (x, y) of a size x size texture to be the brush's stamp and
+// changes the brush to it. texels of the transparent index are left out of the stamp
+int BRS_Take_Stamp( brs_brush_type *brush, const uint32_t *texels, int size, int x, int y,
+                    int w, int h, uint32_t transparent );
+
+
+// copies w x h texels to be tiled across the texture in place of the drawing colour, NULL
+// goes back to the drawing colour. stamps always draw their own texels
+void BRS_Set_Pattern( brs_brush_type *brush, const uint32_t *texels, int w, int h );
+
+
+// sets how many texels the dither mask leaves out, from 0 for none to BRS_DITHER_LEVELS - 1
+void BRS_Set_Dither( brs_brush_type *brush, int dither );
+
+
+// draws the brush centred on texel (x, y) of a size x size texture, clipped to the texture
+void BRS_Dab( brs_brush_type *brush, uint32_t *texels, int size, int x, int y, uint32_t color );
+
+
+// draws the brush at every texel of a line from (x1, y1) to (x2, y2) except the first, which
+// the last dab of a stroke has already covered
+void BRS_Line( brs_brush_type *brush, uint32_t *texels, int size, int x1, int y1, int x2, int y2,
+               uint32_t color );
+
+#endif  // __brush_h__
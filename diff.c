@@ -0,0 +1,499 @@
+/*
+    diff.c
+    compares and merges .txr files
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility.h"
+#include "thread.h"
+#include "texture.h"
+#include "diff.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+#define DIF_CHUNK               16          // textures a thread takes at a time
+
+enum dif_state                  {
+                                    DIF_SAME,
+                                    DIF_CHANGED,
+                                    DIF_ONLY_FIRST,     // the second file has fewer textures
+                                    DIF_ONLY_SECOND
+                                };
+
+// a rectangle of texels, empty while x1 < x0
+struct dif_box_s                {
+                                    int         x0;
+                                    int         y0;
+                                    int         x1;
+                                    int         y1;
+                                };
+typedef struct dif_box_s dif_box_type;
+
+// what was found for one texture
+struct dif_result_s             {
+                                    int         state;
+                                    int         texels;     // texels that differ
+                                    dif_box_type box;
+
+                                    // merges only
+                                    int         ours;       // texels changed in each copy
+                                    int         theirs;
+                                    int         conflicts;
+                                    dif_box_type conflict_box;
+
+                                    const char  *problem;   // set if a read failed
+                                };
+typedef struct dif_result_s dif_result_type;
+
+// everything the threads of a diff or merge share
+struct dif_job_s                {
+                                    txr_reader_type *files;     // a, b or base, ours, theirs
+                                    int         tex_size;
+                                    int         count;
+
+                                    dif_result_type *results;   // count of them
+                                    uint32_t    **merged;       // merges only
+                                };
+typedef struct dif_job_s dif_job_type;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns how many texels of a row differ
+UTI_AVX2_CLONES
+static int Count_Row_Changes( const uint32_t *restrict a, const uint32_t *restrict b, int count )
+{
+    int i, changed = 0;
+    for( i = 0; i < count; i++ )
+    {
+        changed += ( a[i] != b[i] );
+    }
+
+    return changed;
+}
+
+
+// merges one row, taking each texel from whichever of ours and theirs changed it. changes[0]
+// and changes[1] are added to for the texels changed in ours and theirs, and the number of
+// conflicts is returned
+UTI_AVX2_CLONES
+static int Merge_Row( const uint32_t *restrict base, const uint32_t *restrict ours,
+                      const uint32_t *restrict theirs, uint32_t *restrict dest, int count,
+                      int *changes )
+{
+    int i, ours_changed = 0, theirs_changed = 0, conflicts = 0;
+    uint32_t b, o, t;
+
+    for( i = 0; i < count; i++ )
+    {
+        b = base[i];
+        o = ours[i];
+        t = theirs[i];
+
+        dest[i] = ( o == b ) ? t : o;
+
+        ours_changed += ( o != b );
+        theirs_changed += ( t != b );
+        conflicts += ( o != b ) & ( t != b ) & ( o != t );
+    }
+
+    changes[0] += ours_changed;
+    changes[1] += theirs_changed;
+
+    return conflicts;
+}
+
+
+// grows box to take in texels x0 to x1 of row y
+static void Grow_Box( dif_box_type *box, int x0, int x1, int y )
+{
+    if( box->x1 < box->x0 )
+    {
+        box->x0 = x0;
+        box->x1 = x1;
+        box->y0 = y;
+    }
+
+    box->x0 = ( x0 < box->x0 ) ? x0 : box->x0;
+    box->x1 = ( x1 > box->x1 ) ? x1 : box->x1;
+    box->y1 = y;
+
+    return;
+}
+
+
+// compares two textures into result. rows are counted with the vector loop and only rows
+// that differ are searched for where
+static void Compare_Texels( const uint32_t *a, const uint32_t *b, int size, dif_result_type *result )
+{
+    int y, x0, x1, changed;
+    const uint32_t *row_a, *row_b;
+
+    for( y = 0; y < size; y++ )
+    {
+        row_a = &a[y * size];
+        row_b = &b[y * size];
+
+        if( ( changed = Count_Row_Changes( row_a, row_b, size ) ) == 0 )
+        {
+            continue;
+        }
+
+        for( x0 = 0; row_a[x0] == row_b[x0]; x0++ );
+        for( x1 = size - 1; row_a[x1] == row_b[x1]; x1-- );
+
+        result->texels += changed;
+        Grow_Box( &result->box, x0, x1, y );
+    }
+
+    result->state = ( result->texels > 0 ) ? DIF_CHANGED : DIF_SAME;
+
+    return;
+}
+
+
+// compares one chunk of textures, on one of the diff threads
+static int Compare_Chunk( int chunk, void *data )
+{
+    dif_job_type *job = data;
+    int texels = job->tex_size * job->tex_size, i, last = ( chunk + 1 ) * DIF_CHUNK;
+    uint32_t *a = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * texels * 2 );
+    uint32_t *b = &a[texels];
+    dif_result_type *result;
+
+    last = ( last < job->count ) ? last : job->count;
+
+    for( i = chunk * DIF_CHUNK; i < last; i++ )
+    {
+        result = &job->results[i];
+
+        if( i >= job->files[0].count || i >= job->files[1].count )
+        {
+            result->state = ( i >= job->files[1].count ) ? DIF_ONLY_FIRST : DIF_ONLY_SECOND;
+            continue;
+        }
+
+        if( TXR_Read_Texture( &job->files[0], i, a, &result->problem ) == 0 ||
+            TXR_Read_Texture( &job->files[1], i, b, &result->problem ) == 0 )
+        {
+            break;
+        }
+
+        Compare_Texels( a, b, job->tex_size, result );
+    }
+
+    UTI_EC_Free( a );
+
+    return( i == last );
+}
+
+
+// reads texture i of file into texels, or copies fallback if the file has fewer textures
+static int Read_Or_Copy( txr_reader_type *file, int i, uint32_t *texels, const uint32_t *fallback,
+                         int size, const char **problem )
+{
+    if( i < file->count )
+    {
+        return TXR_Read_Texture( file, i, texels, problem );
+    }
+
+    memcpy( texels, fallback, sizeof( uint32_t ) * size * size );
+
+    return 1;
+}
+
+
+// merges one chunk of textures, on one of the merge threads. a texture missing from a copy
+// is taken as unchanged, and one missing from the base as blank
+static int Merge_Chunk( int chunk, void *data )
+{
+    dif_job_type *job = data;
+    int size = job->tex_size, texels = size * size, i, y, x, conflicts, changes[2];
+    int last = ( chunk + 1 ) * DIF_CHUNK;
+    uint32_t *base = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * texels * 3 );
+    uint32_t *ours = &base[texels], *theirs = &base[texels * 2], *dest;
+    dif_result_type *result;
+    size_t row;
+
+    last = ( last < job->count ) ? last : job->count;
+
+    for( i = chunk * DIF_CHUNK; i < last; i++ )
+    {
+        result = &job->results[i];
+
+        if( i >= job->files[0].count )
+        {
+            memset( base, 0, sizeof( uint32_t ) * texels );
+        }
+        else if( TXR_Read_Texture( &job->files[0], i, base, &result->problem ) == 0 )
+        {
+            break;
+        }
+
+        if( Read_Or_Copy( &job->files[1], i, ours, base, size, &result->problem ) == 0 ||
+            Read_Or_Copy( &job->files[2], i, theirs, base, size, &result->problem ) == 0 )
+        {
+            break;
+        }
+
+        dest = job->merged[i] = TXR_Create( size );
+        changes[0] = changes[1] = 0;
+
+        for( y = 0; y < size; y++ )
+        {
+            row = (size_t)y * size;
+            conflicts = Merge_Row( &base[row], &ours[row], &theirs[row], &dest[row], size, changes );
+
+            if( conflicts == 0 )
+            {
+                continue;
+            }
+
+            // the texels that conflict keep ours, so find them by what theirs would have given
+            for( x = 0; x < size; x++ )
+            {
+                if( ours[row + x] != base[row + x] && theirs[row + x] != base[row + x] &&
+                    ours[row + x] != theirs[row + x] )
+                {
+                    Grow_Box( &result->conflict_box, x, x, y );
+                }
+            }
+            result->conflicts += conflicts;
+        }
+
+        TXR_Update_Hash( dest );
+
+        result->ours = changes[0];
+        result->theirs = changes[1];
+        result->state = ( changes[0] || changes[1] ) ? DIF_CHANGED : DIF_SAME;
+    }
+
+    UTI_EC_Free( base );
+
+    return( i == last );
+}
+
+
+// opens count files into files, closing any already open on failure
+static int Open_Files( char **filenames, txr_reader_type *files, int count )
+{
+    const char *problem = NULL;
+    int i, j;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( TXR_Open_Reader( filenames[i], &files[i], &problem ) == 0 )
+        {
+            UTI_Log( UTI_LOG_ERROR, "'%s': %s", filenames[i], problem );
+            for( j = 0; j < i; j++ )
+            {
+                TXR_Close_Reader( &files[j] );
+            }
+            return 0;
+        }
+
+        if( files[i].tex_size != files[0].tex_size )
+        {
+            UTI_Log( UTI_LOG_ERROR, "'%s' has %dx%d textures but '%s' has %dx%d", filenames[i],
+                     files[i].tex_size, files[i].tex_size, filenames[0], files[0].tex_size,
+                     files[0].tex_size );
+            for( j = 0; j <= i; j++ )
+            {
+                TXR_Close_Reader( &files[j] );
+            }
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// makes a cleared result for every texture of the job
+static void Create_Results( dif_job_type *job )
+{
+    job->results = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( dif_result_type ) * ( job->count + 1 ) );
+    memset( job->results, 0, sizeof( dif_result_type ) * ( job->count + 1 ) );
+
+    int i;
+    for( i = 0; i < job->count; i++ )
+    {
+        job->results[i].box.x1 = job->results[i].conflict_box.x1 = -1;
+    }
+
+    return;
+}
+
+
+// runs func over every chunk of the job's textures, logging the first read that failed
+static int Run_Job( dif_job_type *job, int (*func)( int, void * ) )
+{
+    int ok = THR_Parallel_For( ( job->count + DIF_CHUNK - 1 ) / DIF_CHUNK, func, job ), i;
+
+    for( i = 0; i < job->count && ok == 0; i++ )
+    {
+        if( job->results[i].problem != NULL )
+        {
+            UTI_Log( UTI_LOG_ERROR, "%s, texture %d", job->results[i].problem, i );
+            break;
+        }
+    }
+
+    return ok;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// prints the textures that differ between file_a and file_b
+int DIF_Compare( char *file_a, char *file_b, int *changed )
+{
+    char *filenames[2] = { file_a, file_b };
+    txr_reader_type files[2];
+
+    *changed = 0;
+
+    if( Open_Files( filenames, files, 2 ) == 0 )
+    {
+        return 0;
+    }
+
+    dif_job_type job = { files, files[0].tex_size, 0, NULL, NULL };
+    job.count = ( files[0].count > files[1].count ) ? files[0].count : files[1].count;
+
+    Create_Results( &job );
+
+    int i, ok = Run_Job( &job, Compare_Chunk );
+    dif_result_type *result;
+
+    for( i = 0; i < job.count && ok; i++ )
+    {
+        result = &job.results[i];
+
+        switch( result->state )
+        {
+            case DIF_CHANGED:
+                printf( "texture %-5d %d texels changed in (%d, %d) to (%d, %d)\n", i, result->texels,
+                        result->box.x0, result->box.y0, result->box.x1, result->box.y1 );
+                break;
+
+            case DIF_ONLY_FIRST:
+            case DIF_ONLY_SECOND:
+                printf( "texture %-5d only in '%s'\n", i,
+                        filenames[result->state == DIF_ONLY_SECOND] );
+                break;
+
+            default:
+                continue;
+        }
+
+        ( *changed )++;
+    }
+
+    if( ok )
+    {
+        printf( "%d of %d %dx%d textures differ\n", *changed, job.count, job.tex_size, job.tex_size );
+    }
+
+    UTI_EC_Free( job.results );
+    TXR_Close_Reader( &files[0] );
+    TXR_Close_Reader( &files[1] );
+
+    return ok;
+}
+
+
+// merges the changes made to base in ours and in theirs and saves the result to output
+int DIF_Merge( char *base, char *ours, char *theirs, char *output, int *conflicts )
+{
+    char *filenames[3] = { base, ours, theirs };
+    txr_reader_type files[3];
+
+    *conflicts = 0;
+
+    if( Open_Files( filenames, files, 3 ) == 0 )
+    {
+        return 0;
+    }
+
+    // layers can't be matched up between the copies, so only the flattened textures merge
+    int i;
+    for( i = 0; i < 3; i++ )
+    {
+        if( files[i].layer_count > 0 )
+        {
+            UTI_Log( UTI_LOG_WARN, "'%s' has %d layers, they are flattened in '%s'", filenames[i],
+                     files[i].layer_count, output );
+        }
+    }
+
+    dif_job_type job = { files, files[0].tex_size, 0, NULL, NULL };
+    job.count = ( files[1].count > files[2].count ) ? files[1].count : files[2].count;
+    job.count = ( files[0].count > job.count ) ? files[0].count : job.count;
+
+    Create_Results( &job );
+    job.merged = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE, sizeof( uint32_t * ) * ( job.count + 1 ) );
+    memset( job.merged, 0, sizeof( uint32_t * ) * ( job.count + 1 ) );
+
+    int ok = Run_Job( &job, Merge_Chunk ), changed = 0, conflicted = 0;
+    dif_result_type *result;
+
+    for( i = 0; i < job.count && ok; i++ )
+    {
+        result = &job.results[i];
+        if( result->state == DIF_SAME )
+        {
+            continue;
+        }
+
+        changed++;
+        printf( "texture %-5d %d texels from '%s', %d from '%s'", i, result->ours, ours,
+                result->theirs, theirs );
+
+        if( result->conflicts > 0 )
+        {
+            conflicted++;
+            *conflicts += result->conflicts;
+            printf( ", %d conflicts in (%d, %d) to (%d, %d)", result->conflicts,
+                    result->conflict_box.x0, result->conflict_box.y0, result->conflict_box.x1,
+                    result->conflict_box.y1 );
+        }
+
+        printf( "\n" );
+    }
+
+    if( ok )
+    {
+        // textures that merged to the same texels share them again in the saved file
+        txr_set_type set = { job.tex_size, job.count, job.merged };
+        TXR_Share_Duplicates( set.textures, set.count );
+        ok = TXR_Save_File( output, &set );
+
+        printf( "%d of %d textures changed, %d with conflicts (%d texels kept from '%s')\n",
+                changed, job.count, conflicted, *conflicts, ours );
+    }
+
+    for( i = 0; i < job.count; i++ )
+    {
+        TXR_Release( job.merged[i] );
+    }
+    UTI_EC_Free( job.merged );
+    UTI_EC_Free( job.results );
+
+    for( i = 0; i < 3; i++ )
+    {
+        TXR_Close_Reader( &files[i] );
+    }
+
+    return ok;
+}
@@ -0,0 +1,37 @@
+/*
+    diff.h
+    compares and merges .txr files without opening a window, for when two people have been
+    editing copies of the same file.
+
+    a diff lists every texture that differs between two files, with how many texels changed
+    and the rectangle they are in. a merge takes the file both copies started from (the base)
+    and combines the changes made in each: a texel changed in only one copy takes that change,
+    and a texel changed differently in both is a conflict, which keeps the first copy's texel
+    and is listed so it can be fixed by hand. layers are not merged: the textures are merged
+    as they look flattened and saved without layers, with a warning for each copy that had
+    them.
+
+    files are read a texture at a time rather than loaded whole, and the textures are shared
+    out between all the cores
+*/
+
+#ifndef __diff_h__
+#define __diff_h__
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// prints the textures that differ between file_a and file_b. changed is set to the number of
+// textures that differ, including any only one file has
+int DIF_Compare( char *file_a, char *file_b, int *changed );
+
+
+// merges the changes made to base in ours and in theirs and saves the result to output.
+// conflicts is set to the number of texels changed differently in both, which keep the texel
+// from ours. layered textures are merged flattened and saved without their layers
+int DIF_Merge( char *base, char *ours, char *theirs, char *output, int *conflicts );
+
+#endif  // __diff_h__
@@ -0,0 +1,496 @@
+/*
+    generate.c
+    procedural textures
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+#include "generate.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+#define RAMP_LEVELS             64          // shades in a pattern's colour ramp
+#define BAND_ROWS               16          // rows generated by a thread at a time
+
+#define OCTAVES                 4           // layers of noise added together, each twice as fine
+#define NOISE_CELLS             4           // noise lattice cells across the first octave
+
+#define BRICK_ROWS              8           // bricks are laid in 8 rows of 4
+#define BRICK_COLS              4
+#define TILE_COUNT              4           // tiles are a 4 x 4 grid
+#define WOOD_RINGS              6
+#define MARBLE_VEINS            3
+
+#define PI                      3.14159265f
+
+// a pattern writes values from 0 (the dark end of its ramp) to 1 (the light end) for one row
+// of the texture, scratch has room for another row
+struct gen_pattern_s            {
+                                    char        *name;
+                                    void        (*row)( float *row, float *scratch, int y,
+                                                        int size, uint32_t seed );
+                                    uint8_t     dark[3];
+                                    uint8_t     light[3];
+                                };
+typedef struct gen_pattern_s gen_pattern_type;
+
+// one generating job, shared by the threads working on it
+struct gen_job_s                {
+                                    uint32_t    **textures;
+                                    int         size;
+                                    uint32_t    seed;
+
+                                    const gen_pattern_type  *pattern;
+                                    uint32_t    ramp[RAMP_LEVELS];  // palette index of each shade
+                                };
+typedef struct gen_job_s gen_job_type;
+
+static void Noise_Row( float *row, float *scratch, int y, int size, uint32_t seed );
+static void Perlin_Row( float *row, float *scratch, int y, int size, uint32_t seed );
+static void Bricks_Row( float *row, float *scratch, int y, int size, uint32_t seed );
+static void Tiles_Row( float *row, float *scratch, int y, int size, uint32_t seed );
+static void Wood_Row( float *row, float *scratch, int y, int size, uint32_t seed );
+static void Marble_Row( float *row, float *scratch, int y, int size, uint32_t seed );
+
+static const gen_pattern_type   gen_patterns[GEN_COUNT] =
+                                {
+                                    { "noise",  Noise_Row,  {  24,  24,  24 }, { 224, 224, 224 } },
+                                    { "perlin", Perlin_Row, {  16,  32,  64 }, { 160, 192, 224 } },
+                                    { "bricks", Bricks_Row, {  40,  24,  16 }, { 192,  96,  64 } },
+                                    { "tiles",  Tiles_Row,  {  32,  32,  40 }, { 200, 200, 192 } },
+                                    { "wood",   Wood_Row,   {  64,  32,   0 }, { 192, 128,  64 } },
+                                    { "marble", Marble_Row, {  96,  96,  96 }, { 240, 240, 232 } }
+                                };
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+//=======================
+//  NOISE
+//=======================
+
+// mixes a lattice point and a seed into 32 well scrambled bits. integer only, so loops
+// calling it still vectorize
+static inline uint32_t Hash( uint32_t x, uint32_t y, uint32_t seed )
+{
+    uint32_t h = seed ^ ( x * 0x27d4eb2du ) ^ ( y * 0x165667b1u );
+
+    h ^= h >> 15;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+
+// returns a value from 0 to 1 for a lattice point
+static inline float Lattice_Value( uint32_t x, uint32_t y, uint32_t seed )
+{
+    return( Hash( x, y, seed ) >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+
+// returns the dot product of the gradient at a lattice point with (fx, fy). the gradient is
+// one of 8 directions, (+-1, +-0.5) or (+-0.5, +-1), picked by the hash. the bits are turned
+// into multipliers rather than used to choose between values, as the compiler won't
+// vectorize a choice between floats
+static inline float Lattice_Gradient( uint32_t x, uint32_t y, uint32_t seed, float fx, float fy )
+{
+    uint32_t h = Hash( x, y, seed );
+
+    float swap = (float)( ( h >> 2 ) & 1 );
+    float u = fx + ( fy - fx ) * swap;
+    float v = fy + ( fx - fy ) * swap;
+
+    return( 1.0f - (float)( h & 1 ) * 2.0f ) * u + ( 0.5f - (float)( ( h >> 1 ) & 1 ) ) * v;
+}
+
+
+// smooths the fraction across a lattice cell so the noise has no creases at cell edges
+static inline float Fade( float t )
+{
+    return t * t * t * ( t * ( t * 6.0f - 15.0f ) + 10.0f );
+}
+
+
+// adds amp times one octave of noise, cells lattice cells across, to a row of the texture.
+// the lattice wraps every cells cells, which is what makes the noise tile. it is always
+// inlined with gradient a constant, so each kind of noise gets a loop with no branches in it
+// that the compiler can vectorize
+static inline void Octave_Row(  float *restrict row, int y, int size, int cells, uint32_t seed,
+                                const int gradient, float amp )
+{
+    float py = ( y + 0.5f ) * cells / size;
+    int y0 = (int)py;
+    float fy = py - y0;
+    float sy = Fade( fy );
+    int y1 = ( y0 + 1 == cells ) ? 0 : y0 + 1;
+
+    float scale = (float)cells / size, px, fx, sx, a, b, c, d;
+    int x0, x1;
+
+    int x;
+    for( x = 0; x < size; x++ )
+    {
+        px = ( x + 0.5f ) * scale;
+        x0 = (int)px;
+        fx = px - x0;
+        sx = Fade( fx );
+        x1 = ( x0 + 1 ) * ( x0 + 1 != cells );
+
+        if( gradient )
+        {
+            a = Lattice_Gradient( x0, y0, seed, fx, fy );
+            b = Lattice_Gradient( x1, y0, seed, fx - 1.0f, fy );
+            c = Lattice_Gradient( x0, y1, seed, fx, fy - 1.0f );
+            d = Lattice_Gradient( x1, y1, seed, fx - 1.0f, fy - 1.0f );
+        }
+        else
+        {
+            a = Lattice_Value( x0, y0, seed );
+            b = Lattice_Value( x1, y0, seed );
+            c = Lattice_Value( x0, y1, seed );
+            d = Lattice_Value( x1, y1, seed );
+        }
+
+        a += ( b - a ) * sx;
+        c += ( d - c ) * sx;
+        row[x] += amp * ( a + ( c - a ) * sy );
+    }
+
+    return;
+}
+
+
+// adds amp times one octave of value or gradient noise to a row
+static void Add_Octave( float *row, int y, int size, int cells, uint32_t seed, int gradient,
+                        float amp )
+{
+    if( gradient )
+    {
+        Octave_Row( row, y, size, cells, seed, 1, amp );
+    }
+    else
+    {
+        Octave_Row( row, y, size, cells, seed, 0, amp );
+    }
+
+    return;
+}
+
+
+// fills a row with OCTAVES octaves of noise starting at cells lattice cells across, each
+// octave twice as fine and half as strong as the one before. value noise comes out from 0 to
+// 1, gradient noise roughly -1 to 1
+static void Fractal_Row( float *row, int y, int size, int cells, uint32_t seed, int gradient )
+{
+    memset( row, 0, sizeof( float ) * size );
+
+    float amp = 1.0f, total = 0.0f;
+    int octave;
+    for( octave = 0; octave < OCTAVES && ( octave == 0 || cells <= size ); octave++ )
+    {
+        Add_Octave( row, y, size, cells, seed + octave, gradient, amp );
+        total += amp;
+        amp *= 0.5f;
+        cells *= 2;
+    }
+
+    int x;
+    for( x = 0; x < size; x++ )
+    {
+        row[x] /= total;
+    }
+
+    return;
+}
+
+
+//=======================
+//  PATTERNS
+//=======================
+
+// plain fractal value noise
+static void Noise_Row( float *row, float *scratch, int y, int size, uint32_t seed )
+{
+    Fractal_Row( row, y, size, NOISE_CELLS, seed, 0 );
+
+    return;
+}
+
+
+// fractal gradient noise, softer and less blocky than value noise
+static void Perlin_Row( float *row, float *scratch, int y, int size, uint32_t seed )
+{
+    Fractal_Row( row, y, size, NOISE_CELLS, seed, 1 );
+
+    int x;
+    for( x = 0; x < size; x++ )
+    {
+        row[x] = row[x] * 0.5f + 0.5f;
+    }
+
+    return;
+}
+
+
+// bricks in staggered rows, each a slightly different shade, with dark mortar between them.
+// t / size picks the brick and t % size is how far into it the texel is, scaled up by the
+// number of bricks, so brick edges fall on the same texels whatever the texture size
+static void Bricks_Row( float *row, float *scratch, int y, int size, uint32_t seed )
+{
+    int mortar = ( size >= 64 ) ? size / 64 : 1;
+
+    int ty = y * BRICK_ROWS;
+    int brick_row = ty / size;
+    int in_mortar_row = ( ty % size ) < BRICK_ROWS * mortar;
+    int offset = ( brick_row & 1 ) ? size / ( 2 * BRICK_COLS ) : 0;
+
+    Fractal_Row( scratch, y, size, NOISE_CELLS * 4, seed ^ 0xb41c, 0 );
+
+    int x, tx, brick_col;
+    for( x = 0; x < size; x++ )
+    {
+        tx = ( ( x + offset ) % size ) * BRICK_COLS;
+        brick_col = tx / size;
+
+        if( in_mortar_row || ( tx % size ) < BRICK_COLS * mortar )
+        {
+            row[x] = 0.1f * scratch[x];
+        }
+        else
+        {
+            row[x] = 0.45f + 0.3f * Lattice_Value( brick_col, brick_row, seed ) + 0.25f * scratch[x];
+        }
+    }
+
+    return;
+}
+
+
+// a grid of square tiles with dark grout, each tile its own shade
+static void Tiles_Row( float *row, float *scratch, int y, int size, uint32_t seed )
+{
+    int grout = ( size >= 64 ) ? size / 64 : 1;
+
+    int ty = y * TILE_COUNT;
+    int tile_row = ty / size;
+    int in_grout_row = ( ty % size ) < TILE_COUNT * grout;
+
+    Fractal_Row( scratch, y, size, NOISE_CELLS * 2, seed ^ 0x711e, 0 );
+
+    int x, tx;
+    for( x = 0; x < size; x++ )
+    {
+        tx = x * TILE_COUNT;
+
+        if( in_grout_row || ( tx % size ) < TILE_COUNT * grout )
+        {
+            row[x] = 0.15f * scratch[x];
+        }
+        else
+        {
+            row[x] = 0.6f + 0.25f * Lattice_Value( tx / size, tile_row, seed ) + 0.15f * scratch[x];
+        }
+    }
+
+    return;
+}
+
+
+// rings running across the texture, pushed about by noise
+static void Wood_Row( float *row, float *scratch, int y, int size, uint32_t seed )
+{
+    Fractal_Row( scratch, y, size, NOISE_CELLS, seed, 1 );
+
+    float base = (float)y * WOOD_RINGS / size;
+
+    int x;
+    for( x = 0; x < size; x++ )
+    {
+        row[x] = 0.5f + 0.5f * sinf( 2.0f * PI * ( base + 0.6f * scratch[x] ) );
+    }
+
+    return;
+}
+
+
+// diagonal veins distorted by noise. the veins repeat a whole number of times across and
+// down so they still tile
+static void Marble_Row( float *row, float *scratch, int y, int size, uint32_t seed )
+{
+    Fractal_Row( scratch, y, size, NOISE_CELLS, seed, 1 );
+
+    float scale = (float)MARBLE_VEINS / size;
+
+    int x;
+    for( x = 0; x < size; x++ )
+    {
+        row[x] = 1.0f - fabsf( sinf( PI * ( ( x + y ) * scale + 1.5f * scratch[x] ) ) );
+    }
+
+    return;
+}
+
+
+//=======================
+//  JOBS
+//=======================
+
+// picks the palette colour for each shade of the pattern's ramp
+static void Build_Ramp( gen_job_type *job )
+{
+    const uint8_t *dark = job->pattern->dark, *light = job->pattern->light;
+
+    int i, c;
+    uint8_t rgb[3];
+    for( i = 0; i < RAMP_LEVELS; i++ )
+    {
+        for( c = 0; c < 3; c++ )
+        {
+            rgb[c] = dark[c] + ( light[c] - dark[c] ) * i / ( RAMP_LEVELS - 1 );
+        }
+        job->ramp[i] = GRA_Nearest_Palette_Index( rgb[0], rgb[1], rgb[2] );
+    }
+
+    return;
+}
+
+
+// generates rows y1 to y2 - 1 of a texture
+static void Generate_Rows( gen_job_type *job, uint32_t *texels, uint32_t seed, int y1, int y2 )
+{
+    int size = job->size;
+    float *row = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( float ) * size * 2 );
+
+    int x, y, level;
+    for( y = y1; y < y2; y++ )
+    {
+        job->pattern->row( row, &row[size], y, size, seed );
+
+        for( x = 0; x < size; x++ )
+        {
+            level = (int)( row[x] * ( RAMP_LEVELS - 1 ) + 0.5f );
+            level = ( level < 0 ) ? 0 : ( level >= RAMP_LEVELS ) ? RAMP_LEVELS - 1 : level;
+
+            texels[y * size + x] = job->ramp[level];
+        }
+    }
+
+    UTI_EC_Free( row );
+
+    return;
+}
+
+
+// generates one band of BAND_ROWS rows of a single texture
+static int Generate_Band( int band, void *data )
+{
+    gen_job_type *job = data;
+
+    int y1 = band * BAND_ROWS;
+    int y2 = ( y1 + BAND_ROWS < job->size ) ? y1 + BAND_ROWS : job->size;
+
+    Generate_Rows( job, job->textures[0], job->seed, y1, y2 );
+
+    return 1;
+}
+
+
+// generates the whole of texture index of a batch
+static int Generate_One( int index, void *data )
+{
+    gen_job_type *job = data;
+
+    Generate_Rows( job, job->textures[index], Hash( index, 0, job->seed ), 0, job->size );
+
+    return 1;
+}
+
+
+// sets up a job, returns 0 if type isn't a pattern
+static int Start_Job( gen_job_type *job, uint32_t **textures, int size, int type, uint32_t seed )
+{
+    if( type < 0 || type >= GEN_COUNT || size <= 0 )
+    {
+        UTI_Print_Error( "No such texture pattern" );
+        return 0;
+    }
+
+    job->textures = textures;
+    job->size = size;
+    job->seed = seed;
+    job->pattern = &gen_patterns[type];
+
+    Build_Ramp( job );
+
+    return 1;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// returns the name of pattern type, or NULL if there is no such pattern
+char *GEN_Get_Name( int type )
+{
+    return( type >= 0 && type < GEN_COUNT ) ? gen_patterns[type].name : NULL;
+}
+
+
+// returns the pattern called name, or -1 if there isn't one
+int GEN_Find( char *name )
+{
+    int i;
+    for( i = 0; i < GEN_COUNT; i++ )
+    {
+        if( strcmp( gen_patterns[i].name, name ) == 0 )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+// fills a size x size texture with pattern type, a band of rows at a time on each core
+int GEN_Texture( uint32_t *texels, int size, int type, uint32_t seed )
+{
+    gen_job_type job;
+
+    if( Start_Job( &job, &texels, size, type, seed ) == 0 )
+    {
+        return 0;
+    }
+
+    return THR_Parallel_For( ( size + BAND_ROWS - 1 ) / BAND_ROWS, Generate_Band, &job );
+}
+
+
+// fills count textures with pattern type, a whole texture at a time on each core
+int GEN_Textures( uint32_t **textures, int count, int size, int type, uint32_t seed )
+{
+    gen_job_type job;
+
+    if( Start_Job( &job, textures, size, type, seed ) == 0 )
+    {
+        return 0;
+    }
+
+    return THR_Parallel_For( count, Generate_One, &job );
+}
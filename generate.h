@@ -0,0 +1,51 @@
+/*
+    generate.h
+    procedural textures: value and perlin noise, bricks, tiles, wood and marble.
+
+    every pattern tiles, so the right edge of a texture matches its left and the bottom its
+    top, and is coloured with a ramp of palette colours picked from the current palette (which
+    has to exist first). the same pattern, size and seed always give the same texels
+*/
+
+#ifndef __generate_h__
+#define __generate_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+enum    {
+            GEN_NOISE,                  // value noise
+            GEN_PERLIN,                 // perlin gradient noise
+            GEN_BRICKS,
+            GEN_TILES,
+            GEN_WOOD,
+            GEN_MARBLE,
+            GEN_COUNT
+        };
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// returns the name of pattern type, or NULL if there is no such pattern
+char *GEN_Get_Name( int type );
+
+
+// returns the pattern called name, or -1 if there isn't one
+int GEN_Find( char *name );
+
+
+// fills a size x size texture with pattern type, its rows shared out over all the cores
+int GEN_Texture( uint32_t *texels, int size, int type, uint32_t seed );
+
+
+// fills count textures with pattern type, spread over all the cores a texture at a time.
+// each texture gets its own seed made from seed and its place in the list, so they all differ
+int GEN_Textures( uint32_t **textures, int count, int size, int type, uint32_t seed );
+
+#endif  // __generate_h__
@@ -1,15 +1,21 @@
 /*
-    graphics.h
-    a software graphics library using 2 banks of screen memory for double buffering.
-    all drawing is done to raw memory which are then transferred to a SDL_Surface of the same
-    res, which is then upscaled to another SDL_Surface to allow any window size to show any
-    lower resolution - ie a 320x200 resolution in a 1024x640 window.
+    graphics.c
+    a software graphics library using 3 banks of screen memory for triple buffering, so one
+    thread can draw the next frame while another shows the last. all drawing is done to raw
+    memory at a low resolution, and a finished frame is put on the screen by one of the
+    backends in the backends table: surface copies it to an SDL_Surface of the same res and
+    scales that onto the window surface, renderer streams it to an SDL_Texture for an
+    SDL_Renderer to scale, and offscreen only turns it into RGBA in memory. the window
+    backends let any window size show any lower resolution - ie a 320x200 resolution in a
+    1024x640 window.
 
     made for use with my texture and palette definitions to give an old fashioned look
 */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include <SDL2/SDL.h>
 
@@ -31,10 +37,30 @@ static SDL_Window           *scr_window         = NULL;         // display windo
 static SDL_Surface          *scr_surface        = NULL;         // window surface
 static SDL_Surface          *scr_render         = NULL;         // render surface
 
+static SDL_Renderer         *scr_renderer       = NULL;         // renderer backend only
+static SDL_Texture          *scr_texture        = NULL;         // streamed to every frame
+
+static uint32_t             *scr_offscreen      = NULL;         // offscreen backend's frame
+
 static SDL_Rect             scr_rect           = { 0, 0, 0, 0 };
 
-static uint32_t             *w_buffer           = NULL;         // buffer to write to
-static uint32_t             *r_buffer           = NULL;         // buffer to display (read from)
+static void                 *w_buffer           = NULL;         // buffer to write to
+static void                 *r_buffer           = NULL;         // buffer to display (read from)
+
+// triple buffering. the drawing thread owns the buffer at w_index and the window thread the
+// one at r_index. the third is handed between them by swapping indices with mid_index, which
+// has FRAME_NEW set when it holds a finished frame that hasn't been shown. neither thread
+// ever waits for the other
+#define FRAME_NEW               4
+#define FRAME_INDEX             3
+
+static int                  w_index             = 0;
+static int                  r_index             = 1;
+static atomic_int           mid_index           = 2;
+
+// set by GRA_Set_Indexed_Display, the buffers then hold one byte palette indices which are
+// only turned into RGBA when a frame is shown
+static int                  scr_indexed         = 0;
 
 static int                  scr_width           = 0;            // window dimensions
 static int                  scr_height          = 0;            
@@ -43,7 +69,7 @@ static int                  res_width           = 0;            // render dimens
 static int                  res_height          = 0;
 
 // double buffer to write to
-static scr_buffer_type      scr_buffer          = { 0, 0, NULL, NULL };
+static scr_buffer_type      scr_buffer          = { 0, 0, 0, { NULL, NULL, NULL } };
 
 static uint32_t             *palette            = NULL;
 
@@ -53,61 +79,114 @@ static uint32_t             *palette            = NULL;
 // font data is loaded here
 static uint8_t             *font_buffer        = NULL;
 
+//====================
+//  BACKENDS
+//====================
+
+// ways of getting a finished frame onto the screen. open creates whatever the backend needs
+// for a width x height window showing res_width x res_height frames, present shows r_buffer
+// and close frees it all
+struct gra_backend_s            {
+                                    char        *name;
+
+                                    int         (*open)( char *title, int width, int height );
+                                    void        (*present)();
+                                    void        (*close)();
+                                };
+typedef struct gra_backend_s gra_backend_type;
+
+static int  Surface_Open( char *title, int width, int height );
+static void Surface_Present();
+static void Surface_Close();
+static int  Renderer_Open( char *title, int width, int height );
+static void Renderer_Present();
+static void Renderer_Close();
+static int  Offscreen_Open( char *title, int width, int height );
+static void Offscreen_Present();
+static void Offscreen_Close();
+
+static gra_backend_type     backends[]          = {
+                                                    {   "surface",      Surface_Open,
+                                                        Surface_Present, Surface_Close },
+                                                    {   "renderer",     Renderer_Open,
+                                                        Renderer_Present, Renderer_Close },
+                                                    {   "offscreen",    Offscreen_Open,
+                                                        Offscreen_Present, Offscreen_Close }
+                                                  };
+
+#define BACKEND_COUNT           ( sizeof( backends ) / sizeof( backends[0] ) )
+
+static gra_backend_type     *scr_backend        = &backends[0];
+
+//====================
+//  INPUT
+//====================
+
+// input events waiting to be read by GRA_Next_Event, grows as needed so fast mouse movement
+// during a slow frame is never lost
+static gra_event_type       *event_queue        = NULL;
+static int                  event_size          = 0;            // allocated events
+static int                  event_count         = 0;            // events waiting
+static int                  event_read          = 0;            // next event to read
+
+// the trace being written by GRA_Record_Input, and how many GRA_Check_Quit calls there have
+// been since the last record was written
+static FILE                 *trace_file         = NULL;
+static uint32_t             trace_frames        = 0;
+
+// the trace being played back by GRA_Replay_Input instead of reading SDL's events
+static gra_trace_record_type    *replay         = NULL;
+static int                  replay_count        = 0;
+static int                  replay_next         = 0;
+
 //===============================================================
 //  PRIVATE FUNCTIONS
 //===============================================================
 
 // All int returning functions return 1 on success or 0 on failure unless otherwise stated
 
-// draws the w_buffer to the render surface
-void Draw_Buffer()
+// expands count palette indices to RGBA through lut, gcc vectorizes the loop
+UTI_AVX2_CLONES
+void Expand_Indexed( uint32_t *restrict dest, const uint8_t *restrict src,
+                     const uint32_t *restrict lut, int count )
 {
-    uint32_t *bufp;
-    bufp = scr_render->pixels;              // get pointer to surface pixel data
-    int x, y;
-
-    for( y = 0; y < scr_render->h; y++ )
+    int i;
+    for( i = 0; i < count; i++ )
     {
-        for( x = 0; x < scr_render->w; x++ )
-        {
-            *bufp = w_buffer[y * scr_render->w + x];
-            bufp++;
-        }
+        dest[i] = lut[src[i]];
     }
 
     return;
 }
 
 
-// swaps the pointers to w_buffer and r_buffer
-void Swap_Buffer()
+// draws the r_buffer as RGBA to dest, which has pitch bytes per row
+void Draw_Buffer( uint32_t *dest, int pitch )
 {
-    uint32_t *temp;
-    temp = w_buffer;
-    w_buffer = r_buffer;
-    r_buffer = temp;
-
-    return;
-}
-
+    int y;
 
+    for( y = 0; y < res_height; y++ )
+    {
+        // indexed frames are turned into RGBA here, once per frame
+        if( scr_indexed )
+        {
+            Expand_Indexed( dest, &( (uint8_t *)r_buffer )[y * res_width], palette, res_width );
+        }
+        else
+        {
+            memcpy( dest, &( (uint32_t *)r_buffer )[y * res_width], sizeof( uint32_t ) * res_width );
+        }
 
-//===============================================================
-//  FUNCTION BODIES
-//===============================================================
+        dest = (uint32_t *)( (uint8_t *)dest + pitch );
+    }
 
-// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+    return;
+}
 
-//=======================
-//  INITIALIZATION
-//=======================
 
-// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
-// writing to and initializes 2 SDL_Surfaces - one w_res x h_res which is stretched onto the
-// second which is width x height, which is rendered to the window.
-int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res )
+// starts SDL video and opens a window, used by the backends that show frames
+static int Open_Window( char *title, int width, int height )
 {
- 
     // initialize SDL
     if( SDL_Init( SDL_INIT_VIDEO ) != 0 )
     {
@@ -116,15 +195,6 @@ int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res
         return 0;
     }
 
-    
-    // set screen globals
-    scr_width = width;
-    scr_height = height;
-
-    res_width = w_res;
-    res_height = h_res;
-
-
     // create display window
     scr_window = SDL_CreateWindow(  title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                                     width, height, SDL_WINDOW_SHOWN );
@@ -135,6 +205,19 @@ int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res
         return 0;
     }
 
+    return 1;
+}
+
+
+// surface backend, frames are copied to a surface the size of the frame, which SDL scales
+// onto the window surface in software
+static int Surface_Open( char *title, int width, int height )
+{
+    if( Open_Window( title, width, height ) == 0 )
+    {
+        return 0;
+    }
+
     // create display surface
     scr_surface = SDL_GetWindowSurface( scr_window );
     if( scr_surface == NULL )
@@ -144,9 +227,8 @@ int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res
         return 0;
     }
 
-
     // create render surface
-    scr_render = SDL_CreateRGBSurface(  SDL_SWSURFACE, w_res, h_res, 32,
+    scr_render = SDL_CreateRGBSurface(  SDL_SWSURFACE, res_width, res_height, 32,
                                         R_MASK, G_MASK, B_MASK, A_MASK );
     if( scr_render == NULL )
     {
@@ -161,40 +243,406 @@ int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res
     scr_rect.w = width;
     scr_rect.h = height;
 
-    // create double buffer
+    return 1;
+}
+
+
+static void Surface_Present()
+{
+    Draw_Buffer( scr_render->pixels, scr_render->pitch );
+
+    SDL_BlitScaled( scr_render, NULL, scr_surface, &scr_rect );
+
+    SDL_UpdateWindowSurface( scr_window );
+
+    return;
+}
+
+
+static void Surface_Close()
+{
+    SDL_FreeSurface( scr_render );
+    scr_render = NULL;
+
+    SDL_DestroyWindow( scr_window );
+    scr_window = NULL;
+
+    return;
+}
+
+
+// renderer backend, frames are written straight into a streaming texture and the renderer
+// does the scaling, on the gpu if there is one or with its software renderer if not
+static int Renderer_Open( char *title, int width, int height )
+{
+    if( Open_Window( title, width, height ) == 0 )
+    {
+        return 0;
+    }
+
+    scr_renderer = SDL_CreateRenderer( scr_window, -1, 0 );
+    if( scr_renderer == NULL )
+    {
+        UTI_Print_Error( "Unable to create renderer" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    // RGBA32 is the byte order R G B A in memory whatever the machine, same as the masks
+    scr_texture = SDL_CreateTexture(    scr_renderer, SDL_PIXELFORMAT_RGBA32,
+                                        SDL_TEXTUREACCESS_STREAMING, res_width, res_height );
+    if( scr_texture == NULL )
+    {
+        UTI_Print_Error( "Unable to create streaming texture" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void Renderer_Present()
+{
+    void *pixels;
+    int pitch;
+
+    if( SDL_LockTexture( scr_texture, NULL, &pixels, &pitch ) != 0 )
+    {
+        return;
+    }
+
+    Draw_Buffer( pixels, pitch );
+    SDL_UnlockTexture( scr_texture );
+
+    SDL_RenderCopy( scr_renderer, scr_texture, NULL, NULL );
+    SDL_RenderPresent( scr_renderer );
+
+    return;
+}
+
+
+static void Renderer_Close()
+{
+    SDL_DestroyTexture( scr_texture );
+    scr_texture = NULL;
+
+    SDL_DestroyRenderer( scr_renderer );
+    scr_renderer = NULL;
+
+    SDL_DestroyWindow( scr_window );
+    scr_window = NULL;
+
+    return;
+}
+
+
+// offscreen backend, no window is opened and frames are only turned into RGBA in memory. for
+// running without a display and for timing everything but the final scale
+static int Offscreen_Open( char *title, int width, int height )
+{
+    scr_offscreen = UTI_EC_Tag_Malloc( UTI_MEM_FRAMEBUFFER,
+                                       sizeof( uint32_t ) * res_width * res_height );
+
+    return 1;
+}
+
+
+static void Offscreen_Present()
+{
+    Draw_Buffer( scr_offscreen, sizeof( uint32_t ) * res_width );
+
+    return;
+}
+
+
+static void Offscreen_Close()
+{
+    UTI_EC_Free( scr_offscreen );
+    scr_offscreen = NULL;
+
+    return;
+}
+
+
+// writes a colour (an index on an indexed display) to the write buffer at offset
+static inline void Put_Pixel( int offset, uint32_t color )
+{
+    if( scr_indexed )
+    {
+        ( (uint8_t *)w_buffer )[offset] = color;
+    }
+    else
+    {
+        ( (uint32_t *)w_buffer )[offset] = color;
+    }
+
+    return;
+}
+
+
+// writes one record to the trace file. the first record of a GRA_Check_Quit call carries
+// how many calls there have been since the last one
+void Record_Event( int type, uint32_t timestamp, int x, int y, int button, int key )
+{
+    gra_trace_record_type record = {    timestamp, ( trace_frames > 0xffff ) ? 0xffff : trace_frames,
+                                        type, button, x, y, key };
+
+    if( fwrite( &record, sizeof( gra_trace_record_type ), 1, trace_file ) != 1 )
+    {
+        UTI_Print_Error( "Unable to write input trace, recording stopped" );
+        fclose( trace_file );
+        trace_file = NULL;
+    }
+    trace_frames = 0;
+
+    return;
+}
+
+
+// adds an input event to the end of the event queue, and to the trace if one is being written
+void Queue_Event( int type, uint32_t timestamp, int x, int y, int button, int key, int wheel )
+{
+    if( trace_file != NULL )
+    {
+        Record_Event( type, timestamp, x, y, button, ( type == GRA_EVENT_WHEEL ) ? wheel : key );
+    }
+
+    // all events have been read, start from the beginning again
+    if( event_read == event_count )
+    {
+        event_read = 0;
+        event_count = 0;
+    }
+
+    if( event_count == event_size )
+    {
+        event_size = ( event_size ) ? event_size * 2 : 64;
+        event_queue = UTI_EC_Realloc( event_queue, sizeof( gra_event_type ) * event_size );
+    }
+
+    gra_event_type *e = &event_queue[event_count++];
+    e->type = type;
+    e->timestamp = timestamp;
+    e->x = x;
+    e->y = y;
+    e->button = button;
+    e->key = key;
+    e->wheel = wheel;
+
+    return;
+}
+
+
+// adds the events of the next recorded GRA_Check_Quit call to the event queue, returns 0 if
+// the user quit in it or it was the last one
+int Replay_Frame()
+{
+    gra_trace_record_type *r;
+    int first = 1;
+
+    while( replay_next < replay_count )
+    {
+        r = &replay[replay_next];
+        if( r->frames > 0 && !first )
+        {
+            break;
+        }
+
+        first = 0;
+        replay_next++;
+
+        if( r->type == GRA_TRACE_QUIT )
+        {
+            return 0;
+        }
+
+        Queue_Event(    r->type, r->timestamp, r->x, r->y, r->button,
+                        ( r->type == GRA_EVENT_WHEEL ) ? 0 : r->key,
+                        ( r->type == GRA_EVENT_WHEEL ) ? r->key : 0 );
+    }
+
+    return( replay_next < replay_count );
+}
+
+
+// converts SDL mouse buttons to the 1 for LMB, 2 for RMB used by GRA_Get_Mouse_State
+int Convert_Button( int sdl_button )
+{
+    switch( sdl_button )
+    {
+        case SDL_BUTTON_LEFT:
+            return 1;
+
+        case SDL_BUTTON_RIGHT:
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+
+// swaps w_buffer for the buffer waiting in the middle, marking it as a new frame. drawing
+// thread only
+void Swap_Write_Buffer()
+{
+    // acq_rel: the release publishes the finished frame, the acquire makes sure the window
+    // thread has finished reading the buffer being taken back
+    int old = atomic_exchange_explicit( &mid_index, w_index | FRAME_NEW, memory_order_acq_rel );
+
+    w_index = old & FRAME_INDEX;
+    w_buffer = scr_buffer.buffer[w_index];
+
+    return;
+}
+
+
+// swaps r_buffer for the newest finished frame, returns 0 if there isn't one. window thread
+// only
+int Swap_Read_Buffer()
+{
+    if( !( atomic_load_explicit( &mid_index, memory_order_acquire ) & FRAME_NEW ) )
+    {
+        return 0;
+    }
+
+    int old = atomic_exchange_explicit( &mid_index, r_index, memory_order_acq_rel );
+
+    r_index = old & FRAME_INDEX;
+    r_buffer = scr_buffer.buffer[r_index];
+
+    return 1;
+}
+
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+//=======================
+//  INITIALIZATION
+//=======================
+
+// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
+// writing to and sets up the backend chosen with GRA_Set_Backend to show w_res x h_res frames
+// stretched to fill the width x height window
+int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res )
+{
+    // set screen globals
+    scr_width = width;
+    scr_height = height;
+
+    res_width = w_res;
+    res_height = h_res;
+
+
+    if( scr_backend->open( title, width, height ) == 0 )
+    {
+        return 0;
+    }
+
+    // create triple buffer
     scr_buffer.w = w_res;
     scr_buffer.h = h_res;
-    scr_buffer.buffer1 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
-    scr_buffer.buffer2 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
+    scr_buffer.pixel_size = ( scr_indexed ) ? sizeof( uint8_t ) : sizeof( uint32_t );
+
+    int i;
+    for( i = 0; i < SCR_BUFFER_COUNT; i++ )
+    {
+        scr_buffer.buffer[i] = UTI_EC_Tag_Malloc( UTI_MEM_FRAMEBUFFER,
+                                                  scr_buffer.pixel_size * w_res * h_res );
+        memset( scr_buffer.buffer[i], 0, scr_buffer.pixel_size * w_res * h_res );
+    }
 
     // set write and read buffer pointers
-    w_buffer = scr_buffer.buffer1;
-    r_buffer = scr_buffer.buffer2;
+    w_index = 0;
+    r_index = 1;
+    atomic_store( &mid_index, 2 );
+    w_buffer = scr_buffer.buffer[w_index];
+    r_buffer = scr_buffer.buffer[r_index];
 
 
     return 1;
 }
 
 
+// makes the next display created use one byte palette indices for its buffers instead of RGBA
+void GRA_Set_Indexed_Display( int indexed )
+{
+    scr_indexed = indexed;
+
+    return;
+}
+
+
+// picks how frames are shown by the next display created, returns 0 if there is no backend
+// called name
+int GRA_Set_Backend( char *name )
+{
+    int i;
+    for( i = 0; i < BACKEND_COUNT; i++ )
+    {
+        if( strcmp( backends[i].name, name ) == 0 )
+        {
+            scr_backend = &backends[i];
+            return 1;
+        }
+    }
+
+    UTI_Print_Error( "Unknown display backend" );
+
+    return 0;
+}
+
+
+// returns the name of backend number index, or NULL once index is past the last one
+char *GRA_Get_Backend_Name( int index )
+{
+    if( index < 0 || index >= BACKEND_COUNT )
+    {
+        return NULL;
+    }
+
+    return backends[index].name;
+}
+
+
 // frees the SDL types, such as the window and surfaces and the 
 void GRA_Close()
 {
     // free SDL_ Structs
-    SDL_DestroyWindow( scr_window );
-    scr_window = NULL;
-
-    SDL_FreeSurface( scr_render );
-    scr_render = NULL;
+    scr_backend->close();
 
     // free screen buffers
-    UTI_EC_Free( scr_buffer.buffer1 );
-    scr_buffer.buffer1 = NULL;
-
-    UTI_EC_Free( scr_buffer.buffer2 );
-    scr_buffer.buffer2 = NULL;
+    int i;
+    for( i = 0; i < SCR_BUFFER_COUNT; i++ )
+    {
+        UTI_EC_Free( scr_buffer.buffer[i] );
+        scr_buffer.buffer[i] = NULL;
+    }
 
     // free font data
     UTI_EC_Free( font_buffer );
+    font_buffer = NULL;
+
+    // free input events
+    UTI_EC_Free( event_queue );
+    event_queue = NULL;
+    event_size = event_count = event_read = 0;
+
+    if( trace_file != NULL && fclose( trace_file ) != 0 )
+    {
+        UTI_Print_Error( "Unable to write input trace" );
+    }
+    trace_file = NULL;
+
+    UTI_EC_Free( replay );
+    replay = NULL;
+    replay_count = replay_next = 0;
     
     // TODO - free texture data
     
@@ -214,33 +662,191 @@ void GRA_Delay( int milli )
     return;
 }
 
-// check if user quits, by clicking window 'x' or pressed escape
+// wrapper for SDL_GetTicks, milliseconds since the display was created
+uint32_t GRA_Get_Ticks()
+{
+    return SDL_GetTicks();
+}
+
+// microseconds from SDL's high resolution counter
+uint64_t GRA_Get_Microseconds()
+{
+    static uint64_t frequency = 0;
+    if( frequency == 0 )
+    {
+        frequency = SDL_GetPerformanceFrequency();
+    }
+
+    uint64_t count = SDL_GetPerformanceCounter();
+
+    // split up so the multiply can't overflow
+    return ( count / frequency ) * 1000000 + ( count % frequency ) * 1000000 / frequency;
+}
+
+// check if user quits, by clicking window 'x' or pressed escape. every other mouse and key
+// event is queued for GRA_Next_Event
 int GRA_Check_Quit()
 {
     SDL_Event e;
+    int running = 1, x, y;
+
+    if( replay != NULL )
+    {
+        return Replay_Frame();
+    }
+
+    trace_frames++;
 
     while( SDL_PollEvent( &e ) != 0 )
     {
-        // check for user closing window
-        if( e.type == SDL_QUIT )
+        switch( e.type )
         {
-            return 0;
+            // check for user closing window
+            case SDL_QUIT:
+                running = 0;
+                break;
+
+            case SDL_KEYDOWN:
+                // check for user pressing escape
+                if( e.key.keysym.sym == SDLK_ESCAPE )
+                {
+                    running = 0;
+                }
+                else
+                {
+                    Queue_Event(    GRA_EVENT_KEY_DOWN, e.key.timestamp, 0, 0,
+                                    ( ( e.key.keysym.mod & KMOD_SHIFT ) ? GRA_MOD_SHIFT : 0 ) |
+                                    ( ( e.key.keysym.mod & KMOD_CTRL ) ? GRA_MOD_CTRL : 0 ),
+                                    e.key.keysym.sym, 0 );
+                }
+                break;
+
+            case SDL_MOUSEMOTION:
+                Queue_Event(    GRA_EVENT_MOTION, e.motion.timestamp, e.motion.x, e.motion.y,
+                                ( e.motion.state & SDL_BUTTON( SDL_BUTTON_LEFT ) ) ? 1 :
+                                ( e.motion.state & SDL_BUTTON( SDL_BUTTON_RIGHT ) ) ? 2 : 0, 0, 0 );
+                break;
+
+            case SDL_MOUSEBUTTONDOWN:
+                Queue_Event(    GRA_EVENT_BUTTON_DOWN, e.button.timestamp, e.button.x, e.button.y,
+                                Convert_Button( e.button.button ), 0, 0 );
+                break;
+
+            case SDL_MOUSEBUTTONUP:
+                Queue_Event(    GRA_EVENT_BUTTON_UP, e.button.timestamp, e.button.x, e.button.y,
+                                Convert_Button( e.button.button ), 0, 0 );
+                break;
+
+            case SDL_MOUSEWHEEL:
+                // wheel events don't carry the mouse position, so look it up
+                SDL_GetMouseState( &x, &y );
+                Queue_Event(    GRA_EVENT_WHEEL, e.wheel.timestamp, x, y, 0, 0,
+                                ( e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ) ? -e.wheel.y : e.wheel.y );
+                break;
+
+            default:
+                break;
         }
-        else if( e.type == SDL_KEYDOWN )
+    }
+
+    // flushed after every call with events, so a trace is still good if the program crashes
+    if( trace_file != NULL )
+    {
+        if( !running )
         {
-            // check for user pressing escape
-            switch( e.key.keysym.sym )
-            {
-                case SDLK_ESCAPE:
-                    return 0;
-                    break;
+            Record_Event( GRA_TRACE_QUIT, SDL_GetTicks(), 0, 0, 0, 0 );
+        }
 
-                default:
-                    break;
-            }
+        if( trace_frames == 0 && trace_file != NULL )
+        {
+            fflush( trace_file );
         }
     }
 
+    return running;
+}
+
+
+// takes the oldest input event collected by GRA_Check_Quit, returns 0 when there are none left
+int GRA_Next_Event( gra_event_type *event )
+{
+    if( event_read == event_count )
+    {
+        return 0;
+    }
+
+    *event = event_queue[event_read++];
+
+    return 1;
+}
+
+
+// starts writing the events GRA_Check_Quit collects to a trace file
+int GRA_Record_Input( char *filename, uint64_t context )
+{
+    gra_trace_header_type header = { { 'G', 'R', 'T', '1' }, GRA_TRACE_VERSION, context };
+
+    if( ( trace_file = fopen( filename, "wb" ) ) == NULL )
+    {
+        UTI_Print_Error( "Unable to create input trace" );
+        return 0;
+    }
+
+    if( fwrite( &header, sizeof( gra_trace_header_type ), 1, trace_file ) != 1 )
+    {
+        UTI_Print_Error( "Unable to write input trace" );
+        fclose( trace_file );
+        trace_file = NULL;
+        return 0;
+    }
+
+    trace_frames = 0;
+
+    return 1;
+}
+
+
+// loads a trace file for GRA_Check_Quit to play back
+int GRA_Replay_Input( char *filename, uint64_t *context )
+{
+    gra_trace_header_type header;
+    long size;
+
+    FILE *file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open input trace" );
+        return 0;
+    }
+
+    if( fread( &header, sizeof( gra_trace_header_type ), 1, file ) != 1 ||
+        memcmp( header.magic, "GRT1", 4 ) != 0 || header.version != GRA_TRACE_VERSION ||
+        fseek( file, 0, SEEK_END ) != 0 || ( size = ftell( file ) ) < 0 ||
+        fseek( file, sizeof( gra_trace_header_type ), SEEK_SET ) != 0 )
+    {
+        UTI_Print_Error( "Not an input trace" );
+        fclose( file );
+        return 0;
+    }
+
+    // a record cut short by a crash is left off
+    replay_count = ( size - sizeof( gra_trace_header_type ) ) / sizeof( gra_trace_record_type );
+    replay_next = 0;
+    replay = UTI_EC_Malloc( sizeof( gra_trace_record_type ) * ( replay_count + 1 ) );
+
+    if( fread( replay, sizeof( gra_trace_record_type ), replay_count, file ) != (size_t)replay_count )
+    {
+        UTI_Print_Error( "Unable to read input trace" );
+        UTI_EC_Free( replay );
+        replay = NULL;
+        replay_count = 0;
+        fclose( file );
+        return 0;
+    }
+
+    fclose( file );
+    *context = header.context;
+
     return 1;
 }
 
@@ -253,11 +859,8 @@ int GRA_Check_Quit()
 // clears the current buffer for writing
 void GRA_Clear_Screen()
 {
-    int i;
-    for( i = 0; i < res_width * res_height; i++ )
-    {
-        w_buffer[i] = 0;        // black
-    }
+    // black, or palette index 0 on an indexed display
+    memset( w_buffer, 0, scr_buffer.pixel_size * res_width * res_height );
 
     return;
 }
@@ -274,23 +877,53 @@ void GRA_Fill_Screen( int color_index )
 // switches buffers for the next write
 void GRA_Refresh_Window()
 {
-    Draw_Buffer();
-    Swap_Buffer();
+    GRA_Submit_Frame();
+    GRA_Present_Frame();
 
-    SDL_BlitScaled( scr_render, NULL, scr_surface, &scr_rect );
+    return;
+}
 
-    SDL_UpdateWindowSurface( scr_window );
+
+// hands w_buffer over as a finished frame and takes a free buffer to draw the next one in,
+// called from the drawing thread
+void GRA_Submit_Frame()
+{
+    Swap_Write_Buffer();
 
     return;
 }
 
 
+// returns 1 if a submitted frame hasn't been taken by the window thread yet
+int GRA_Frame_Pending()
+{
+    return( atomic_load_explicit( &mid_index, memory_order_acquire ) & FRAME_NEW ) != 0;
+}
 
-// generates a 256 colour palette
-int GRA_Generate_Palette()
+
+// takes the newest submitted frame if there is one and shows it, called from the window
+// thread. the drawing thread carries on with the next frame while this one is scaled
+int GRA_Present_Frame()
 {
+    if( Swap_Read_Buffer() == 0 )
+    {
+        return 0;
+    }
+
+    scr_backend->present();
+
+    return 1;
+}
+
 
-    palette = UTI_EC_Malloc( sizeof( uint32_t ) * PALETTE_SIZE );
+
+// generates a 256 colour palette, replacing the one made before
+int GRA_Generate_Palette()
+{
+    if( palette == NULL )
+    {
+        palette = UTI_EC_Tag_Malloc( UTI_MEM_PALETTE, sizeof( uint32_t ) * PALETTE_SIZE );
+    }
 
     int r, g, b, a = 0xff;
     for( r = 0; r < 8; r++ )
@@ -309,15 +942,99 @@ int GRA_Generate_Palette()
 
 
 
-// loads a 256 colour palette from file
+// frees the palette
+void GRA_Free_Palette()
+{
+    UTI_EC_Free( palette );
+    palette = NULL;
+
+    return;
+}
+
+
+
+// loads a 256 colour palette from file, replacing the one made before. the file is 256 r g b
+// byte triples
 int GRA_Load_Palette( char *filename )
 {
+    uint8_t rgb[PALETTE_SIZE * 3];
+
+    FILE *file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open palette file" );
+        return 0;
+    }
+
+    size_t got = fread( rgb, 3, PALETTE_SIZE, file );
+    fclose( file );
+
+    if( got != PALETTE_SIZE )
+    {
+        UTI_Print_Error( "Palette file is too short" );
+        return 0;
+    }
+
+    if( palette == NULL )
+    {
+        palette = UTI_EC_Tag_Malloc( UTI_MEM_PALETTE, sizeof( uint32_t ) * PALETTE_SIZE );
+    }
+
+    int i;
+    for( i = 0; i < PALETTE_SIZE; i++ )
+    {
+        palette[i] = GRA_Create_Color( rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2], 0xff );
+    }
 
     return 1;
 }
 
 
 
+// saves the palette to file as 256 r g b byte triples
+int GRA_Save_Palette( char *filename )
+{
+    uint8_t rgb[PALETTE_SIZE * 3];
+
+    int i;
+    for( i = 0; i < PALETTE_SIZE; i++ )
+    {
+        GRA_Get_Palette_RGB( i, &rgb[i * 3], &rgb[i * 3 + 1], &rgb[i * 3 + 2] );
+    }
+
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create palette file" );
+        return 0;
+    }
+
+    int ok = ( fwrite( rgb, sizeof( rgb ), 1, file ) == 1 );
+    ok = ( fclose( file ) == 0 ) && ok;
+
+    if( !ok )
+    {
+        UTI_Print_Error( "Unable to write palette file" );
+    }
+
+    return ok;
+}
+
+
+
+// sets the colour of palette index
+void GRA_Set_Palette_RGB( int index, uint8_t r, uint8_t g, uint8_t b )
+{
+    if( index >= 0 && index < PALETTE_SIZE )
+    {
+        palette[index] = GRA_Create_Color( r, g, b, 0xff );
+    }
+
+    return;
+}
+
+
+
 // returns corresponding uint32_t for r g b a colour
 uint32_t GRA_Create_Color( uint8_t r, uint8_t g, uint8_t b, uint8_t a )
 {
@@ -326,23 +1043,72 @@ uint32_t GRA_Create_Color( uint8_t r, uint8_t g, uint8_t b, uint8_t a )
 
 
 
-// returns color at given palette index
+// returns the colour to draw palette index with, the index itself on an indexed display
 uint32_t GRA_Get_Palette_Color( int index )
 {
-    if( index < 0 || index > PALETTE_SIZE )
+    if( index < 0 || index >= PALETTE_SIZE )
     {
         return 0;
     }
 
-    return palette[index];
+    return ( scr_indexed ) ? (uint32_t)index : palette[index];
+}
+
+
+// gets the red, green and blue of palette index
+void GRA_Get_Palette_RGB( int index, uint8_t *r, uint8_t *g, uint8_t *b )
+{
+    uint32_t c = ( index >= 0 && index < PALETTE_SIZE ) ? palette[index] : 0;
+
+    *r = ( c & R_MASK ) / R_ADJUST;
+    *g = ( c & G_MASK ) / G_ADJUST;
+    *b = ( c & B_MASK ) / B_ADJUST;
+
+    return;
+}
+
+
+// returns the colour to draw r g b with. an indexed display can only show palette colours, so
+// there it is the index of the closest one
+uint32_t GRA_Match_Color( uint8_t r, uint8_t g, uint8_t b )
+{
+    if( !scr_indexed )
+    {
+        return GRA_Create_Color( r, g, b, 0xff );
+    }
+
+    return GRA_Nearest_Palette_Index( r, g, b );
+}
+
+
+// returns the index of the palette colour closest to r g b
+int GRA_Nearest_Palette_Index( uint8_t r, uint8_t g, uint8_t b )
+{
+    int i, best = 0, dr, dg, db, dist, best_dist = 0x7fffffff;
+    uint32_t c;
+    for( i = 0; i < PALETTE_SIZE; i++ )
+    {
+        c = palette[i];
+        dr = (int)( ( c & R_MASK ) / R_ADJUST ) - r;
+        dg = (int)( ( c & G_MASK ) / G_ADJUST ) - g;
+        db = (int)( ( c & B_MASK ) / B_ADJUST ) - b;
+        dist = dr * dr + dg * dg + db * db;
+
+        if( dist < best_dist )
+        {
+            best_dist = dist;
+            best = i;
+        }
+    }
+
+    return best;
 }
 
 // draws a pixel at given coordinates, uses color variable as an index for the palette table,
 // not as a RGBA value to draw
 void GRA_Set_Palette_Pixel( int x, int y, int color )
 { 
-    printf( "%x\n", palette[color] );
-    GRA_Set_RGBA_Pixel( x, y, palette[color] );
+    GRA_Set_RGBA_Pixel( x, y, GRA_Get_Palette_Color( color ) );
 
     return;
 }
@@ -357,7 +1123,7 @@ void GRA_Set_RGBA_Pixel( int x, int y, uint32_t color )
         return;
     }
 
-    w_buffer[y*res_width + x] = color;
+    Put_Pixel( y*res_width + x, color );
 
     return;
 }
@@ -454,13 +1220,71 @@ void GRA_Draw_Hollow_Rectangle( int x, int y, int w, int h, uint32_t color )
 }
 
 
-// draws a filled rectangle to the screen - TODO - cant use until palette implemented
+// draws a filled rectangle to the screen, covering the same pixels as w vertical lines from
+// y to y+h. filled a row at a time, an indexed display fills each row with memset
 void GRA_Draw_Filled_Rectangle( int x, int y, int w, int h, uint32_t color )
 {
+    int x2 = x + w - 1, y2 = y + h;
+
+    if( x < 0 )                 x = 0;
+    if( y < 0 )                 y = 0;
+    if( x2 > res_width - 1 )    x2 = res_width - 1;
+    if( y2 > res_height - 1 )   y2 = res_height - 1;
+
+    if( x > x2 || y > y2 )
+    {
+        return;
+    }
+
     int i;
-    for( i = 0; i < w; i++ )
+    for( ; y <= y2; y++ )
+    {
+        if( scr_indexed )
+        {
+            memset( &( (uint8_t *)w_buffer )[y * res_width + x], color, x2 - x + 1 );
+            continue;
+        }
+
+        uint32_t *row = &( (uint32_t *)w_buffer )[y * res_width];
+        for( i = x; i <= x2; i++ )
+        {
+            row[i] = color;
+        }
+    }
+
+    return;
+}
+
+
+// draws a w x h image made of palette indices at (x, y), clipped to the screen
+void GRA_Draw_Indexed_Image( int x, int y, int w, int h, const uint8_t *pixels )
+{
+    // clip the image to the screen, keeping track of where it starts in pixels
+    int sx = 0, sy = 0, pitch = w;
+
+    if( x < 0 )                 { sx = -x; w += x; x = 0; }
+    if( y < 0 )                 { sy = -y; h += y; y = 0; }
+    if( x + w > res_width )     w = res_width - x;
+    if( y + h > res_height )    h = res_height - y;
+
+    if( w <= 0 || h <= 0 )
     {
-        GRA_Draw_Vertical_Line( x+i, y, y+h, color );
+        return;
+    }
+
+    int j;
+    const uint8_t *src;
+    for( j = 0; j < h; j++ )
+    {
+        src = &pixels[( sy + j ) * pitch + sx];
+        if( scr_indexed )
+        {
+            memcpy( &( (uint8_t *)w_buffer )[( y + j ) * res_width + x], src, w );
+        }
+        else
+        {
+            Expand_Indexed( &( (uint32_t *)w_buffer )[( y + j ) * res_width + x], src, palette, w );
+        }
     }
 
     return;
@@ -514,18 +1338,26 @@ int GRA_Load_Font( char *filename )
     if( filesize != FONT_FILE_SIZE )
     {
         UTI_Print_Error( "Font file is incorrect size" );
+        fclose( file );
         return 0;
     }
 
     // create temp buffer
     uint8_t *temp_buffer;
-    temp_buffer = UTI_EC_Malloc( filesize );
+    temp_buffer = UTI_EC_Tag_Malloc( UTI_MEM_FONT, filesize );
 
     // load data to buffer
-    fread( temp_buffer, filesize, 1, file );
+    if( fread( temp_buffer, filesize, 1, file ) != 1 )
+    {
+        UTI_Print_Error( "Unable to read font file" );
+        UTI_EC_Free( temp_buffer );
+        fclose( file );
+        return 0;
+    }
     
-    // create font buffer
-    font_buffer = UTI_EC_Malloc( filesize * CHAR_SIZE );
+    // create font buffer, a font loaded before is replaced
+    UTI_EC_Free( font_buffer );
+    font_buffer = UTI_EC_Tag_Malloc( UTI_MEM_FONT, filesize * CHAR_SIZE );
 
     // unpack font data
     int i, j;
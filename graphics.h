@@ -1,9 +1,13 @@
 /*
     graphics.h
-    a software graphics library using 2 banks of screen memory for double buffering.
-    all drawing is done to raw memory which are then transferred to a SDL_Surface of the same
-    res, which is then upscaled to another SDL_Surface to allow any window size to show any
-    lower resolution - ie a 320x200 resolution in a 1024x640 window.
+    a software graphics library using 3 banks of screen memory for triple buffering, so one
+    thread can draw the next frame while another shows the last. all drawing is done to raw
+    memory at a low resolution, and a finished frame is put on the screen by one of the
+    backends picked with GRA_Set_Backend: surface copies it to an SDL_Surface of the same res
+    and scales that onto the window surface, renderer streams it to an SDL_Texture for an
+    SDL_Renderer to scale, and offscreen only turns it into RGBA in memory. the window
+    backends let any window size show any lower resolution - ie a 320x200 resolution in a
+    1024x640 window.
 
     made for use with my texture and palette definitions to give an old fashioned look
 */
@@ -50,16 +54,82 @@
 //  STRUCTS AND TYPES
 //===============================================================
 
+// one buffer being drawn, one being shown and one holding the newest finished frame
+#define SCR_BUFFER_COUNT        3
+
 struct scr_buffer_s             {
                                     int         w;
                                     int         h;
+                                    int         pixel_size; // 1 on an indexed display, else 4
 
-                                    uint32_t    *buffer1;
-                                    uint32_t    *buffer2;
+                                    // uint8_t indices or uint32_t RGBA
+                                    void        *buffer[SCR_BUFFER_COUNT];
                                 };
 typedef struct scr_buffer_s scr_buffer_type;
 
 
+// input events kept by the event dispatcher
+enum    {
+            GRA_EVENT_MOTION,           // mouse moved, button holds the button held down (if any)
+            GRA_EVENT_BUTTON_DOWN,
+            GRA_EVENT_BUTTON_UP,
+            GRA_EVENT_KEY_DOWN,
+            GRA_EVENT_WHEEL
+        };
+
+struct gra_event_s              {
+                                    int         type;
+                                    uint32_t    timestamp;  // SDL ticks when the event happened
+
+                                    int         x;          // mouse position in window coords
+                                    int         y;
+                                    int         button;     // 1 for LMB, 2 for RMB, 0 for others,
+                                                            // GRA_MOD_ bits held for key events
+                                    int         key;        // SDL keycode for key events
+                                    int         wheel;      // wheel steps, positive is away from the user
+                                };
+typedef struct gra_event_s gra_event_type;
+
+// input traces written by GRA_Record_Input and played back by GRA_Replay_Input. all values
+// in machine byte order:
+//      gra_trace_header_type
+//      gra_trace_record_type for every event, in the order GRA_Check_Quit collected them
+// frames is how many GRA_Check_Quit calls there have been since the one that collected the
+// record before, so events collected together have 0 after the first. the last record is a
+// GRA_TRACE_QUIT if the session ended normally
+#define GRA_TRACE_VERSION       1
+#define GRA_TRACE_QUIT          255         // record type for the user quitting
+
+struct gra_trace_header_s       {
+                                    char        magic[4];   // "GRT1"
+                                    uint32_t    version;
+                                    uint64_t    context;    // given to GRA_Record_Input
+                                };
+typedef struct gra_trace_header_s gra_trace_header_type;
+
+struct gra_trace_record_s       {
+                                    uint32_t    timestamp;
+                                    uint16_t    frames;
+                                    uint8_t     type;       // GRA_EVENT_ or GRA_TRACE_QUIT
+                                    uint8_t     button;
+                                    int16_t     x;
+                                    int16_t     y;
+                                    int32_t     key;        // wheel steps for wheel events
+                                };
+typedef struct gra_trace_record_s gra_trace_record_type;
+
+// modifier keys held down during a key event
+#define GRA_MOD_SHIFT           1
+#define GRA_MOD_CTRL            2
+
+// SDL keycodes of the arrow keys, so callers can handle them without the SDL headers.
+// letter and digit keys are their lower case ASCII codes
+#define GRA_KEY_RIGHT           0x4000004F
+#define GRA_KEY_LEFT            0x40000050
+#define GRA_KEY_DOWN            0x40000051
+#define GRA_KEY_UP              0x40000052
+
+
 // TODO
 //struct  texture_s               {};
 
@@ -73,12 +143,30 @@ typedef struct scr_buffer_s scr_buffer_type;
 //  INITIALIZATION
 //=======================
 
-// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
-// writing to and initializes 2 SDL_Surfaces - one w_res x h_res which is stretched onto the
-// second which is width x height, which is rendered to the window.
+// creates the w_res x h_res buffers drawn to and has the backend chosen with GRA_Set_Backend
+// set up a width x height window to show them in, or nothing for the offscreen backend
 int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res );
 
 
+// call before GRA_Create_Display to choose how frames are shown: "surface" (the default)
+// scales with SDL surface blits, "renderer" streams frames to an SDL_Texture and lets an
+// SDL_Renderer scale them, "offscreen" opens no window and keeps frames in memory. returns 0 if
+// there is no backend called name
+int GRA_Set_Backend( char *name );
+
+
+// returns the name of backend number index, or NULL once index is past the last one
+char *GRA_Get_Backend_Name( int index );
+
+
+// call before GRA_Create_Display to draw into 8 bit palette indices instead of RGBA. drawing
+// writes a quarter of the memory and the palette is applied once per frame when it is shown,
+// so changes to the palette show up on the next frame. colours passed to the drawing
+// functions are then palette indices, use GRA_Get_Palette_Color and GRA_Match_Color to get
+// colours that work on either kind of display
+void GRA_Set_Indexed_Display( int indexed );
+
+
 // frees the SDL types, such as the window and surfaces and the 
 void GRA_Close();
 
@@ -90,9 +178,29 @@ void GRA_Close();
 // wrapper for SDL_Delay, stalls program for milli milliseconds
 void GRA_Delay( int milli );
 
-// check if user quits, by clicking window 'x' or pressed escape
+// wrapper for SDL_GetTicks, milliseconds since the display was created
+uint32_t GRA_Get_Ticks();
+
+// microseconds from SDL's high resolution counter, for timing short things
+uint64_t GRA_Get_Microseconds();
+
+// check if user quits, by clicking window 'x' or pressed escape. this also collects all other
+// waiting input events for GRA_Next_Event, so it should be called once every frame
 int GRA_Check_Quit();
 
+// takes the oldest input event collected by GRA_Check_Quit, returns 0 when there are none left
+int GRA_Next_Event( gra_event_type *event );
+
+// writes every event GRA_Check_Quit collects from now on, and the user quitting, to the trace
+// file filename. context is stored in the trace for whoever plays it back, to check they
+// start from the same place. the file is closed by GRA_Close
+int GRA_Record_Input( char *filename, uint64_t context );
+
+// loads the trace file filename, after which GRA_Check_Quit collects the recorded events
+// instead of reading SDL's, the events of one recorded call at a time, and returns 0 once
+// the user quits or the trace runs out. context is set to the trace's context
+int GRA_Replay_Input( char *filename, uint64_t *context );
+
 
 
 //=======================
@@ -112,23 +220,63 @@ void GRA_Fill_Screen( int color_index );
 void GRA_Refresh_Window();
 
 
-// generates a 256 colour palette
+// frames can be drawn on a different thread to the one that owns the window. the drawing
+// thread calls GRA_Submit_Frame when the buffer is finished and can start on the next frame
+// straight away, in another buffer. the window thread calls GRA_Present_Frame to show the
+// newest finished frame while the next is drawn. a frame submitted before the last one was
+// taken replaces it, so a drawing thread that doesn't want to drop frames waits for
+// GRA_Frame_Pending to return 0
+void GRA_Submit_Frame();
+
+// returns 1 if a submitted frame hasn't been taken by the window thread yet
+int GRA_Frame_Pending();
+
+// shows the newest submitted frame if there is one, returns 1 if a frame was shown
+int GRA_Present_Frame();
+
+
+// generates a 256 colour palette, replacing the one made before
 int GRA_Generate_Palette();
 
 
-// loads a 256 colour palette from file
+// frees the palette, which is kept when the display is closed
+void GRA_Free_Palette();
+
+
+// loads a 256 colour palette from file, replacing the one made before. the file is 256 r g b
+// byte triples
 int GRA_Load_Palette( char *filename );
 
 
+// saves the palette to file in the form GRA_Load_Palette reads
+int GRA_Save_Palette( char *filename );
+
+
+// sets the colour of palette index
+void GRA_Set_Palette_RGB( int index, uint8_t r, uint8_t g, uint8_t b );
+
+
 
 // returns corresponding uint32_t for r g b a colour
 uint32_t GRA_Create_Color( uint8_t r, uint8_t g, uint8_t b, uint8_t a );
 
 
-// returns color at given palette index
+// returns the colour to draw palette index with, the index itself on an indexed display
 uint32_t GRA_Get_Palette_Color( int index );
 
 
+// gets the red, green and blue of palette index
+void GRA_Get_Palette_RGB( int index, uint8_t *r, uint8_t *g, uint8_t *b );
+
+
+// returns the colour to draw r g b with, the closest palette index on an indexed display
+uint32_t GRA_Match_Color( uint8_t r, uint8_t g, uint8_t b );
+
+
+// returns the index of the palette colour closest to r g b
+int GRA_Nearest_Palette_Index( uint8_t r, uint8_t g, uint8_t b );
+
+
 // draws a pixel at given coordinates, uses color variable as an index for the palette table,
 // not as a RGBA value to draw
 void GRA_Set_Palette_Pixel( int x, int y, int color_index );
@@ -157,6 +305,10 @@ void GRA_Draw_Hollow_Rectangle( int x, int y, int w, int h, uint32_t color_rgba
 void GRA_Draw_Filled_Rectangle( int x, int y, int w, int h, uint32_t color_rgba );
 
 
+// draws a w x h image made of palette indices at (x, y), clipped to the screen
+void GRA_Draw_Indexed_Image( int x, int y, int w, int h, const uint8_t *pixels );
+
+
 
 //==========================
 //  TEXTURES
@@ -0,0 +1,427 @@
+/*
+    kernels.c
+    whole texture loops, specialized for each power of two size
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility.h"
+#include "kernels.h"
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+//=======================
+//  GENERIC KERNELS
+//=======================
+
+// these work for any size and scale, and are what the specialized kernels are checked and
+// timed against
+
+static void Blit_Generic( const uint32_t *texels, int size, int scale, uint8_t *dest )
+{
+    int x, y, k, w = size * scale;
+    uint8_t *row;
+
+    for( y = 0; y < size; y++ )
+    {
+        row = &dest[y * scale * w];
+        for( x = 0; x < size; x++ )
+        {
+            memset( &row[x * scale], texels[y * size + x], scale );
+        }
+
+        // the other rows of this texel row are the same
+        for( k = 1; k < scale; k++ )
+        {
+            memcpy( &row[k * w], row, w );
+        }
+    }
+
+    return;
+}
+
+
+static void Reduce_Generic( const uint32_t *texels, int size, int factor, uint8_t *dest )
+{
+    int x, y, w = size / factor;
+
+    for( y = 0; y < w; y++ )
+    {
+        for( x = 0; x < w; x++ )
+        {
+            dest[y * w + x] = texels[y * factor * size + x * factor];
+        }
+    }
+
+    return;
+}
+
+
+static void Flip_Generic( uint32_t *texels, int size )
+{
+    int x, y;
+    uint32_t t, *row;
+
+    for( y = 0; y < size; y++ )
+    {
+        row = &texels[y * size];
+        for( x = 0; x < size / 2; x++ )
+        {
+            t = row[x];
+            row[x] = row[size - 1 - x];
+            row[size - 1 - x] = t;
+        }
+    }
+
+    return;
+}
+
+
+static void Rotate_CW_Generic( uint32_t *texels, int size, uint32_t *scratch )
+{
+    memcpy( scratch, texels, sizeof( uint32_t ) * size * size );
+
+    int r, c;
+    for( r = 0; r < size; r++ )
+    {
+        for( c = 0; c < size; c++ )
+        {
+            texels[r * size + c] = scratch[( size - 1 - c ) * size + r];
+        }
+    }
+
+    return;
+}
+
+
+static void Rotate_CCW_Generic( uint32_t *texels, int size, uint32_t *scratch )
+{
+    memcpy( scratch, texels, sizeof( uint32_t ) * size * size );
+
+    int r, c;
+    for( r = 0; r < size; r++ )
+    {
+        for( c = 0; c < size; c++ )
+        {
+            texels[r * size + c] = scratch[c * size + ( size - 1 - r )];
+        }
+    }
+
+    return;
+}
+
+
+//=======================
+//  SPECIALIZED KERNELS
+//=======================
+
+// each macro makes the kernel for textures SIZE = 2^SHIFT texels across. they are the
+// generic loops above with the size, scale or factor fixed, so every multiply is a shift and
+// every loop bound a constant
+
+// scales up by 2^S
+#define BLIT_KERNEL( SIZE, SHIFT, S )                                                           \
+static void Blit_##SIZE##_##S( const uint32_t *texels, int size, int scale, uint8_t *dest )     \
+{                                                                                               \
+    int x, y, k;                                                                                \
+    uint8_t *row;                                                                               \
+                                                                                                \
+    for( y = 0; y < SIZE; y++ )                                                                 \
+    {                                                                                           \
+        row = &dest[y << ( SHIFT + S + S )];                                                    \
+        for( x = 0; x < SIZE; x++ )                                                             \
+        {                                                                                       \
+            memset( &row[x << S], texels[( y << SHIFT ) + x], 1 << S );                         \
+        }                                                                                       \
+                                                                                                \
+        for( k = 1; k < ( 1 << S ); k++ )                                                       \
+        {                                                                                       \
+            memcpy( &row[k << ( SHIFT + S )], row, SIZE << S );                                 \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    return;                                                                                     \
+}
+
+// shrinks by 2^R
+#define REDUCE_KERNEL( SIZE, SHIFT, R )                                                         \
+static void Reduce_##SIZE##_##R( const uint32_t *texels, int size, int factor, uint8_t *dest )  \
+{                                                                                               \
+    int x, y;                                                                                   \
+    const uint32_t *row;                                                                        \
+                                                                                                \
+    for( y = 0; y < ( SIZE >> R ); y++ )                                                        \
+    {                                                                                           \
+        row = &texels[y << ( SHIFT + R )];                                                      \
+        for( x = 0; x < ( SIZE >> R ); x++ )                                                    \
+        {                                                                                       \
+            dest[( y << ( SHIFT - R ) ) + x] = row[x << R];                                     \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    return;                                                                                     \
+}
+
+#define FLIP_KERNEL( SIZE, SHIFT )                                                              \
+static void Flip_##SIZE( uint32_t *texels, int size )                                           \
+{                                                                                               \
+    int x, y;                                                                                   \
+    uint32_t t, *row;                                                                           \
+                                                                                                \
+    for( y = 0; y < SIZE; y++ )                                                                 \
+    {                                                                                           \
+        row = &texels[y << SHIFT];                                                              \
+        for( x = 0; x < SIZE / 2; x++ )                                                         \
+        {                                                                                       \
+            t = row[x];                                                                         \
+            row[x] = row[SIZE - 1 - x];                                                         \
+            row[SIZE - 1 - x] = t;                                                              \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    return;                                                                                     \
+}
+
+// rotations read down the columns of the copy, so they work through the texture in square
+// tiles small enough that the columns stay in the cache
+#define ROTATE_TILE( SIZE )     ( ( SIZE < 16 ) ? SIZE : 16 )
+
+#define ROTATE_KERNELS( SIZE, SHIFT )                                                           \
+static void Rotate_CW_##SIZE( uint32_t *texels, int size, uint32_t *scratch )                   \
+{                                                                                               \
+    memcpy( scratch, texels, sizeof( uint32_t ) << ( SHIFT + SHIFT ) );                         \
+                                                                                                \
+    int tr, tc, r, c;                                                                           \
+    for( tr = 0; tr < SIZE; tr += ROTATE_TILE( SIZE ) )                                         \
+    {                                                                                           \
+        for( tc = 0; tc < SIZE; tc += ROTATE_TILE( SIZE ) )                                     \
+        {                                                                                       \
+            for( r = tr; r < tr + ROTATE_TILE( SIZE ); r++ )                                    \
+            {                                                                                   \
+                for( c = tc; c < tc + ROTATE_TILE( SIZE ); c++ )                                \
+                {                                                                               \
+                    texels[( r << SHIFT ) + c] = scratch[( ( SIZE - 1 - c ) << SHIFT ) + r];    \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    return;                                                                                     \
+}                                                                                               \
+                                                                                                \
+static void Rotate_CCW_##SIZE( uint32_t *texels, int size, uint32_t *scratch )                  \
+{                                                                                               \
+    memcpy( scratch, texels, sizeof( uint32_t ) << ( SHIFT + SHIFT ) );                         \
+                                                                                                \
+    int tr, tc, r, c;                                                                           \
+    for( tr = 0; tr < SIZE; tr += ROTATE_TILE( SIZE ) )                                         \
+    {                                                                                           \
+        for( tc = 0; tc < SIZE; tc += ROTATE_TILE( SIZE ) )                                     \
+        {                                                                                       \
+            for( r = tr; r < tr + ROTATE_TILE( SIZE ); r++ )                                    \
+            {                                                                                   \
+                for( c = tc; c < tc + ROTATE_TILE( SIZE ); c++ )                                \
+                {                                                                               \
+                    texels[( r << SHIFT ) + c] = scratch[( c << SHIFT ) + ( SIZE - 1 - r )];    \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    return;                                                                                     \
+}
+
+// the kernels every size has, blits up to the 256 texels of the edit area are added below
+#define SIZE_KERNELS( SIZE, SHIFT )                                                             \
+    REDUCE_KERNEL( SIZE, SHIFT, 1 )                                                             \
+    REDUCE_KERNEL( SIZE, SHIFT, 2 )                                                             \
+    REDUCE_KERNEL( SIZE, SHIFT, 3 )                                                             \
+    FLIP_KERNEL( SIZE, SHIFT )                                                                  \
+    ROTATE_KERNELS( SIZE, SHIFT )
+
+SIZE_KERNELS( 8, 3 )
+SIZE_KERNELS( 16, 4 )
+SIZE_KERNELS( 32, 5 )
+SIZE_KERNELS( 64, 6 )
+SIZE_KERNELS( 128, 7 )
+SIZE_KERNELS( 256, 8 )
+
+BLIT_KERNEL( 8, 3, 0 )      BLIT_KERNEL( 8, 3, 1 )      BLIT_KERNEL( 8, 3, 2 )
+BLIT_KERNEL( 8, 3, 3 )      BLIT_KERNEL( 8, 3, 4 )      BLIT_KERNEL( 8, 3, 5 )
+BLIT_KERNEL( 16, 4, 0 )     BLIT_KERNEL( 16, 4, 1 )     BLIT_KERNEL( 16, 4, 2 )
+BLIT_KERNEL( 16, 4, 3 )     BLIT_KERNEL( 16, 4, 4 )
+BLIT_KERNEL( 32, 5, 0 )     BLIT_KERNEL( 32, 5, 1 )     BLIT_KERNEL( 32, 5, 2 )
+BLIT_KERNEL( 32, 5, 3 )
+BLIT_KERNEL( 64, 6, 0 )     BLIT_KERNEL( 64, 6, 1 )     BLIT_KERNEL( 64, 6, 2 )
+BLIT_KERNEL( 128, 7, 0 )    BLIT_KERNEL( 128, 7, 1 )
+BLIT_KERNEL( 256, 8, 0 )
+
+
+//=======================
+//  TABLES
+//=======================
+
+#define GENERIC_BLITS           Blit_Generic, Blit_Generic, Blit_Generic, Blit_Generic, Blit_Generic, Blit_Generic
+
+static const krn_table_type     krn_generic =
+                                {
+                                    0,
+                                    { GENERIC_BLITS },
+                                    { Reduce_Generic, Reduce_Generic, Reduce_Generic, Reduce_Generic },
+                                    Flip_Generic, Rotate_CW_Generic, Rotate_CCW_Generic
+                                };
+
+// scales that would take a texture past 256 texels use the generic blit
+static const krn_table_type     krn_tables[] =
+{
+    {   8,  { Blit_8_0, Blit_8_1, Blit_8_2, Blit_8_3, Blit_8_4, Blit_8_5 },
+            { Reduce_Generic, Reduce_8_1, Reduce_8_2, Reduce_8_3 },
+            Flip_8, Rotate_CW_8, Rotate_CCW_8 },
+
+    {   16, { Blit_16_0, Blit_16_1, Blit_16_2, Blit_16_3, Blit_16_4, Blit_Generic },
+            { Reduce_Generic, Reduce_16_1, Reduce_16_2, Reduce_16_3 },
+            Flip_16, Rotate_CW_16, Rotate_CCW_16 },
+
+    {   32, { Blit_32_0, Blit_32_1, Blit_32_2, Blit_32_3, Blit_Generic, Blit_Generic },
+            { Reduce_Generic, Reduce_32_1, Reduce_32_2, Reduce_32_3 },
+            Flip_32, Rotate_CW_32, Rotate_CCW_32 },
+
+    {   64, { Blit_64_0, Blit_64_1, Blit_64_2, Blit_Generic, Blit_Generic, Blit_Generic },
+            { Reduce_Generic, Reduce_64_1, Reduce_64_2, Reduce_64_3 },
+            Flip_64, Rotate_CW_64, Rotate_CCW_64 },
+
+    {   128, { Blit_128_0, Blit_128_1, Blit_Generic, Blit_Generic, Blit_Generic, Blit_Generic },
+            { Reduce_Generic, Reduce_128_1, Reduce_128_2, Reduce_128_3 },
+            Flip_128, Rotate_CW_128, Rotate_CCW_128 },
+
+    {   256, { Blit_256_0, Blit_Generic, Blit_Generic, Blit_Generic, Blit_Generic, Blit_Generic },
+            { Reduce_Generic, Reduce_256_1, Reduce_256_2, Reduce_256_3 },
+            Flip_256, Rotate_CW_256, Rotate_CCW_256 }
+};
+
+#define KRN_TABLE_COUNT         ( sizeof( krn_tables ) / sizeof( krn_tables[0] ) )
+
+
+//=======================
+//  DISPATCH
+//=======================
+
+// returns log2 of n, or -1 if n isn't a power of 2
+static int Log2( int n )
+{
+    int shift = 0;
+    while( n > 1 && ( n & 1 ) == 0 )
+    {
+        n >>= 1;
+        shift++;
+    }
+
+    return( n == 1 ) ? shift : -1;
+}
+
+
+// returns k if it is the table for size, otherwise the generic table
+static const krn_table_type *Check_Table( const krn_table_type *k, int size )
+{
+    return( k != NULL && k->size == size ) ? k : &krn_generic;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// returns the kernels for size x size textures
+const krn_table_type *KRN_Select( int size )
+{
+    int i;
+    for( i = 0; i < KRN_TABLE_COUNT; i++ )
+    {
+        if( krn_tables[i].size == size )
+        {
+            return &krn_tables[i];
+        }
+    }
+
+    return &krn_generic;
+}
+
+
+// returns the generic kernels, which work for any size
+const krn_table_type *KRN_Generic()
+{
+    return &krn_generic;
+}
+
+
+// scales size x size texels up by scale into dest
+void KRN_Blit( const krn_table_type *k, const uint32_t *texels, int size, int scale, uint8_t *dest )
+{
+    int shift = Log2( scale );
+
+    k = Check_Table( k, size );
+    if( shift >= 0 && shift < KRN_SCALES )
+    {
+        k->blit[shift]( texels, size, scale, dest );
+    }
+    else
+    {
+        Blit_Generic( texels, size, scale, dest );
+    }
+
+    return;
+}
+
+
+// shrinks size x size texels by factor into dest
+void KRN_Reduce( const krn_table_type *k, const uint32_t *texels, int size, int factor, uint8_t *dest )
+{
+    int shift = Log2( factor );
+
+    k = Check_Table( k, size );
+    if( shift >= 0 && shift < KRN_REDUCTIONS )
+    {
+        k->reduce[shift]( texels, size, factor, dest );
+    }
+    else
+    {
+        Reduce_Generic( texels, size, factor, dest );
+    }
+
+    return;
+}
+
+
+// mirrors a whole texture left to right
+void KRN_Flip_Horizontal( const krn_table_type *k, uint32_t *texels, int size )
+{
+    Check_Table( k, size )->flip_h( texels, size );
+
+    return;
+}
+
+
+// rotates a whole texture by a quarter turn, clockwise if turns is 1 or anticlockwise if -1
+void KRN_Rotate( const krn_table_type *k, uint32_t *texels, int size, int turns )
+{
+    uint32_t *scratch = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * size * size );
+
+    k = Check_Table( k, size );
+    if( turns == 1 )
+    {
+        k->rotate_cw( texels, size, scratch );
+    }
+    else
+    {
+        k->rotate_ccw( texels, size, scratch );
+    }
+
+    UTI_EC_Free( scratch );
+
+    return;
+}
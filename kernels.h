@@ -0,0 +1,77 @@
+/*
+    kernels.h
+    the loops run over whole textures most often: drawing a texture scaled up, shrinking one
+    for a thumbnail, flipping and rotating. textures are nearly always a power of two from
+    8 to 256 texels across and scaled by a power of two, so there is a copy of each loop for
+    every one of those sizes (and scales) with the numbers fixed at compile time, turning the
+    multiplies into shifts and letting the compiler unroll the short loops.
+
+    KRN_Select picks the table of loops for a texture size once, when a file is opened. sizes
+    without their own loops get the generic table, which works for anything
+*/
+
+#ifndef __kernels_h__
+#define __kernels_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define KRN_SCALES              6           // scales 1 to 32 have their own blits
+#define KRN_REDUCTIONS          4           // shrinking by 2 to 8 has its own loops
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// every kernel is passed the size, and the scale or factor, even though most ignore them
+typedef void (*krn_blit_func)( const uint32_t *texels, int size, int scale, uint8_t *dest );
+typedef void (*krn_reduce_func)( const uint32_t *texels, int size, int factor, uint8_t *dest );
+typedef void (*krn_flip_func)( uint32_t *texels, int size );
+typedef void (*krn_rotate_func)( uint32_t *texels, int size, uint32_t *scratch );
+
+struct krn_table_s              {
+                                    int                 size;       // 0 for the generic table
+
+                                    krn_blit_func       blit[KRN_SCALES];       // by log2 scale
+                                    krn_reduce_func     reduce[KRN_REDUCTIONS]; // by log2 factor
+                                    krn_flip_func       flip_h;
+                                    krn_rotate_func     rotate_cw;
+                                    krn_rotate_func     rotate_ccw;
+                                };
+typedef struct krn_table_s krn_table_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// returns the kernels for size x size textures
+const krn_table_type *KRN_Select( int size );
+
+
+// returns the generic kernels, which work for any size
+const krn_table_type *KRN_Generic();
+
+
+// scales size x size texels up by scale into dest, a packed image of palette indices
+// size * scale texels across
+void KRN_Blit( const krn_table_type *k, const uint32_t *texels, int size, int scale, uint8_t *dest );
+
+
+// shrinks size x size texels by factor into dest, a packed image of palette indices
+// size / factor texels across, taking the top left texel of each factor x factor block
+void KRN_Reduce( const krn_table_type *k, const uint32_t *texels, int size, int factor, uint8_t *dest );
+
+
+// mirrors a whole texture left to right
+void KRN_Flip_Horizontal( const krn_table_type *k, uint32_t *texels, int size );
+
+
+// rotates a whole texture by a quarter turn, clockwise if turns is 1 or anticlockwise if -1
+void KRN_Rotate( const krn_table_type *k, uint32_t *texels, int size, int turns );
+
+#endif  // __kernels_h__
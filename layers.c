@@ -0,0 +1,369 @@
+/*
+    layers.c
+    layered textures and compositing them a tile at a time
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility.h"
+#include "texture.h"
+#include "layers.h"
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// lays count texels of a layer over dest, leaving dest where the layer is transparent
+UTI_AVX2_CLONES
+static void Composite_Row( uint32_t *restrict dest, const uint32_t *restrict src, uint32_t transparent,
+                           int count )
+{
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        dest[i] = ( src[i] == transparent ) ? dest[i] : src[i];
+    }
+
+    return;
+}
+
+
+// flattens tile (tx, ty) into dest, with texels standing in for layer swap if it isn't -1.
+// usage, if not NULL, has the texels replaced taken off and the new ones added
+static void Composite_Tile( lyr_stack_type *stack, uint32_t *dest, int tx, int ty, int swap,
+                            const uint32_t *texels, uint32_t *usage )
+{
+    int size = stack->size, x = tx * LYR_TILE, y0 = ty * LYR_TILE, y, l, i, first;
+    int w = ( x + LYR_TILE < size ) ? LYR_TILE : size - x;
+    int h = ( y0 + LYR_TILE < size ) ? LYR_TILE : size - y0;
+    const uint32_t *src;
+    size_t row;
+
+    for( first = 0; first < stack->count && !stack->layer[first].visible; first++ );
+
+    for( y = y0; y < y0 + h; y++ )
+    {
+        row = (size_t)y * size + x;
+
+        for( i = 0; usage != NULL && i < w; i++ )
+        {
+            usage[dest[row + i] & 0xff]--;
+        }
+
+        // the lowest visible layer is opaque, with nothing showing there is palette index 0
+        if( first == stack->count )
+        {
+            memset( &dest[row], 0, sizeof( uint32_t ) * w );
+        }
+        else
+        {
+            src = ( first == swap ) ? texels : stack->layer[first].texels;
+            memcpy( &dest[row], &src[row], sizeof( uint32_t ) * w );
+
+            for( l = first + 1; l < stack->count; l++ )
+            {
+                if( stack->layer[l].visible )
+                {
+                    src = ( l == swap ) ? texels : stack->layer[l].texels;
+                    Composite_Row( &dest[row], &src[row], stack->layer[l].transparent, w );
+                }
+            }
+        }
+
+        for( i = 0; usage != NULL && i < w; i++ )
+        {
+            usage[dest[row + i] & 0xff]++;
+        }
+    }
+
+    return;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+//=======================
+//  STACKS
+//=======================
+
+// makes a stack with a single opaque layer sharing the texels of a flat texture
+lyr_stack_type *LYR_Create( uint32_t *texels )
+{
+    lyr_stack_type *stack = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE, sizeof( lyr_stack_type ) );
+    memset( stack, 0, sizeof( lyr_stack_type ) );
+
+    stack->size = TXR_Size( texels );
+    stack->count = 1;
+    stack->layer[0].texels = TXR_Retain( texels );
+    stack->layer[0].visible = 1;
+    stack->layer[0].transparent = LYR_OPAQUE;
+
+    stack->tiles = ( stack->size + LYR_TILE - 1 ) / LYR_TILE;
+    stack->dirty = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE, stack->tiles * stack->tiles );
+    memset( stack->dirty, 0, stack->tiles * stack->tiles );
+
+    return stack;
+}
+
+
+// releases every layer and frees the stack
+void LYR_Free( lyr_stack_type *stack )
+{
+    if( stack == NULL )
+    {
+        return;
+    }
+
+    int l;
+    for( l = 0; l < stack->count; l++ )
+    {
+        TXR_Release( stack->layer[l].texels );
+    }
+
+    UTI_EC_Free( stack->dirty );
+    UTI_EC_Free( stack );
+
+    return;
+}
+
+
+// adds a layer above the active one filled with its transparent index, and makes it active.
+// a new layer changes nothing, so no tiles need compositing
+int LYR_Add( lyr_stack_type *stack, uint32_t transparent )
+{
+    if( stack->count == LYR_MAX_LAYERS )
+    {
+        UTI_Print_Error( "Texture already has the most layers it can" );
+        return 0;
+    }
+
+    int l = ++stack->active;
+    memmove( &stack->layer[l + 1], &stack->layer[l], sizeof( lyr_layer_type ) * ( stack->count - l ) );
+    stack->count++;
+
+    stack->layer[l].texels = TXR_Create( stack->size );
+    stack->layer[l].visible = 1;
+    stack->layer[l].transparent = transparent;
+
+    int i;
+    for( i = 0; i < stack->size * stack->size; i++ )
+    {
+        stack->layer[l].texels[i] = transparent;
+    }
+    TXR_Update_Hash( stack->layer[l].texels );
+
+    return 1;
+}
+
+
+// removes the active layer, the one below becomes active
+int LYR_Remove( lyr_stack_type *stack )
+{
+    if( stack->count == 1 )
+    {
+        UTI_Print_Error( "Cannot remove a texture's only layer" );
+        return 0;
+    }
+
+    int l = stack->active;
+    TXR_Release( stack->layer[l].texels );
+
+    memmove( &stack->layer[l], &stack->layer[l + 1], sizeof( lyr_layer_type ) * ( stack->count - l - 1 ) );
+    stack->count--;
+    stack->active = ( l > 0 ) ? l - 1 : 0;
+
+    LYR_Mark_All( stack );
+
+    return 1;
+}
+
+
+// gives a layer its own texel array if it is sharing one, returns its texels
+uint32_t *LYR_Unshare( lyr_stack_type *stack, int layer )
+{
+    uint32_t *texels = stack->layer[layer].texels;
+
+    if( TXR_Shared( texels ) )
+    {
+        stack->layer[layer].texels = TXR_Copy( texels );
+        TXR_Release( texels );
+    }
+
+    return stack->layer[layer].texels;
+}
+
+
+// recalculates the stored hash of every layer
+void LYR_Update_Hashes( lyr_stack_type *stack )
+{
+    int l;
+    for( l = 0; l < stack->count; l++ )
+    {
+        // a shared layer can't have been written to
+        if( !TXR_Shared( stack->layer[l].texels ) )
+        {
+            TXR_Update_Hash( stack->layer[l].texels );
+        }
+    }
+
+    return;
+}
+
+
+//=======================
+//  COMPOSITING
+//=======================
+
+// marks the tiles touching texels (x0, y0) to (x1, y1) as needing compositing
+void LYR_Mark_Dirty( lyr_stack_type *stack, int x0, int y0, int x1, int y1 )
+{
+    int t, size = stack->size, tx, ty;
+
+    if( x0 > x1 )
+    {
+        t = x0; x0 = x1; x1 = t;
+    }
+    if( y0 > y1 )
+    {
+        t = y0; y0 = y1; y1 = t;
+    }
+
+    x0 = ( x0 < 0 ) ? 0 : x0;
+    y0 = ( y0 < 0 ) ? 0 : y0;
+    x1 = ( x1 >= size ) ? size - 1 : x1;
+    y1 = ( y1 >= size ) ? size - 1 : y1;
+
+    for( ty = y0 / LYR_TILE; ty <= y1 / LYR_TILE; ty++ )
+    {
+        for( tx = x0 / LYR_TILE; tx <= x1 / LYR_TILE; tx++ )
+        {
+            stack->dirty[ty * stack->tiles + tx] = 1;
+        }
+    }
+
+    return;
+}
+
+
+// marks every tile as needing compositing
+void LYR_Mark_All( lyr_stack_type *stack )
+{
+    memset( stack->dirty, 1, stack->tiles * stack->tiles );
+
+    return;
+}
+
+
+// flattens the dirty tiles of the layers into dest and clears them, keeping usage up to date
+int LYR_Composite( lyr_stack_type *stack, uint32_t *dest, uint32_t *usage )
+{
+    int tx, ty, done = 0;
+    uint8_t *dirty = stack->dirty;
+
+    for( ty = 0; ty < stack->tiles; ty++ )
+    {
+        for( tx = 0; tx < stack->tiles; tx++, dirty++ )
+        {
+            if( *dirty )
+            {
+                Composite_Tile( stack, dest, tx, ty, -1, NULL, usage );
+                *dirty = 0;
+                done++;
+            }
+        }
+    }
+
+    return done;
+}
+
+
+// flattens the whole texture into dest with texels standing in for one layer
+void LYR_Composite_With( lyr_stack_type *stack, uint32_t *dest, int layer, const uint32_t *texels )
+{
+    int tx, ty;
+    for( ty = 0; ty < stack->tiles; ty++ )
+    {
+        for( tx = 0; tx < stack->tiles; tx++ )
+        {
+            Composite_Tile( stack, dest, tx, ty, layer, texels, NULL );
+        }
+    }
+
+    return;
+}
+
+
+//=======================
+//  FILES
+//=======================
+
+// adds the layers of every texture with a stack to set
+void LYR_Add_To_Set( txr_set_type *set, lyr_stack_type **stacks, int count )
+{
+    int i, l, total = set->layer_count;
+    for( i = 0; i < count; i++ )
+    {
+        total += ( stacks[i] != NULL ) ? stacks[i]->count : 0;
+    }
+
+    set->layers = UTI_EC_Tag_Realloc( UTI_MEM_TEXTURE, set->layers,
+                                      sizeof( txr_layer_type ) * ( total + 1 ) );
+
+    txr_layer_type *record = &set->layers[set->layer_count];
+    for( i = 0; i < count; i++ )
+    {
+        for( l = 0; stacks[i] != NULL && l < stacks[i]->count; l++, record++ )
+        {
+            record->texture = i;
+            record->visible = stacks[i]->layer[l].visible;
+            record->transparent = stacks[i]->layer[l].transparent;
+            record->texels = TXR_Retain( stacks[i]->layer[l].texels );
+        }
+    }
+
+    set->layer_count = total;
+
+    return;
+}
+
+
+// makes stacks for the textures of set that have layers
+int LYR_Take_From_Set( txr_set_type *set, lyr_stack_type **stacks )
+{
+    txr_layer_type *record;
+    lyr_stack_type *stack;
+    int i, l;
+
+    for( i = 0; i < set->layer_count; i += stack->count )
+    {
+        record = &set->layers[i];
+
+        stack = stacks[record->texture] = LYR_Create( set->textures[record->texture] );
+        TXR_Release( stack->layer[0].texels );
+        stack->count = 0;
+
+        for( l = i; l < set->layer_count && set->layers[l].texture == record->texture; l++ )
+        {
+            if( TXR_Size( set->layers[l].texels ) != stack->size || stack->count == LYR_MAX_LAYERS )
+            {
+                UTI_Print_Error( "Texture layers don't fit the texture" );
+                return 0;
+            }
+
+            stack->layer[stack->count].texels = TXR_Retain( set->layers[l].texels );
+            stack->layer[stack->count].visible = set->layers[l].visible;
+            stack->layer[stack->count].transparent = set->layers[l].transparent;
+            stack->count++;
+        }
+
+        // the top layer is the one most likely to be worked on next
+        stack->active = stack->count - 1;
+    }
+
+    return 1;
+}
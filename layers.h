@@ -0,0 +1,130 @@
+/*
+    layers.h
+    a texture can be built from a stack of layers, so a base material can be kept apart from
+    the decals painted over it. each layer is a texel array of its own with a visibility flag
+    and a transparent palette index, texels of that index letting the layers below show
+    through. the lowest visible layer is always opaque.
+
+    the texture's own texel array holds the layers flattened together, so drawing, thumbnails,
+    saving and the headless tools never need to know about layers. the flattened texels are
+    worked out a 16 x 16 tile at a time: edits mark the tiles they touch as dirty and
+    LYR_Composite only redoes those, so painting on a large layered texture costs about the
+    same as on a flat one.
+
+    layer texel arrays follow the same sharing rules as textures, anything about to write to
+    one must call LYR_Unshare first
+*/
+
+#ifndef __layers_h__
+#define __layers_h__
+
+#include <stdint.h>
+
+#include "texture.h"
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define LYR_MAX_LAYERS          8
+#define LYR_TILE                16          // width and height of the tiles composited
+
+#define LYR_OPAQUE              0xFFFFFFFF  // transparent index of a layer with no see through texels
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+struct lyr_layer_s              {
+                                    uint32_t    *texels;
+                                    int         visible;
+                                    uint32_t    transparent;    // palette index, or LYR_OPAQUE
+                                };
+typedef struct lyr_layer_s lyr_layer_type;
+
+struct lyr_stack_s              {
+                                    int         size;           // texture width and height
+                                    int         count;
+                                    int         active;         // layer being drawn on
+
+                                    lyr_layer_type  layer[LYR_MAX_LAYERS];  // bottom first
+
+                                    int         tiles;          // tiles across (and down)
+                                    uint8_t     *dirty;         // tiles x tiles flags
+                                };
+typedef struct lyr_stack_s lyr_stack_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+//=======================
+//  STACKS
+//=======================
+
+// makes a stack with a single opaque layer holding the texels of a flat texture. the layer
+// shares the texel array until one of them is written to
+lyr_stack_type *LYR_Create( uint32_t *texels );
+
+
+// releases every layer and frees the stack. ignores NULL
+void LYR_Free( lyr_stack_type *stack );
+
+
+// adds a layer above the active one, filled with its transparent index, and makes it active.
+// fails if the stack is full
+int LYR_Add( lyr_stack_type *stack, uint32_t transparent );
+
+
+// removes the active layer, the one below becomes active. fails if it is the only layer
+int LYR_Remove( lyr_stack_type *stack );
+
+
+// gives a layer its own texel array if it is sharing one, returns its texels
+uint32_t *LYR_Unshare( lyr_stack_type *stack, int layer );
+
+
+// recalculates the stored hash of every layer, call after writing to them
+void LYR_Update_Hashes( lyr_stack_type *stack );
+
+
+//=======================
+//  COMPOSITING
+//=======================
+
+// marks the tiles touching texels (x0, y0) to (x1, y1) as needing compositing, the corners
+// can be given either way round and are clipped to the texture
+void LYR_Mark_Dirty( lyr_stack_type *stack, int x0, int y0, int x1, int y1 );
+
+
+// marks every tile as needing compositing, for when the layers themselves change
+void LYR_Mark_All( lyr_stack_type *stack );
+
+
+// flattens the dirty tiles of the layers into dest and clears them, returns the number of
+// tiles redone. usage, 256 counts by palette index or NULL, is kept up to date with the
+// texels of dest that are replaced
+int LYR_Composite( lyr_stack_type *stack, uint32_t *dest, uint32_t *usage );
+
+
+// flattens the whole texture into dest with texels standing in for one layer, for showing an
+// edit before it is made
+void LYR_Composite_With( lyr_stack_type *stack, uint32_t *dest, int layer, const uint32_t *texels );
+
+
+//=======================
+//  FILES
+//=======================
+
+// adds the layers of every texture with a stack to set, stacks being indexed by texture. the
+// set holds a reference to each layer, released by TXR_Free_Set
+void LYR_Add_To_Set( txr_set_type *set, lyr_stack_type **stacks, int count );
+
+
+// makes stacks for the textures of set that have layers, stacks must have room for the set's
+// textures and is left NULL for flat ones. the flattened textures are not touched
+int LYR_Take_From_Set( txr_set_type *set, lyr_stack_type **stacks );
+
+#endif  // __layers_h__
@@ -0,0 +1,205 @@
+/*
+    link.c
+    publishes the textures to shared memory for a running game
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "texture.h"
+#include "link.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+#define LNK_ALIGN               64          // texels start on a multiple of this many bytes
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns CLOCK_MONOTONIC in microseconds, which any process on the machine can compare with
+static uint64_t Monotonic_Microseconds()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+// moves a generation on to odd before writing what it covers, release ordered so a reader
+// never sees the old generation with new data
+static uint64_t Begin_Write( _Atomic uint64_t *generation )
+{
+    uint64_t g = atomic_load_explicit( generation, memory_order_relaxed );
+
+    atomic_store_explicit( generation, g + 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+
+    return g + 2;
+}
+
+
+// writes the low byte of each of count texels, the palette index, to dest
+static void Narrow_Texels( uint8_t *restrict dest, const uint32_t *restrict texels, int count )
+{
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        dest[i] = texels[i];
+    }
+
+    return;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// creates and maps the segment, replacing one left over from an editor that didn't close it
+lnk_link_type *LNK_Open( char *name, int tex_size, int capacity )
+{
+    lnk_link_type *link = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE, sizeof( lnk_link_type ) );
+    memset( link, 0, sizeof( lnk_link_type ) );
+
+    // shm_open names start with a slash
+    snprintf( link->name, LNK_NAME_LENGTH, "%s%s", ( name[0] == '/' ) ? "" : "/", name );
+
+    size_t slots = sizeof( lnk_header_type ) + sizeof( lnk_slot_type ) * capacity;
+    size_t offset = ( slots + LNK_ALIGN - 1 ) / LNK_ALIGN * LNK_ALIGN;
+    link->bytes = offset + (size_t)tex_size * tex_size * capacity;
+
+    shm_unlink( link->name );
+
+    int fd = shm_open( link->name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+    if( fd == -1 )
+    {
+        UTI_Print_Error( "Unable to create shared memory for the live link" );
+        UTI_EC_Free( link );
+        return NULL;
+    }
+
+    // the segment is sparse, only textures that are written take up memory
+    void *map = MAP_FAILED;
+    if( ftruncate( fd, link->bytes ) == 0 )
+    {
+        map = mmap( NULL, link->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    }
+    close( fd );
+
+    if( map == MAP_FAILED )
+    {
+        UTI_Print_Error( "Unable to map shared memory for the live link" );
+        shm_unlink( link->name );
+        UTI_EC_Free( link );
+        return NULL;
+    }
+
+    link->header = map;
+    link->slots = (lnk_slot_type *)( link->header + 1 );
+    link->texels = (uint8_t *)map + offset;
+
+    // the new segment is all zeroes, so only the header needs filling in
+    lnk_header_type *header = link->header;
+    memcpy( header->magic, "LNK1", 4 );
+    header->version = LNK_VERSION;
+    header->tex_size = tex_size;
+    header->capacity = capacity;
+    header->texels_offset = offset;
+    atomic_store_explicit( &header->open, 1, memory_order_release );
+
+    UTI_Log( UTI_LOG_INFO, "Live link '%s' open: %d textures of %dx%d", link->name, capacity,
+             tex_size, tex_size );
+
+    return link;
+}
+
+
+// marks the segment closed, unmaps it and removes the name
+void LNK_Close( lnk_link_type *link )
+{
+    if( link == NULL )
+    {
+        return;
+    }
+
+    atomic_store_explicit( &link->header->open, 0, memory_order_release );
+    atomic_fetch_add_explicit( &link->header->generation, 1, memory_order_release );
+
+    munmap( link->header, link->bytes );
+    shm_unlink( link->name );
+
+    UTI_EC_Free( link );
+
+    return;
+}
+
+
+// writes the palette and the textures that changed since they were last published
+int LNK_Publish( lnk_link_type *link, uint32_t **textures, int count )
+{
+    lnk_header_type *header = link->header;
+    int i, written = 0, changed = 0, size = header->tex_size * header->tex_size;
+    uint8_t palette[LNK_COLORS * 3];
+    uint64_t g, hash, now = Monotonic_Microseconds();
+
+    count = ( count > (int)header->capacity ) ? (int)header->capacity : count;
+
+    for( i = 0; i < LNK_COLORS; i++ )
+    {
+        GRA_Get_Palette_RGB( i, &palette[i * 3], &palette[i * 3 + 1], &palette[i * 3 + 2] );
+    }
+
+    if( memcmp( palette, header->palette, sizeof( palette ) ) != 0 ||
+        atomic_load_explicit( &header->palette_generation, memory_order_relaxed ) == 0 )
+    {
+        g = Begin_Write( &header->palette_generation );
+        memcpy( header->palette, palette, sizeof( palette ) );
+        atomic_store_explicit( &header->palette_generation, g, memory_order_release );
+        changed = 1;
+    }
+
+    // a texture that has never been written has generation 0
+    lnk_slot_type *slot = link->slots;
+    for( i = 0; i < count; i++, slot++ )
+    {
+        hash = TXR_Get_Hash( textures[i] );
+        if( hash == slot->hash && atomic_load_explicit( &slot->generation, memory_order_relaxed ) != 0 )
+        {
+            continue;
+        }
+
+        g = Begin_Write( &slot->generation );
+        Narrow_Texels( &link->texels[(size_t)i * size], textures[i], size );
+        slot->hash = hash;
+        slot->published = now;
+        atomic_store_explicit( &slot->generation, g, memory_order_release );
+        written++;
+    }
+
+    if( (int)atomic_load_explicit( &header->count, memory_order_relaxed ) != count )
+    {
+        atomic_store_explicit( &header->count, count, memory_order_release );
+        changed = 1;
+    }
+
+    if( written > 0 || changed )
+    {
+        atomic_fetch_add_explicit( &header->generation, 1, memory_order_release );
+    }
+
+    return written;
+}
@@ -0,0 +1,98 @@
+/*
+    link.h
+    publishes the textures to a POSIX shared memory segment while they are edited, so a
+    running game can map it and show each edit within a frame instead of after a save and
+    restart. the texels are written in the form the game draws them and it reads them where
+    they are, nothing is copied on its side.
+
+    segment layout, all values in machine byte order:
+        lnk_header_type
+        capacity x lnk_slot_type            - one per texture, in texture order
+        capacity x tex_size x tex_size      - uint8_t palette indices, rows top to bottom,
+                                              from texels_offset
+
+    every slot has a generation that is odd while its texels are being written and moves on
+    to the next even number once they are done, and the palette has one that works the same
+    way. a reader keeps the generation each texture was at when it last picked it up. on
+    seeing a new even generation it can draw from the texels in place, and reading the
+    generation again afterwards tells it whether they were written to meanwhile. the
+    header's generation moves on after every change, so with nothing new a reader only has
+    one value to check each frame. open is cleared when the editor closes the segment, a
+    reader should then unmap it and look for the name again.
+
+    see linkView.c for a reader that stands in for the game
+*/
+
+#ifndef __link_h__
+#define __link_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define LNK_VERSION             1
+
+#define LNK_COLORS              256
+#define LNK_NAME_LENGTH         256
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+struct lnk_header_s             {
+                                    char                magic[4];       // "LNK1"
+                                    uint32_t            version;
+                                    uint32_t            tex_size;
+                                    uint32_t            capacity;       // texture slots
+                                    uint64_t            texels_offset;  // from the start of the segment
+
+                                    _Atomic uint32_t    open;           // cleared when the editor closes
+                                    _Atomic uint32_t    count;          // textures in use
+                                    _Atomic uint64_t    generation;     // moves on after any change
+
+                                    _Atomic uint64_t    palette_generation;
+                                    uint8_t             palette[LNK_COLORS * 3];
+                                };
+typedef struct lnk_header_s lnk_header_type;
+
+struct lnk_slot_s               {
+                                    _Atomic uint64_t    generation;     // odd while being written
+                                    uint64_t            hash;           // TXR_ hash of the texels
+                                    uint64_t            published;      // CLOCK_MONOTONIC microseconds
+                                };
+typedef struct lnk_slot_s lnk_slot_type;
+
+struct lnk_link_s               {
+                                    char                name[LNK_NAME_LENGTH];
+                                    size_t              bytes;          // mapped
+
+                                    lnk_header_type     *header;
+                                    lnk_slot_type       *slots;
+                                    uint8_t             *texels;
+                                };
+typedef struct lnk_link_s lnk_link_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// creates the segment name with room for capacity tex_size x tex_size textures and maps it.
+// a segment left with the same name is replaced. returns NULL on failure
+lnk_link_type *LNK_Open( char *name, int tex_size, int capacity );
+
+
+// marks the segment closed, unmaps it and removes the name, readers keep their mappings
+void LNK_Close( lnk_link_type *link );
+
+
+// writes the palette and every one of count textures whose hash differs from the one last
+// published for it, returns how many textures were written
+int LNK_Publish( lnk_link_type *link, uint32_t **textures, int count );
+
+#endif  // __link_h__
@@ -0,0 +1,276 @@
+/*
+    linkView.c
+    stands in for the game at the other end of texEdit's live link (-L <name>). it maps the
+    segment read only and once a frame picks up the palette and textures that changed, using
+    the texels where they are as the game would, and reports how long after being published
+    each one was seen. when texEdit closes the link it waits for the name to come back
+
+    usage: linkView <name> [seconds] [frame ms]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "link.h"
+
+//====================================================================
+//  CONSTANTS AND GLOBALS
+//====================================================================
+
+#define FRAME_MS                16
+
+static char                     name[LNK_NAME_LENGTH];
+
+static lnk_header_type          *header = NULL;             // NULL while the link is closed
+static size_t                   bytes = 0;
+
+static uint64_t                 *seen = NULL;               // generation each texture was picked up at
+static uint64_t                 last_generation = 0;
+static uint64_t                 last_palette = 0;
+
+static uint64_t                 picked_up = 0;              // textures, over the whole run
+static uint64_t                 total_latency = 0;
+static uint64_t                 worst_latency = 0;
+
+//====================================================================
+//  FUNCTION PROTOTYPES
+//====================================================================
+
+// returns CLOCK_MONOTONIC in microseconds, the clock texEdit stamps textures with
+uint64_t Now();
+
+// maps the segment if texEdit has it open, returns 1 if it is mapped
+int Open_Link();
+
+// unmaps the segment and forgets what was picked up from it
+void Close_Link();
+
+// picks up whatever changed since the last frame
+void Frame();
+
+// reads a texture's texels in place the way drawing it would, returns their checksum
+uint32_t Use_Texels( const uint8_t *texels, int count );
+
+//====================================================================
+//  MAIN
+//====================================================================
+
+int main( int argc, char *argv[] )
+{
+    if( argc < 2 )
+    {
+        printf( "Usage: %s <name> [seconds] [frame ms]\n", argv[0] );
+        printf( "       follows the textures texEdit publishes with -L <name>, as a game would\n" );
+        return 1;
+    }
+
+    snprintf( name, LNK_NAME_LENGTH, "%s%s", ( argv[1][0] == '/' ) ? "" : "/", argv[1] );
+
+    int seconds = ( argc > 2 ) ? atoi( argv[2] ) : 0;
+    int frame_ms = ( argc > 3 ) ? atoi( argv[3] ) : FRAME_MS;
+    frame_ms = ( frame_ms < 1 ) ? 1 : frame_ms;
+
+    uint64_t start = Now(), next = start;
+    struct timespec wait;
+
+    while( seconds <= 0 || Now() - start < (uint64_t)seconds * 1000000 )
+    {
+        if( header != NULL || Open_Link() )
+        {
+            Frame();
+        }
+
+        next += frame_ms * 1000;
+        uint64_t now = Now();
+        if( next > now )
+        {
+            wait.tv_sec = ( next - now ) / 1000000;
+            wait.tv_nsec = ( next - now ) % 1000000 * 1000;
+            nanosleep( &wait, NULL );
+        }
+        else
+        {
+            next = now;
+        }
+    }
+
+    if( picked_up > 0 )
+    {
+        printf( "%llu textures picked up, %.3fms after publishing on average, %.3fms at worst\n",
+                (unsigned long long)picked_up, total_latency / 1000.0 / picked_up,
+                worst_latency / 1000.0 );
+    }
+
+    Close_Link();
+
+    return 0;
+}
+
+//====================================================================
+//  FUNCTION BODIES
+//====================================================================
+
+uint64_t Now()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// maps the segment if texEdit has it open
+int Open_Link()
+{
+    int fd = shm_open( name, O_RDONLY, 0 );
+    if( fd == -1 )
+    {
+        return 0;
+    }
+
+    struct stat info;
+    void *map = MAP_FAILED;
+    if( fstat( fd, &info ) == 0 && (size_t)info.st_size >= sizeof( lnk_header_type ) )
+    {
+        bytes = info.st_size;
+        map = mmap( NULL, bytes, PROT_READ, MAP_SHARED, fd, 0 );
+    }
+    close( fd );
+
+    if( map == MAP_FAILED )
+    {
+        return 0;
+    }
+
+    // texEdit sets open last, once the header is filled in
+    header = map;
+    if( !atomic_load_explicit( &header->open, memory_order_acquire ) || memcmp( header->magic, "LNK1", 4 ) != 0 ||
+        header->version != LNK_VERSION || header->texels_offset +
+        (uint64_t)header->tex_size * header->tex_size * header->capacity > bytes )
+    {
+        munmap( map, bytes );
+        header = NULL;
+        return 0;
+    }
+
+    seen = calloc( header->capacity, sizeof( uint64_t ) );
+    last_generation = 0;
+    last_palette = 0;
+
+    printf( "Link '%s' open: %u textures of %ux%u\n", name, header->capacity, header->tex_size,
+            header->tex_size );
+
+    return 1;
+}
+
+void Close_Link()
+{
+    if( header != NULL )
+    {
+        munmap( header, bytes );
+        header = NULL;
+    }
+
+    free( seen );
+    seen = NULL;
+
+    return;
+}
+
+// picks up whatever changed since the last frame. a texture being written to as it is read
+// is left for the next frame
+void Frame()
+{
+    uint64_t generation = atomic_load_explicit( &header->generation, memory_order_acquire );
+    if( generation == last_generation )
+    {
+        return;
+    }
+
+    if( !atomic_load_explicit( &header->open, memory_order_acquire ) )
+    {
+        printf( "Link closed\n" );
+        Close_Link();
+        return;
+    }
+
+    int retry = 0;
+    uint64_t g = atomic_load_explicit( &header->palette_generation, memory_order_acquire );
+    if( g != last_palette && !( g & 1 ) )
+    {
+        printf( "Palette generation %llu\n", (unsigned long long)g );
+        last_palette = g;
+    }
+    retry |= ( g & 1 );
+
+    const lnk_slot_type *slots = (const lnk_slot_type *)( header + 1 );
+    const uint8_t *texels = (const uint8_t *)header + header->texels_offset;
+    int i, count = atomic_load_explicit( &header->count, memory_order_acquire );
+    int size = header->tex_size * header->tex_size;
+    uint64_t published, latency;
+    uint32_t checksum;
+
+    for( i = 0; i < count; i++ )
+    {
+        g = atomic_load_explicit( &slots[i].generation, memory_order_acquire );
+        if( g == seen[i] )
+        {
+            continue;
+        }
+
+        if( g & 1 )
+        {
+            retry = 1;
+            continue;
+        }
+
+        published = slots[i].published;
+        checksum = Use_Texels( &texels[(size_t)i * size], size );
+
+        // the generation not having moved on means the texels weren't written to meanwhile
+        atomic_thread_fence( memory_order_acquire );
+        if( atomic_load_explicit( &slots[i].generation, memory_order_relaxed ) != g )
+        {
+            retry = 1;
+            continue;
+        }
+
+        latency = Now() - published;
+        picked_up++;
+        total_latency += latency;
+        worst_latency = ( latency > worst_latency ) ? latency : worst_latency;
+        seen[i] = g;
+
+        printf( "Texture %d generation %llu, %.3fms after publishing, checksum %08x\n", i,
+                (unsigned long long)g, latency / 1000.0, checksum );
+    }
+
+    if( !retry )
+    {
+        last_generation = generation;
+    }
+
+    return;
+}
+
+// reads count texels where they are, the stand-in for drawing with them
+uint32_t Use_Texels( const uint8_t *texels, int count )
+{
+    uint32_t a = 1, b = 0;
+    int i;
+
+    for( i = 0; i < count; i++ )
+    {
+        a = ( a + texels[i] ) % 65521;
+        b = ( b + a ) % 65521;
+    }
+
+    return ( b << 16 ) | a;
+}
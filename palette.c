@@ -0,0 +1,468 @@
+/*
+    palette.c
+    fits the palette to the textures using it
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+#include "texture.h"
+#include "region.h"
+#include "palette.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// one palette colour in use, with how many texels use it
+struct pal_entry_s              {
+                                    int         rgb[3];
+                                    int         index;      // in the old palette
+                                    uint64_t    weight;
+
+                                    int         key;        // channel being sorted on
+                                };
+typedef struct pal_entry_s pal_entry_type;
+
+// a median cut box, a run of entries
+struct pal_box_s                {
+                                    int         first;
+                                    int         count;
+                                };
+typedef struct pal_box_s pal_box_type;
+
+// everything the threads of a count or remap share
+struct pal_job_s                {
+                                    uint32_t    **arrays;
+                                    int         texels;     // in each array
+
+                                    _Atomic uint64_t    histogram[PAL_COLORS];
+                                    const uint32_t      *map;
+                                };
+typedef struct pal_job_s pal_job_type;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// counts the texels of one array, on one of the count threads. four sets of bins keep texels
+// of the same index in a row from waiting on each other
+static int Count_Array( int index, void *data )
+{
+    pal_job_type *job = data;
+    const uint32_t *texels = job->arrays[index];
+    uint32_t bins[4][PAL_COLORS];
+    int i, n = job->texels;
+
+    memset( bins, 0, sizeof( bins ) );
+
+    for( i = 0; i + 4 <= n; i += 4 )
+    {
+        bins[0][texels[i] & ( PAL_COLORS - 1 )]++;
+        bins[1][texels[i + 1] & ( PAL_COLORS - 1 )]++;
+        bins[2][texels[i + 2] & ( PAL_COLORS - 1 )]++;
+        bins[3][texels[i + 3] & ( PAL_COLORS - 1 )]++;
+    }
+    for( ; i < n; i++ )
+    {
+        bins[0][texels[i] & ( PAL_COLORS - 1 )]++;
+    }
+
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        atomic_fetch_add( &job->histogram[i], (uint64_t)bins[0][i] + bins[1][i] + bins[2][i] + bins[3][i] );
+    }
+
+    return 1;
+}
+
+
+// remaps one array, on one of the remap threads. RGN_Remap has the vectorized loop
+static int Remap_Array( int index, void *data )
+{
+    pal_job_type *job = data;
+    int size = TXR_Size( job->arrays[index] );
+
+    RGN_Remap( job->arrays[index], size, 0, 0, size, size, job->map );
+    TXR_Update_Hash( job->arrays[index] );
+
+    return 1;
+}
+
+
+// sorts entries on their key, then their old index so the order never depends on qsort
+static int Compare_Entries( const void *a, const void *b )
+{
+    const pal_entry_type *ea = a, *eb = b;
+
+    if( ea->key != eb->key )
+    {
+        return ea->key - eb->key;
+    }
+
+    return ea->index - eb->index;
+}
+
+
+// returns the channel a box's colours spread furthest along, and sets range to how far
+static int Widest_Channel( pal_entry_type *entries, pal_box_type *box, int *range )
+{
+    int c, i, lo, hi, widest = 0;
+
+    *range = -1;
+    for( c = 0; c < 3; c++ )
+    {
+        lo = 255;
+        hi = 0;
+        for( i = box->first; i < box->first + box->count; i++ )
+        {
+            lo = ( entries[i].rgb[c] < lo ) ? entries[i].rgb[c] : lo;
+            hi = ( entries[i].rgb[c] > hi ) ? entries[i].rgb[c] : hi;
+        }
+
+        if( hi - lo > *range )
+        {
+            *range = hi - lo;
+            widest = c;
+        }
+    }
+
+    return widest;
+}
+
+
+// sorts texel array pointers by address
+static int Compare_Arrays( const void *a, const void *b )
+{
+    uintptr_t pa = (uintptr_t)*(uint32_t * const *)a, pb = (uintptr_t)*(uint32_t * const *)b;
+
+    return( pa > pb ) - ( pa < pb );
+}
+
+
+// sorts list and drops the repeats from it, returns how many are left
+static int Distinct_Arrays( uint32_t **list, int total )
+{
+    int i, count = 0;
+
+    qsort( list, total, sizeof( uint32_t * ), Compare_Arrays );
+
+    for( i = 0; i < total; i++ )
+    {
+        if( count == 0 || list[count - 1] != list[i] )
+        {
+            list[count++] = list[i];
+        }
+    }
+
+    return count;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// counts the texels of each palette index in count texel arrays, spread over the cores
+void PAL_Histogram( uint32_t **arrays, int count, int tex_size, uint64_t *histogram )
+{
+    pal_job_type *job = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( pal_job_type ) );
+    job->arrays = arrays;
+    job->texels = tex_size * tex_size;
+
+    int i;
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        atomic_init( &job->histogram[i], 0 );
+    }
+
+    THR_Parallel_For( count, Count_Array, job );
+
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        histogram[i] = atomic_load( &job->histogram[i] );
+    }
+
+    UTI_EC_Free( job );
+
+    return;
+}
+
+
+// adds the texels of a region to usage, or takes them off it with sign -1
+void PAL_Count_Region( const uint32_t *texels, int size, int x, int y, int w, int h,
+                       uint32_t *usage, int sign )
+{
+    if( RGN_Clip( size, &x, &y, &w, &h ) == 0 )
+    {
+        return;
+    }
+
+    const uint32_t *row;
+    int r, i;
+    for( r = 0; r < h; r++ )
+    {
+        row = &texels[( y + r ) * size + x];
+        for( i = 0; i < w; i++ )
+        {
+            usage[row[i] & ( PAL_COLORS - 1 )] += sign;
+        }
+    }
+
+    return;
+}
+
+
+// sets a palette of at most colors entries for the colours counted in histogram by median
+// cut. reserved colours are put in boxes of their own first, whether texels use them or not,
+// and the rest start out in one box. the box split next is always the one whose colours
+// spread furthest on one channel, and it is split where half its texels are on each side
+int PAL_Median_Cut( const uint64_t *histogram, const uint8_t *reserved, int colors, uint32_t *map )
+{
+    pal_entry_type entries[PAL_COLORS];
+    pal_box_type boxes[PAL_COLORS];
+    uint8_t r, g, b;
+    int i, n = 0, kept = 0, pass;
+
+    // reserved entries go first so each can be given its box before the cut starts
+    for( pass = 0; pass < 2; pass++ )
+    {
+        for( i = 0; i < PAL_COLORS; i++ )
+        {
+            if( ( pass == 0 ) != ( reserved != NULL && reserved[i] ) ||
+                ( pass == 1 && histogram[i] == 0 ) )
+            {
+                continue;
+            }
+
+            GRA_Get_Palette_RGB( i, &r, &g, &b );
+            entries[n].rgb[0] = r;
+            entries[n].rgb[1] = g;
+            entries[n].rgb[2] = b;
+            entries[n].index = i;
+            entries[n].weight = ( histogram[i] > 0 ) ? histogram[i] : 1;
+            n++;
+        }
+
+        kept = ( pass == 0 ) ? n : kept;
+    }
+
+    // a set with no texels at all keeps colour 0
+    if( n == 0 )
+    {
+        GRA_Get_Palette_RGB( 0, &r, &g, &b );
+        entries[0] = (pal_entry_type){ { r, g, b }, 0, 1, 0 };
+        n = 1;
+    }
+
+    int count = 0, box, best, range, best_range, channel;
+    for( count = 0; count < kept; count++ )
+    {
+        boxes[count].first = count;
+        boxes[count].count = 1;
+    }
+    if( n > kept )
+    {
+        boxes[count].first = kept;
+        boxes[count].count = n - kept;
+        count++;
+    }
+
+    // merging a reserved colour with any other would change what it means
+    if( colors < count )
+    {
+        UTI_Log( UTI_LOG_WARN, "Palette needs %d colours to keep the %d see through ones apart",
+                 count, kept );
+    }
+    colors = ( colors < count ) ? count : ( colors > PAL_COLORS ) ? PAL_COLORS : colors;
+
+    uint64_t total, half;
+    while( count < colors )
+    {
+        best = -1;
+        best_range = 0;
+        for( box = 0; box < count; box++ )
+        {
+            Widest_Channel( entries, &boxes[box], &range );
+            if( boxes[box].count > 1 && range > best_range )
+            {
+                best = box;
+                best_range = range;
+            }
+        }
+
+        // every box is down to one colour
+        if( best == -1 )
+        {
+            break;
+        }
+
+        pal_box_type *split = &boxes[best];
+        channel = Widest_Channel( entries, split, &range );
+
+        total = 0;
+        for( i = split->first; i < split->first + split->count; i++ )
+        {
+            entries[i].key = entries[i].rgb[channel];
+            total += entries[i].weight;
+        }
+        qsort( &entries[split->first], split->count, sizeof( pal_entry_type ), Compare_Entries );
+
+        // both halves keep at least one colour
+        half = 0;
+        for( i = split->first; i < split->first + split->count - 2; i++ )
+        {
+            half += entries[i].weight;
+            if( half * 2 >= total )
+            {
+                break;
+            }
+        }
+
+        boxes[count].first = i + 1;
+        boxes[count].count = split->first + split->count - ( i + 1 );
+        split->count = i + 1 - split->first;
+        count++;
+    }
+
+    // each box becomes one colour, the average of its colours weighted by use
+    int rgb[PAL_COLORS][3], c;
+    uint64_t sum[3];
+
+    memset( rgb, 0, sizeof( rgb ) );
+    for( box = 0; box < count; box++ )
+    {
+        sum[0] = sum[1] = sum[2] = total = 0;
+        for( i = boxes[box].first; i < boxes[box].first + boxes[box].count; i++ )
+        {
+            for( c = 0; c < 3; c++ )
+            {
+                sum[c] += entries[i].rgb[c] * entries[i].weight;
+            }
+            total += entries[i].weight;
+            map[entries[i].index] = box;
+        }
+
+        for( c = 0; c < 3; c++ )
+        {
+            rgb[box][c] = ( sum[c] + total / 2 ) / total;
+        }
+    }
+
+    // colours no texel uses go to whichever new colour is closest
+    int d, dist, best_dist;
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        if( histogram[i] > 0 || ( reserved != NULL && reserved[i] ) )
+        {
+            continue;
+        }
+
+        GRA_Get_Palette_RGB( i, &r, &g, &b );
+        best_dist = 0x7fffffff;
+        for( box = 0; box < count; box++ )
+        {
+            d = rgb[box][0] - r;
+            dist = d * d;
+            d = rgb[box][1] - g;
+            dist += d * d;
+            d = rgb[box][2] - b;
+            dist += d * d;
+
+            if( dist < best_dist )
+            {
+                best_dist = dist;
+                map[i] = box;
+            }
+        }
+    }
+
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        GRA_Set_Palette_RGB( i, rgb[i][0], rgb[i][1], rgb[i][2] );
+    }
+
+    return count;
+}
+
+
+// replaces every texel of count texel arrays with map[texel] and rehashes them, spread over
+// the cores
+void PAL_Remap( uint32_t **arrays, int count, int tex_size, const uint32_t *map )
+{
+    pal_job_type *job = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( pal_job_type ) );
+    job->arrays = arrays;
+    job->texels = tex_size * tex_size;
+    job->map = map;
+
+    THR_Parallel_For( count, Remap_Array, job );
+
+    UTI_EC_Free( job );
+
+    return;
+}
+
+
+// fits the palette to the textures and layers of set and remaps them all to it. texel arrays
+// shared between textures or layers are only counted and remapped once
+int PAL_Optimize( txr_set_type *set, int colors )
+{
+    int total = set->count + set->layer_count, count, i;
+    uint32_t **all = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t * ) * ( total + 1 ) );
+
+    memcpy( all, set->textures, sizeof( uint32_t * ) * set->count );
+    for( i = 0; i < set->layer_count; i++ )
+    {
+        all[set->count + i] = set->layers[i].texels;
+    }
+
+    count = Distinct_Arrays( all, total );
+
+    uint64_t histogram[PAL_COLORS];
+    uint32_t map[PAL_COLORS];
+    uint8_t reserved[PAL_COLORS];
+
+    // a layer's see through index must not end up standing for a colour painted on it
+    memset( reserved, 0, sizeof( reserved ) );
+    for( i = 0; i < set->layer_count; i++ )
+    {
+        if( set->layers[i].transparent < PAL_COLORS )
+        {
+            reserved[set->layers[i].transparent] = 1;
+        }
+    }
+
+    uint64_t start = GRA_Get_Microseconds();
+    PAL_Histogram( all, count, set->tex_size, histogram );
+    uint64_t counted = GRA_Get_Microseconds();
+
+    int used = PAL_Median_Cut( histogram, reserved, colors, map );
+    uint64_t cut = GRA_Get_Microseconds();
+
+    PAL_Remap( all, count, set->tex_size, map );
+
+    // a layer's see through index moves with its texels
+    for( i = 0; i < set->layer_count; i++ )
+    {
+        if( set->layers[i].transparent < PAL_COLORS )
+        {
+            set->layers[i].transparent = map[set->layers[i].transparent];
+        }
+    }
+
+    UTI_Log( UTI_LOG_DEBUG, "Palette fitted to %d texel arrays: counted in %.3fms, cut in %.3fms, "
+             "remapped in %.3fms", count, ( counted - start ) / 1000.0, ( cut - counted ) / 1000.0,
+             ( GRA_Get_Microseconds() - cut ) / 1000.0 );
+
+    UTI_EC_Free( all );
+
+    return used;
+}
@@ -0,0 +1,62 @@
+/*
+    palette.h
+    fits the palette to the textures using it. the generated palette is an even spread of
+    colours, most of which a given set of textures never uses.
+
+    the texels of every texture are counted by palette index, then the colours in use are
+    split up by median cut into as many boxes as the palette is to have entries, each box
+    becoming the weighted average of its colours. every texture is then remapped to the new
+    palette. asking for fewer colours than are in use merges the closest ones, and any entries
+    left over are black and free for other uses. the same per index counts, kept for each
+    texture, show which entries are free to start with
+*/
+
+#ifndef __palette_h__
+#define __palette_h__
+
+#include <stdint.h>
+
+#include "texture.h"
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define PAL_COLORS              256         // palette entries, and histogram bins
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// counts the texels of each palette index in count tex_size x tex_size texel arrays into the
+// PAL_COLORS entries of histogram, spread out between all the cores
+void PAL_Histogram( uint32_t **arrays, int count, int tex_size, uint64_t *histogram );
+
+
+// adds the texels of the w x h region at (x, y) of a size x size texture to the PAL_COLORS
+// counts of usage, or takes them off with sign -1. the region is clipped to the texture
+void PAL_Count_Region( const uint32_t *texels, int size, int x, int y, int w, int h,
+                       uint32_t *usage, int sign );
+
+
+// sets a palette of at most colors entries for the colours counted in histogram, worked out
+// from the current palette by median cut. every index flagged in reserved, which may be NULL,
+// gets an entry of its own that no other colour is merged into, even if that takes more than
+// colors entries. map gets the new index for every old one, and the number of entries used
+// is returned
+int PAL_Median_Cut( const uint64_t *histogram, const uint8_t *reserved, int colors, uint32_t *map );
+
+
+// replaces every texel of count tex_size x tex_size texel arrays with map[texel] and rehashes
+// them, spread out between all the cores. no array may be in the list twice
+void PAL_Remap( uint32_t **arrays, int count, int tex_size, const uint32_t *map );
+
+
+// fits the palette to the textures and layers of set, with at most colors entries, and
+// remaps them all to it. each layer's see through index keeps an entry of its own. returns
+// the number of entries used, 0 on failure
+int PAL_Optimize( txr_set_type *set, int colors );
+
+#endif  // __palette_h__
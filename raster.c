@@ -0,0 +1,423 @@
+/*
+    raster.c
+    drawing tools that write straight into a texel array
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "utility.h"
+#include "raster.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// starting number of spans the flood fill stack can hold, it doubles when it runs out
+#define FILL_STACK_START        256
+
+// a row of texels waiting to be scanned by the flood fill, dy is the direction the fill was
+// travelling when the span was found
+struct fill_span_s              {
+                                    int         x1;
+                                    int         x2;
+                                    int         y;
+                                    int         dy;
+                                };
+typedef struct fill_span_s fill_span_type;
+
+// palette index counts this thread's writes keep up to date, NULL while not counting
+static _Thread_local uint32_t   *usage = NULL;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// fills a span that is already known to be within the texture
+static void Fill_Span( uint32_t *row, int x1, int x2, uint32_t color )
+{
+    int x;
+
+    if( usage != NULL && x1 <= x2 )
+    {
+        for( x = x1; x <= x2; x++ )
+        {
+            usage[row[x] & 0xff]--;
+        }
+        usage[color & 0xff] += x2 - x1 + 1;
+    }
+
+    for( ; x1 <= x2; x1++ )
+    {
+        row[x1] = color;
+    }
+
+    return;
+}
+
+
+// pushes a span onto the fill stack, growing it if needed. every push is made for a run of
+// texels that has just been filled, so the stack stays bounded by the size of the texture
+static void Push_Span(  fill_span_type **stack, int *top, int *size,
+                        int x1, int x2, int y, int dy, int h )
+{
+    // rows off the top or bottom of the texture are never pushed
+    if( y < 0 || y >= h )
+    {
+        return;
+    }
+
+    if( *top == *size )
+    {
+        *size *= 2;
+        *stack = UTI_EC_Tag_Realloc( UTI_MEM_SCRATCH, *stack, sizeof( fill_span_type ) * (*size) );
+    }
+
+    (*stack)[*top].x1 = x1;
+    (*stack)[*top].x2 = x2;
+    (*stack)[*top].y  = y;
+    (*stack)[*top].dy = dy;
+    (*top)++;
+
+    return;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// makes the texel writes of the calling thread keep counts up to date, NULL stops it
+void RAS_Count_Usage( uint32_t *counts )
+{
+    usage = counts;
+
+    return;
+}
+
+
+// sets a single texel, ignores texels outside of the texture
+void RAS_Point( uint32_t *texels, int w, int h, int x, int y, uint32_t color )
+{
+    if( x < 0 || x >= w || y < 0 || y >= h )
+    {
+        return;
+    }
+
+    if( usage != NULL )
+    {
+        usage[texels[y*w + x] & 0xff]--;
+        usage[color & 0xff]++;
+    }
+
+    texels[y*w + x] = color;
+
+    return;
+}
+
+
+// fills the texels from x1 to x2 (inclusive) on row y
+void RAS_Span( uint32_t *texels, int w, int h, int x1, int x2, int y, uint32_t color )
+{
+    if( y < 0 || y >= h )
+    {
+        return;
+    }
+
+    // make sure x1 is the left end
+    if( x1 > x2 )
+    {
+        int temp = x1;
+        x1 = x2;
+        x2 = temp;
+    }
+
+    if( x2 < 0 || x1 >= w )
+    {
+        return;
+    }
+
+    if( x1 < 0 )            x1 = 0;
+    if( x2 > w-1 )          x2 = w-1;
+
+    Fill_Span( &texels[y*w], x1, x2, color );
+
+    return;
+}
+
+
+// writes a run of source texels over row y, skipping the RAS_KEEP ones
+void RAS_Copy_Span( uint32_t *texels, int w, int h, int x1, int x2, int y, const uint32_t *src )
+{
+    if( y < 0 || y >= h || x2 < 0 || x1 >= w )
+    {
+        return;
+    }
+
+    if( x1 < 0 )
+    {
+        src -= x1;
+        x1 = 0;
+    }
+    if( x2 > w-1 )          x2 = w-1;
+
+    uint32_t *row = &texels[y*w + x1];
+    int x, n = x2 - x1 + 1;
+
+    if( usage != NULL )
+    {
+        for( x = 0; x < n; x++ )
+        {
+            if( src[x] != RAS_KEEP )
+            {
+                usage[row[x] & 0xff]--;
+                usage[src[x] & 0xff]++;
+            }
+        }
+    }
+
+    for( x = 0; x < n; x++ )
+    {
+        row[x] = ( src[x] == RAS_KEEP ) ? row[x] : src[x];
+    }
+
+    return;
+}
+
+
+// draws a line from (x1, y1) to (x2, y2) using bresenham's algorithm
+void RAS_Line( uint32_t *texels, int w, int h, int x1, int y1, int x2, int y2, uint32_t color )
+{
+    // horizontal lines are a single span
+    if( y1 == y2 )
+    {
+        RAS_Span( texels, w, h, x1, x2, y1, color );
+        return;
+    }
+
+    int dx = abs( x2 - x1 ), sx = ( x1 < x2 ) ? 1 : -1;
+    int dy = -abs( y2 - y1 ), sy = ( y1 < y2 ) ? 1 : -1;
+    int err = dx + dy, e2;
+
+    while( 1 )
+    {
+        RAS_Point( texels, w, h, x1, y1, color );
+
+        if( x1 == x2 && y1 == y2 )
+        {
+            break;
+        }
+
+        e2 = 2 * err;
+        if( e2 >= dy )
+        {
+            err += dy;
+            x1 += sx;
+        }
+        if( e2 <= dx )
+        {
+            err += dx;
+            y1 += sy;
+        }
+    }
+
+    return;
+}
+
+
+// draws a rectangle with opposite corners (x1, y1) and (x2, y2), filled if fill is set
+void RAS_Rectangle( uint32_t *texels, int w, int h, int x1, int y1, int x2, int y2,
+                    uint32_t color, int fill )
+{
+    // make sure y1 is the top
+    if( y1 > y2 )
+    {
+        int temp = y1;
+        y1 = y2;
+        y2 = temp;
+    }
+
+    int y;
+    if( fill )
+    {
+        for( y = y1; y <= y2; y++ )
+        {
+            RAS_Span( texels, w, h, x1, x2, y, color );
+        }
+
+        return;
+    }
+
+    RAS_Span( texels, w, h, x1, x2, y1, color );
+    RAS_Span( texels, w, h, x1, x2, y2, color );
+
+    for( y = y1 + 1; y < y2; y++ )
+    {
+        RAS_Point( texels, w, h, x1, y, color );
+        RAS_Point( texels, w, h, x2, y, color );
+    }
+
+    return;
+}
+
+
+// draws an ellipse that fits the box with corners (x1, y1) and (x2, y2), filled if fill is set.
+// midpoint algorithm working inwards from the left and right ends of the box, which handles
+// even and odd sized boxes exactly. the error terms grow with the cube of the box size, so
+// they are kept in 64 bits
+void RAS_Ellipse(   uint32_t *texels, int w, int h, int x1, int y1, int x2, int y2,
+                    uint32_t color, int fill )
+{
+    int64_t a = abs( x2 - x1 ), b = abs( y2 - y1 ), b1 = b & 1;
+    int64_t dx = 4 * ( 1 - a ) * b * b, dy = 4 * ( b1 + 1 ) * a * a;
+    int64_t err = dx + dy + b1 * a * a, e2;
+
+    // make sure (x1, y1) is the top left corner
+    if( x1 > x2 )
+    {
+        x1 = x2;
+        x2 += a;
+    }
+    if( y1 > y2 )
+    {
+        y1 = y2;
+    }
+
+    // start at the middle rows, y1 works down and y2 works up
+    y1 += ( b + 1 ) / 2;
+    y2 = y1 - b1;
+    a *= 8 * a;
+    b1 = 8 * b * b;
+
+    do
+    {
+        if( fill )
+        {
+            RAS_Span( texels, w, h, x1, x2, y1, color );
+            RAS_Span( texels, w, h, x1, x2, y2, color );
+        }
+        else
+        {
+            RAS_Point( texels, w, h, x2, y1, color );
+            RAS_Point( texels, w, h, x1, y1, color );
+            RAS_Point( texels, w, h, x1, y2, color );
+            RAS_Point( texels, w, h, x2, y2, color );
+        }
+
+        e2 = 2 * err;
+        if( e2 <= dy )
+        {
+            y1++;
+            y2--;
+            err += dy += a;
+        }
+        if( e2 >= dx || 2 * err > dy )
+        {
+            x1++;
+            x2--;
+            err += dx += b1;
+        }
+    } while( x1 <= x2 );
+
+    // very flat ellipses stop early, finish off the tips
+    while( y1 - y2 < b )
+    {
+        RAS_Span( texels, w, h, x1 - 1, x2 + 1, y1++, color );
+        RAS_Span( texels, w, h, x1 - 1, x2 + 1, y2--, color );
+    }
+
+    return;
+}
+
+
+// fills the 4-connected area of texels sharing the colour at (x, y) with color
+int RAS_Flood_Fill( uint32_t *texels, int w, int h, int x, int y, uint32_t color )
+{
+    if( x < 0 || x >= w || y < 0 || y >= h )
+    {
+        return 0;
+    }
+
+    uint32_t target = texels[y*w + x];
+
+    // nothing to do, and the scan below would never finish
+    if( target == color )
+    {
+        return 1;
+    }
+
+    int size = FILL_STACK_START, top = 0;
+    fill_span_type *stack = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( fill_span_type ) * size );
+
+    // seed the row the fill starts on, scanning down and up from it
+    Push_Span( &stack, &top, &size, x, x, y, 1, h );
+    Push_Span( &stack, &top, &size, x, x, y - 1, -1, h );
+
+    int x1, x2, dy, left;
+    uint32_t *row;
+    while( top > 0 )
+    {
+        top--;
+        x1 = stack[top].x1;
+        x2 = stack[top].x2;
+        y  = stack[top].y;
+        dy = stack[top].dy;
+
+        row = &texels[y*w];
+        left = x1;
+
+        // extend the span out to the left, anything found there also has to be checked on
+        // the row the span came from
+        if( row[x1] == target )
+        {
+            while( left > 0 && row[left-1] == target )
+            {
+                left--;
+            }
+            Fill_Span( row, left, x1 - 1, color );
+
+            if( left < x1 )
+            {
+                Push_Span( &stack, &top, &size, left, x1 - 1, y - dy, -dy, h );
+            }
+        }
+
+        // walk along the span filling each run of target texels
+        while( x1 <= x2 )
+        {
+            int start = x1;
+            while( x1 < w && row[x1] == target )
+            {
+                x1++;
+            }
+            Fill_Span( row, start, x1 - 1, color );
+
+            // continue in the same direction under the whole run
+            if( x1 > left )
+            {
+                Push_Span( &stack, &top, &size, left, x1 - 1, y + dy, dy, h );
+            }
+
+            // the run overhangs the end of the span, so look back the other way too
+            if( x1 - 1 > x2 )
+            {
+                Push_Span( &stack, &top, &size, x2 + 1, x1 - 1, y - dy, -dy, h );
+            }
+
+            // skip to the next target texel within the span
+            x1++;
+            while( x1 < x2 && row[x1] != target )
+            {
+                x1++;
+            }
+            left = x1;
+        }
+    }
+
+    UTI_EC_Free( stack );
+
+    return 1;
+}
@@ -0,0 +1,67 @@
+/*
+    raster.h
+    drawing tools that write straight into a texel array. every function takes the texel
+    array and its dimensions so they work on any texture size, and everything is clipped to
+    the texture so callers can pass coordinates that are partly outside of it.
+
+    shapes are broken down into horizontal spans wherever possible, as a span is a single
+    tight loop over one row of memory
+*/
+
+#ifndef __raster_h__
+#define __raster_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define RAS_KEEP                0xFFFFFFFF  // source texel that leaves the texel under it as it is
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// makes the texel writes made by the calling thread keep counts, 256 entries indexed by
+// palette index, up to date: each texel written takes one off the count of the index it had
+// and adds one to the count of the new index. NULL stops the counting
+void RAS_Count_Usage( uint32_t *counts );
+
+
+// sets a single texel, ignores texels outside of the texture
+void RAS_Point( uint32_t *texels, int w, int h, int x, int y, uint32_t color );
+
+
+// fills the texels from x1 to x2 (inclusive) on row y
+void RAS_Span( uint32_t *texels, int w, int h, int x1, int x2, int y, uint32_t color );
+
+
+// writes src[0] to src[x2 - x1] over the texels from x1 to x2 (inclusive) on row y, leaving
+// the texels where src is RAS_KEEP alone. x1 must not be past x2
+void RAS_Copy_Span( uint32_t *texels, int w, int h, int x1, int x2, int y, const uint32_t *src );
+
+
+// draws a line from (x1, y1) to (x2, y2) using bresenham's algorithm
+void RAS_Line( uint32_t *texels, int w, int h, int x1, int y1, int x2, int y2, uint32_t color );
+
+
+// draws a rectangle with opposite corners (x1, y1) and (x2, y2), filled if fill is set
+void RAS_Rectangle( uint32_t *texels, int w, int h, int x1, int y1, int x2, int y2,
+                    uint32_t color, int fill );
+
+
+// draws an ellipse that fits the box with corners (x1, y1) and (x2, y2), filled if fill is set
+void RAS_Ellipse(   uint32_t *texels, int w, int h, int x1, int y1, int x2, int y2,
+                    uint32_t color, int fill );
+
+
+// fills the 4-connected area of texels sharing the colour at (x, y) with color. scanline
+// algorithm working from an explicit stack of spans on the heap rather than recursion, so
+// deep or twisting areas can't overflow the call stack. returns 0 if (x, y) is outside of
+// the texture
+int RAS_Flood_Fill( uint32_t *texels, int w, int h, int x, int y, uint32_t color );
+
+#endif  // __raster_h__
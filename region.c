@@ -0,0 +1,284 @@
+/*
+    region.c
+    whole block operations on a rectangle of a texel array
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility.h"
+#include "region.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// rotations read the source a column at a time, so they work through it in square tiles that
+// stay in the cache rather than striding down the whole texture for every row written
+#define ROTATE_TILE             16
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// writes count texels of src to dest in reverse order
+static void Reverse_Row( uint32_t *restrict dest, const uint32_t *restrict src, int count )
+{
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        dest[i] = src[count - 1 - i];
+    }
+
+    return;
+}
+
+
+// looks every texel of a row up in map, the AVX2 copy using gathers
+UTI_AVX2_CLONES
+static void Remap_Row( uint32_t *restrict row, const uint32_t *restrict map, int count )
+{
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        row[i] = map[row[i] & ( RGN_MAP_SIZE - 1 )];
+    }
+
+    return;
+}
+
+
+// returns a mod m in the range 0 to m - 1, for negative a too
+static int Wrap( int a, int m )
+{
+    a %= m;
+    return( ( a < 0 ) ? a + m : a );
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// clips the region at (x, y) of w x h texels to a size x size texture, returns 0 if nothing
+// of it is left
+int RGN_Clip( int size, int *x, int *y, int *w, int *h )
+{
+    if( *x < 0 )                *w += *x, *x = 0;
+    if( *y < 0 )                *h += *y, *y = 0;
+    if( *x + *w > size )        *w = size - *x;
+    if( *y + *h > size )        *h = size - *y;
+
+    return( *w > 0 && *h > 0 );
+}
+
+
+// copies the w x h region at (x, y) into dest, packed with w texels per row
+void RGN_Copy( const uint32_t *texels, int size, int x, int y, int w, int h, uint32_t *dest )
+{
+    int r;
+    for( r = 0; r < h; r++ )
+    {
+        memcpy( &dest[r * w], &texels[( y + r ) * size + x], sizeof( uint32_t ) * w );
+    }
+
+    return;
+}
+
+
+// writes the packed w x h texels in src to the texture with their top left corner at (x, y),
+// anything falling off the texture is dropped
+void RGN_Paste( uint32_t *texels, int size, int x, int y, const uint32_t *src, int w, int h )
+{
+    int cx = x, cy = y, cw = w, ch = h;
+    if( RGN_Clip( size, &cx, &cy, &cw, &ch ) == 0 )
+    {
+        return;
+    }
+
+    // skip the rows and columns of src that were clipped off
+    src += ( cy - y ) * w + ( cx - x );
+
+    int r;
+    for( r = 0; r < ch; r++ )
+    {
+        memcpy( &texels[( cy + r ) * size + cx], &src[r * w], sizeof( uint32_t ) * cw );
+    }
+
+    return;
+}
+
+
+// mirrors the region left to right, a row at a time through a scratch row
+void RGN_Flip_Horizontal( uint32_t *texels, int size, int x, int y, int w, int h )
+{
+    if( RGN_Clip( size, &x, &y, &w, &h ) == 0 )
+    {
+        return;
+    }
+
+    uint32_t *scratch = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * w );
+    uint32_t *row;
+
+    int r;
+    for( r = 0; r < h; r++ )
+    {
+        row = &texels[( y + r ) * size + x];
+        Reverse_Row( scratch, row, w );
+        memcpy( row, scratch, sizeof( uint32_t ) * w );
+    }
+
+    UTI_EC_Free( scratch );
+
+    return;
+}
+
+
+// mirrors the region top to bottom by swapping whole rows
+void RGN_Flip_Vertical( uint32_t *texels, int size, int x, int y, int w, int h )
+{
+    if( RGN_Clip( size, &x, &y, &w, &h ) == 0 )
+    {
+        return;
+    }
+
+    uint32_t *scratch = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * w );
+    uint32_t *top, *bottom;
+
+    int r;
+    for( r = 0; r < h / 2; r++ )
+    {
+        top = &texels[( y + r ) * size + x];
+        bottom = &texels[( y + h - 1 - r ) * size + x];
+
+        memcpy( scratch, top, sizeof( uint32_t ) * w );
+        memcpy( top, bottom, sizeof( uint32_t ) * w );
+        memcpy( bottom, scratch, sizeof( uint32_t ) * w );
+    }
+
+    UTI_EC_Free( scratch );
+
+    return;
+}
+
+
+// rotates the n x n region at (x, y) by turns quarter turns clockwise. half turns are both
+// flips, quarter turns copy the square out and read it back a tile at a time
+int RGN_Rotate( uint32_t *texels, int size, int x, int y, int n, int turns )
+{
+    if( x < 0 || y < 0 || n <= 0 || x + n > size || y + n > size )
+    {
+        UTI_Print_Error( "Rotation does not fit on the texture" );
+        return 0;
+    }
+
+    turns = Wrap( turns, 4 );
+
+    if( turns == 0 )
+    {
+        return 1;
+    }
+
+    if( turns == 2 )
+    {
+        RGN_Flip_Horizontal( texels, size, x, y, n, n );
+        RGN_Flip_Vertical( texels, size, x, y, n, n );
+        return 1;
+    }
+
+    uint32_t *square = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * n * n );
+    RGN_Copy( texels, size, x, y, n, n, square );
+
+    // clockwise the texel at row r, column c comes from row n - 1 - c, column r of the old
+    // square, anticlockwise from row c, column n - 1 - r
+    int tr, tc, r, c, r_end, c_end;
+    uint32_t *row;
+    for( tr = 0; tr < n; tr += ROTATE_TILE )
+    {
+        r_end = ( tr + ROTATE_TILE < n ) ? tr + ROTATE_TILE : n;
+        for( tc = 0; tc < n; tc += ROTATE_TILE )
+        {
+            c_end = ( tc + ROTATE_TILE < n ) ? tc + ROTATE_TILE : n;
+            for( r = tr; r < r_end; r++ )
+            {
+                row = &texels[( y + r ) * size + x];
+                if( turns == 1 )
+                {
+                    for( c = tc; c < c_end; c++ )
+                    {
+                        row[c] = square[( n - 1 - c ) * n + r];
+                    }
+                }
+                else
+                {
+                    for( c = tc; c < c_end; c++ )
+                    {
+                        row[c] = square[c * n + ( n - 1 - r )];
+                    }
+                }
+            }
+        }
+    }
+
+    UTI_EC_Free( square );
+
+    return 1;
+}
+
+
+// moves the texels of the region dx to the right and dy down, wrapping around its edges.
+// every row of the result is two straight copies out of a copy of the region
+void RGN_Wrap_Shift( uint32_t *texels, int size, int x, int y, int w, int h, int dx, int dy )
+{
+    if( RGN_Clip( size, &x, &y, &w, &h ) == 0 )
+    {
+        return;
+    }
+
+    dx = Wrap( dx, w );
+    dy = Wrap( dy, h );
+
+    if( dx == 0 && dy == 0 )
+    {
+        return;
+    }
+
+    uint32_t *copy = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t ) * w * h );
+    RGN_Copy( texels, size, x, y, w, h, copy );
+
+    int r;
+    uint32_t *row, *src;
+    for( r = 0; r < h; r++ )
+    {
+        row = &texels[( y + r ) * size + x];
+        src = &copy[Wrap( r - dy, h ) * w];
+
+        memcpy( &row[dx], src, sizeof( uint32_t ) * ( w - dx ) );
+        memcpy( row, &src[w - dx], sizeof( uint32_t ) * dx );
+    }
+
+    UTI_EC_Free( copy );
+
+    return;
+}
+
+
+// replaces every texel in the region with map[texel]
+void RGN_Remap( uint32_t *texels, int size, int x, int y, int w, int h, const uint32_t *map )
+{
+    if( RGN_Clip( size, &x, &y, &w, &h ) == 0 )
+    {
+        return;
+    }
+
+    int r;
+    for( r = 0; r < h; r++ )
+    {
+        Remap_Row( &texels[( y + r ) * size + x], map, w );
+    }
+
+    return;
+}
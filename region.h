@@ -0,0 +1,66 @@
+/*
+    region.h
+    whole block operations on a rectangle of a texel array: copying in and out, flips,
+    rotations, wrapping shifts and palette remaps. like the raster tools every function takes
+    the texel array and its size, and regions are clipped to the texture.
+
+    the kernels work a row at a time with straight loops or memcpy so the compiler can
+    vectorize them, and they only touch the texels they are given, so different textures can
+    be transformed on different threads at once
+*/
+
+#ifndef __region_h__
+#define __region_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define RGN_MAP_SIZE            256         // entries in a remap table, one per palette index
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// clips the region at (x, y) of w x h texels to a size x size texture, returns 0 if nothing
+// of it is left
+int RGN_Clip( int size, int *x, int *y, int *w, int *h );
+
+
+// copies the w x h region at (x, y) into dest, packed with w texels per row. the region must
+// already be clipped
+void RGN_Copy( const uint32_t *texels, int size, int x, int y, int w, int h, uint32_t *dest );
+
+
+// writes the packed w x h texels in src to the texture with their top left corner at (x, y),
+// anything falling off the texture is dropped
+void RGN_Paste( uint32_t *texels, int size, int x, int y, const uint32_t *src, int w, int h );
+
+
+// mirrors the region left to right
+void RGN_Flip_Horizontal( uint32_t *texels, int size, int x, int y, int w, int h );
+
+
+// mirrors the region top to bottom
+void RGN_Flip_Vertical( uint32_t *texels, int size, int x, int y, int w, int h );
+
+
+// rotates the n x n region at (x, y) by turns quarter turns clockwise (negative turns go
+// anticlockwise). returns 0 if the square doesn't fit on the texture
+int RGN_Rotate( uint32_t *texels, int size, int x, int y, int n, int turns );
+
+
+// moves the texels of the region dx to the right and dy down, those pushed off one edge come
+// back in on the opposite edge. shifting a whole texture by half its size brings its edges
+// to the middle, which is the usual way to check and fix the seams of a tiling texture
+void RGN_Wrap_Shift( uint32_t *texels, int size, int x, int y, int w, int h, int dx, int dy );
+
+
+// replaces every texel in the region with map[texel], map has RGN_MAP_SIZE entries
+void RGN_Remap( uint32_t *texels, int size, int x, int y, int w, int h, const uint32_t *map );
+
+#endif  // __region_h__
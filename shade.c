@@ -0,0 +1,222 @@
+/*
+    shade.c
+    light level colour maps and blend tables for the game
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+#include "shade.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// the palette as separate channels, so the distances to every colour are worked out together
+struct shd_channels_s           {
+                                    int32_t     r[SHD_COLORS];
+                                    int32_t     g[SHD_COLORS];
+                                    int32_t     b[SHD_COLORS];
+                                };
+typedef struct shd_channels_s shd_channels_type;
+
+// everything the threads of a build share. rows below levels are colour maps and the rest
+// are rows of the blend table
+struct shd_job_s                {
+                                    shd_tables_type     *tables;
+                                    shd_channels_type   channels;
+                                };
+typedef struct shd_job_s shd_job_type;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns the palette index closest to r g b, the lowest index of any that are equally close
+// as GRA_Nearest_Palette_Index gives
+UTI_AVX2_CLONES
+static int Nearest_Color( const shd_channels_type *c, int r, int g, int b )
+{
+    int32_t dist[SHD_COLORS], dr, dg, db;
+    int i, best = 0;
+
+    for( i = 0; i < SHD_COLORS; i++ )
+    {
+        dr = c->r[i] - r;
+        dg = c->g[i] - g;
+        db = c->b[i] - b;
+        dist[i] = dr * dr + dg * dg + db * db;
+    }
+
+    for( i = 1; i < SHD_COLORS; i++ )
+    {
+        best = ( dist[i] < dist[best] ) ? i : best;
+    }
+
+    return best;
+}
+
+
+// fills one colour map or one row of the blend table, on one of the build threads
+static int Build_Row( int row, void *data )
+{
+    shd_job_type *job = data;
+    shd_tables_type *t = job->tables;
+    const shd_channels_type *c = &job->channels;
+    int i, levels = t->levels;
+    uint8_t *dest;
+
+    if( row < levels )
+    {
+        // light falls off evenly, the darkest level is a step above black
+        dest = &t->colormap[row * SHD_COLORS];
+        for( i = 0; i < SHD_COLORS; i++ )
+        {
+            dest[i] = Nearest_Color( c, ( c->r[i] * ( levels - row ) + levels / 2 ) / levels,
+                                        ( c->g[i] * ( levels - row ) + levels / 2 ) / levels,
+                                        ( c->b[i] * ( levels - row ) + levels / 2 ) / levels );
+        }
+        return 1;
+    }
+
+    int front = row - levels;
+    dest = &t->blend[front * SHD_COLORS];
+    for( i = 0; i < SHD_COLORS; i++ )
+    {
+        dest[i] = Nearest_Color( c, ( c->r[front] + c->r[i] + 1 ) / 2, ( c->g[front] + c->g[i] + 1 ) / 2,
+                                    ( c->b[front] + c->b[i] + 1 ) / 2 );
+    }
+
+    return 1;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// makes the colour maps for levels light levels and the blend table from the current palette
+int SHD_Build( shd_tables_type *tables, int levels )
+{
+    if( levels < 1 || levels > SHD_MAX_LEVELS )
+    {
+        UTI_Print_Error( "Light levels must be from 1 to 256" );
+        return 0;
+    }
+
+    shd_job_type *job = UTI_EC_Tag_Malloc( UTI_MEM_PALETTE, sizeof( shd_job_type ) );
+    job->tables = tables;
+
+    int i;
+    uint8_t *rgb = tables->palette;
+    for( i = 0; i < SHD_COLORS; i++, rgb += 3 )
+    {
+        GRA_Get_Palette_RGB( i, &rgb[0], &rgb[1], &rgb[2] );
+        job->channels.r[i] = rgb[0];
+        job->channels.g[i] = rgb[1];
+        job->channels.b[i] = rgb[2];
+    }
+
+    tables->levels = levels;
+    tables->colormap = UTI_EC_Tag_Malloc( UTI_MEM_PALETTE, levels * SHD_COLORS );
+    tables->blend = UTI_EC_Tag_Malloc( UTI_MEM_PALETTE, SHD_COLORS * SHD_COLORS );
+
+    uint64_t start = GRA_Get_Microseconds();
+    int ok = THR_Parallel_For( levels + SHD_COLORS, Build_Row, job );
+
+    UTI_Log( UTI_LOG_DEBUG, "Built %d light levels and a blend table in %.3fms", levels,
+             ( GRA_Get_Microseconds() - start ) / 1000.0 );
+
+    UTI_EC_Free( job );
+
+    return ok;
+}
+
+
+// frees the tables made by SHD_Build
+void SHD_Free( shd_tables_type *tables )
+{
+    UTI_EC_Free( tables->colormap );
+    UTI_EC_Free( tables->blend );
+    tables->colormap = NULL;
+    tables->blend = NULL;
+
+    return;
+}
+
+
+// writes the palette and tables to filename
+int SHD_Save( char *filename, shd_tables_type *tables )
+{
+    shd_header_type header = { { 'S', 'H', 'D', '1' }, SHD_VERSION, tables->levels, SHD_COLORS };
+
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create light table file" );
+        return 0;
+    }
+
+    int ok = 1;
+    if( fwrite( &header, sizeof( shd_header_type ), 1, file ) != 1 ||
+        fwrite( tables->palette, SHD_COLORS * 3, 1, file ) != 1 ||
+        fwrite( tables->colormap, SHD_COLORS, tables->levels, file ) != tables->levels ||
+        fwrite( tables->blend, SHD_COLORS * SHD_COLORS, 1, file ) != 1 )
+    {
+        ok = 0;
+    }
+
+    if( fclose( file ) != 0 )
+    {
+        ok = 0;
+    }
+
+    if( !ok )
+    {
+        UTI_Print_Error( "Unable to write light table file" );
+    }
+
+    return ok;
+}
+
+
+// draws tex_size x tex_size texels once at each light level into a size x size image of
+// palette indices. the grid is as many cells across as down, each texel picked by sampling
+void SHD_Preview( shd_tables_type *tables, const uint32_t *texels, int tex_size, uint8_t *dest,
+                  int size )
+{
+    int across = 1, cell, level, x, y;
+    const uint8_t *map;
+    uint8_t *row;
+
+    while( across * across < tables->levels )
+    {
+        across++;
+    }
+    cell = size / across;
+
+    memset( dest, 0, (size_t)size * size );
+
+    for( level = 0; level < tables->levels && cell > 0; level++ )
+    {
+        map = &tables->colormap[level * SHD_COLORS];
+
+        for( y = 0; y < cell; y++ )
+        {
+            row = &dest[( level / across * cell + y ) * size + level % across * cell];
+
+            for( x = 0; x < cell; x++ )
+            {
+                row[x] = map[texels[y * tex_size / cell * tex_size + x * tex_size / cell] & 0xff];
+            }
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,80 @@
+/*
+    shade.h
+    lighting and translucency tables for a palette raycaster, worked out once here rather than
+    every time the game starts.
+
+    a colour map takes a palette index to the palette colour closest to it at one light level,
+    level 0 being full brightness and each level after it a step darker. the blend table gives
+    the palette colour closest to an even mix of any two palette colours, for translucent
+    walls and sprites.
+
+    file format, all values in machine byte order, made to be mapped into memory as it is:
+        shd_header_type
+        SHD_COLORS x ( r  g  b )            - uint8_t, the palette the tables were made for
+        levels x SHD_COLORS                 - uint8_t colour maps, brightest first
+        SHD_COLORS x SHD_COLORS             - uint8_t blend table, row = front colour,
+                                              column = colour behind it
+
+    every nearest colour search is spread out between all the cores
+*/
+
+#ifndef __shade_h__
+#define __shade_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define SHD_VERSION             1
+
+#define SHD_COLORS              256         // palette entries the tables cover
+#define SHD_LEVELS              32          // default number of light levels
+#define SHD_MAX_LEVELS          256
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+struct shd_header_s             {
+                                    char        magic[4];       // "SHD1"
+                                    uint32_t    version;
+                                    uint32_t    levels;
+                                    uint32_t    colors;         // SHD_COLORS
+                                };
+typedef struct shd_header_s shd_header_type;
+
+struct shd_tables_s             {
+                                    int         levels;
+
+                                    uint8_t     palette[SHD_COLORS * 3];
+                                    uint8_t     *colormap;      // levels x SHD_COLORS
+                                    uint8_t     *blend;         // SHD_COLORS x SHD_COLORS
+                                };
+typedef struct shd_tables_s shd_tables_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// makes the colour maps for levels light levels and the blend table from the current palette
+int SHD_Build( shd_tables_type *tables, int levels );
+
+
+// frees the tables made by SHD_Build
+void SHD_Free( shd_tables_type *tables );
+
+
+// writes the palette and tables to filename
+int SHD_Save( char *filename, shd_tables_type *tables );
+
+
+// draws tex_size x tex_size texels once at each light level into a size x size image of
+// palette indices, as a grid brightest first along the rows
+void SHD_Preview( shd_tables_type *tables, const uint32_t *texels, int tex_size, uint8_t *dest,
+                  int size );
+
+#endif  // __shade_h__
@@ -7,9 +7,27 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <math.h>       //for 'floor()'
+#include <stdlib.h>     //for 'abs()'
+
+#include <stdatomic.h>
 
 #include "graphics.h"
 #include "utility.h"
+#include "raster.h"
+#include "thread.h"
+#include "thumbs.h"
+#include "texture.h"
+#include "autosave.h"
+#include "region.h"
+#include "generate.h"
+#include "atlas.h"
+#include "kernels.h"
+#include "diff.h"
+#include "layers.h"
+#include "shade.h"
+#include "palette.h"
+#include "link.h"
+#include "brush.h"
 
 //====================================================================
 //  DEFINES AND GLOBALS
@@ -55,21 +73,195 @@
 #define SELECTED_COLOR_W        32
 #define SELECTED_COLOR_H        32
 
+#define TOOL_AREA_X             PAL_AREA_X
+#define TOOL_AREA_Y             PAL_AREA_Y + PAL_AREA_H + 8
+#define TOOL_BUTTON_W           60
+#define TOOL_BUTTON_H           12
+#define TOOL_BUTTON_GAP         4
+#define TOOL_BUTTONS_PER_ROW    4
+
+// editing tools, these are also the order of the tool buttons. the 'Solid' button after the
+// last tool toggles whether rectangles and ellipses are filled
+enum { TOOL_PENCIL, TOOL_FILL, TOOL_LINE, TOOL_RECT, TOOL_ELLIPSE, TOOL_SELECT, TOOL_COUNT };
+
+#define SOLID_BUTTON            TOOL_COUNT
+#define TOOL_BUTTON_COUNT       TOOL_COUNT + 1
+
+static char                     *tool_names[TOOL_BUTTON_COUNT] = { "Pencil", "Fill", "Line", "Rect", "Ellipse", "Select", "Solid" };
+
+// thumbnail strip between the edit area and the palette, with scroll buttons above and below
+#define STRIP_X                 TXR_EDIT_X + TXR_EDIT_W + 16
+#define STRIP_UP_Y              TXR_EDIT_Y
+#define STRIP_Y                 STRIP_UP_Y + TXR_SELECT_H + 4
+#define STRIP_GAP               4
+#define STRIP_COUNT             6           // thumbnails shown at once
+#define STRIP_DOWN_Y            STRIP_Y + STRIP_COUNT * ( THUMB_SIZE + STRIP_GAP )
+
 
 static uint32_t                 selected_color = 0;
 static uint32_t                 erase_color = 0;
 
-// texture to edit
+// texels edits are drawn on, the texture being edited or the active layer of a layered one
 static uint32_t                 *current_texture = NULL;
 
 static int                      TEX_SIZE = 0;              // current texture dimensions in pixels (TEX_SIZE x TEX_SIZE) TODO - load this from file or command line
 static float                    PIXEL_SIZE = 0;             // how many pixels in the edit window make up one pixel on the texture
 
-static int                      mouse_locked = 0;
-static int                      mouse_timer = 0;
+// loops specialized for TEX_SIZE, picked once the size is known
+static const krn_table_type     *kernels = NULL;
+
+// the texture scaled up to fill the edit area, as palette indices
+static uint8_t                  edit_view[TXR_EDIT_W * TXR_EDIT_H];
+
+// with light_preview set the edit area shows the texture at every light level of the game,
+// the tables being made the first time they are needed
+static int                      light_preview = 0;
+static shd_tables_type          light_tables = { 0, { 0 }, NULL, NULL };
+
+static int                      current_tool = TOOL_PENCIL;
+static int                      solid_shapes = 0;
+
+// what the pencil draws with, made along with the edit queue
+static brs_brush_type           *brush = NULL;
+
+// stroke being drawn while a mouse button is held down. (x1, y1) is the texel it started on
+// and (x2, y2) the latest one. shapes are drawn onto the preview copy of the current texture
+// until the button is released
+static int                      stroke_active = 0;
+static int                      stroke_button = 0;
+static int                      stroke_x1, stroke_y1, stroke_x2, stroke_y2;
+static uint32_t                 stroke_color = 0;
+static uint32_t                 *stroke_preview = NULL;
+static uint32_t                 *layered_preview = NULL;    // stroke_preview with the other layers
+
+// rectangle picked with the select tool, region operations work on the whole texture while
+// select_w is 0. the clipboard holds clip_w x clip_h packed texels
+static int                      select_x = 0, select_y = 0, select_w = 0, select_h = 0;
+static uint32_t                 *clipboard = NULL;
+static int                      clip_w = 0, clip_h = 0;
+
+// region operations, bound to keys. holding shift applies them to every texture at once
+enum    {
+            REGION_COPY,                // ctrl+c
+            REGION_PASTE,               // ctrl+v, at the top left of the selection
+            REGION_SELECT_ALL,          // a
+            REGION_FLIP_H,              // h
+            REGION_FLIP_V,              // v
+            REGION_ROTATE_CW,           // r
+            REGION_ROTATE_CCW,          // e
+            REGION_SHIFT_LEFT,          // arrow keys wrap the texels round by one, or by half
+            REGION_SHIFT_RIGHT,         // the region with ctrl held
+            REGION_SHIFT_UP,
+            REGION_SHIFT_DOWN,
+            REGION_REMAP                // m, swaps the selected and erase colours
+        };
+
+// a region operation with the region it works on, shared by the threads of a batch
+struct region_op_s              {
+                                    int         op;
+                                    int         x;
+                                    int         y;
+                                    int         w;
+                                    int         h;
+                                    int         half;       // shifts move by half the region
+
+                                    uint32_t    map[RGN_MAP_SIZE];
+                                    uint32_t    **bodies;   // texel arrays a batch works on
+                                };
+typedef struct region_op_s region_op_type;
+
+static int                      strip_first = 0;            // texture at the top of the strip
 
 static char                     *filename = NULL;
 
+// palette file given with -P, the generated palette is used without one
+static char                     *palette_name = NULL;
+
+// shared memory name given with -L, the textures are published there for a running game
+static char                     *link_name = NULL;
+static lnk_link_type            *live_link = NULL;
+
+// input trace given with -R, everything the user does is recorded to it for -r to play back
+static char                     *trace_name = NULL;
+
+// set while -r plays a trace back, edit commands are then applied on the main thread
+static int                      replaying = 0;
+
+// command line, ac is reduced to leave off any display options at the end
+static int                      ac = 0;
+static char                     **av = NULL;
+
+#define BENCH_FRAMES            500         // frames timed per backend by -b
+#define BENCH_ROUNDS            2000        // calls timed per kernel by -k
+
+// input is read on the window thread and turned into edit commands, which are applied and
+// drawn on the edit thread. a slow frame never holds up reading the mouse
+enum    {
+            CMD_PICK_COLOR,             // x = palette index, button = which colour
+            CMD_STROKE_BEGIN,           // x, y = texel, button = mouse button
+            CMD_STROKE_MOVE,            // x, y = texel
+            CMD_STROKE_END,
+            CMD_PREV_TEXTURE,
+            CMD_NEXT_TEXTURE,
+            CMD_TOOL_BUTTON,            // x = tool button
+            CMD_SELECT_TEXTURE,         // x = thumbnail slot in the strip
+            CMD_SCROLL_STRIP,           // x = number of textures to scroll by
+            CMD_REGION,                 // x = region operation, y = 1 for half shifts,
+                                        // button = 1 to apply it to every texture
+            CMD_GENERATE,               // x = pattern, button = 1 to fill every texture
+            CMD_LAYER,                  // x = layer operation
+            CMD_LIGHT_PREVIEW,
+            CMD_BRUSH                   // x = brush operation, y = how many sizes to change by
+        };
+
+// layer operations, bound to keys
+enum    {
+            LAYER_ADD,                  // l, above the active layer with the erase colour see through
+            LAYER_DOWN,                 // j
+            LAYER_UP,                   // k
+            LAYER_SHOW,                 // o, hides or shows the active layer
+            LAYER_TRANSPARENT,          // t, makes the erase colour see through on the active layer
+            LAYER_REMOVE,               // x
+            LAYER_FLATTEN               // f, keeps the flattened texels and drops the layers
+        };
+
+// brush operations, bound to keys
+enum    {
+            BRUSH_SIZE,                 // [ and ], or the mouse wheel over the edit area
+            BRUSH_SHAPE,                // b, square, round and the stamp if there is one
+            BRUSH_STAMP,                // s, takes a stamp from the selection with the erase colour
+                                        // see through
+            BRUSH_PATTERN,              // n, draws with the clipboard in place of the colour, or
+                                        // goes back to the colour
+            BRUSH_DITHER                // d
+        };
+
+struct edit_cmd_s               {
+                                    int         type;
+                                    int         x;
+                                    int         y;
+                                    int         button;
+                                };
+typedef struct edit_cmd_s edit_cmd_type;
+
+#define EDIT_QUEUE_SIZE         4096
+#define FRAME_TIME              5           // minimum milliseconds between drawn frames
+
+static thr_queue_type           *edit_queue = NULL;
+static atomic_int               editing = 0;
+
+// mouse button that started the stroke being sent to the edit thread, 0 if there isn't one.
+// only used on the window thread
+static int                      input_stroke_button = 0;
+
+#define AUTOSAVE_TIME           60000       // milliseconds between autosaves while editing
+
+// set when the textures have changed since the last autosave, edit thread only
+static int                      unsaved_edits = 0;
+
+// seed for the next generated pattern, bumped every time so each one comes out different
+static uint32_t                 generate_seed = 0;
+
 //====================================================================
 //  FUNCTION PROTOTYPES
 //====================================================================
@@ -99,12 +291,99 @@ int Get_Next_Texture();
 // get previous texture
 int Get_Prev_Texture();
 
+// select the texture at index for editing, it must exist
+void Select_Texture( int index );
+
 // draw current texture to the editing window
 void Draw_Current_Texture();
 
 // free texture memory
 void Free_Textures();
 
+// gives a texture its own texel array if it is sharing one
+void Unshare_Texture( int index );
+
+// gives the current texture its own texel array if it is sharing one, call before editing
+void Unshare_Current_Texture();
+
+// marks texels (x1, y1) to (x2, y2) of the current texture as edited
+void Mark_Edited( int x1, int y1, int x2, int y2 );
+
+// brings the current texture up to date after a batch of edits
+void Finish_Edits();
+
+// makes sure nothing outside the texture list holds the texel arrays, returns them in bodies
+int Unshare_Bodies( uint32_t **bodies );
+
+// counts the palette indices used by every texture, and the set as a whole
+void Recount_Usage();
+
+// counts the palette indices used by one texture, on one of the count threads
+int Count_Texture( int index, void *data );
+
+// brings the set's palette index counts up to date with the current texture's
+void Sync_Set_Usage();
+
+// opens the live link given with -L and publishes the textures to it
+int Open_Live_Link();
+
+// start building thumbnails of all textures
+int Start_Thumbnails();
+
+// checks every .txr file in paths (directories are searched) in parallel, no window is opened
+int Verify_Files( char **paths, int count );
+
+// checks one file of the list being verified
+int Verify_File( int index, void *data );
+
+// makes a new file of count textures filled with a pattern, no window is opened
+int Generate_File( int count, int type, uint32_t seed );
+
+// packs the textures of the open file into an atlas for the game, no window is opened
+int Export_Atlas( char *atlas_name, int page_size, int padding, int mips );
+
+// lists the textures that differ between two files, no window is opened. returns the exit
+// code, 0 if they are the same, 1 if they differ and 2 if they couldn't be compared
+int Compare_Files( char *file_a, char *file_b );
+
+// merges the changes made to base in ours and theirs into output, no window is opened.
+// returns the exit code, 0 for a clean merge, 1 if there were conflicts and 2 on failure
+int Merge_Files( char *base, char *ours, char *theirs, char *output );
+
+// writes the light level colour maps and blend table for the palette, no window is opened
+int Export_Light_Tables( char *tables_name, int levels );
+
+// fits the palette to the textures of the open file and saves both, no window is opened
+int Optimize_Palette( char *output, char *new_palette, int colors );
+
+// lists the palette entries the textures of the open file use, no window is opened
+int Print_Usage();
+
+// plays back an input trace against the open file as fast as it goes, no window is opened
+int Replay_Trace( char *trace, char *timings );
+
+// prints the average, median, 95th percentile and worst of count frame times in microseconds
+void Print_Frame_Times( char *name, uint32_t *times, int count );
+
+// sorts frame times, smallest first
+int Compare_Times( const void *a, const void *b );
+
+// returns a hash of every texture and layer, the same for sets that are the same
+uint64_t Hash_Set();
+
+// loads the palette given with -P, or generates one
+int Init_Palette();
+
+// times drawing and showing frames with every display backend
+int Benchmark( int frames );
+
+// times the specialized kernels against the generic ones for every size that has them
+int Benchmark_Kernels( int rounds );
+
+// returns the average microseconds taken by one kernel
+double Time_Kernel( const krn_table_type *k, int kernel, uint32_t *texels, int size,
+                    uint8_t *dest, int rounds );
+
 //==================
 //  GUI
 //==================
@@ -112,6 +391,12 @@ void Free_Textures();
 // draws all screen elements
 void Draw_Tools();
 
+// draws the thumbnail strip
+void Draw_Thumbnails();
+
+// scrolls the thumbnail strip so it starts at texture first
+void Scroll_Strip( int first );
+
 //===================
 //  INPUT
 //===================
@@ -119,9 +404,88 @@ void Draw_Tools();
 // handle command line arguments
 int Parse_Args( int argc, char *argv[] );
 
-// basic input capture
+// converts a string of digits to a number, returns -1 if it isn't one
+int itoa( char *str );
+
+// basic input capture, turns input events into edit commands
 void Mouse_Input();
 
+// converts a mouse position in window coordinates to screen resolution coordinates
+void Mouse_To_Screen( int mousex, int mousey, int *m_res_x, int *m_res_y );
+
+// converts screen coordinates to texel coordinates on the current texture
+int Screen_To_Texel( int m_res_x, int m_res_y, int *tex_x, int *tex_y );
+
+// returns the palette index at screen coordinates, or -1 if outside the palette area
+int Palette_Color_At( int m_res_x, int m_res_y );
+
+// returns the tool button at screen coordinates, or -1 if there isn't one
+int Tool_Button_At( int m_res_x, int m_res_y );
+
+// returns the thumbnail slot at screen coordinates, or -1 if there isn't one
+int Strip_Slot_At( int m_res_x, int m_res_y );
+
+// handles the mouse wheel
+void Mouse_Wheel( int m_res_x, int m_res_y, int wheel );
+
+// handles a mouse button being pressed
+void Mouse_Press( int m_res_x, int m_res_y, int m_button );
+
+// handles the mouse moving
+void Mouse_Drag( int m_res_x, int m_res_y, int m_button );
+
+// handles a key being pressed
+void Key_Press( int key, int mods );
+
+// sends an edit command to the edit thread
+void Send_Command( int type, int x, int y, int button );
+
+// applies all edit commands waiting on the queue, edit thread only
+void Process_Commands();
+
+// edit thread, applies edit commands and draws frames until editing is cleared
+int Edit_Thread( void *data );
+
+// starts a stroke with the current tool at texel (x, y)
+void Begin_Stroke( int x, int y, int m_button );
+
+// continues the stroke to texel (x, y)
+void Continue_Stroke( int x, int y );
+
+// returns 1 if the stroke is a shape being dragged out
+int Stroke_Is_Shape();
+
+// draws the shape being dragged out into the given texel array
+void Draw_Shape( uint32_t *texels );
+
+// finishes the stroke when its mouse button is released
+void End_Stroke();
+
+// sets the selection to the rectangle with corners (x1, y1) and (x2, y2)
+void Set_Selection( int x1, int y1, int x2, int y2 );
+
+// applies a region operation to the current texture or every texture, edit thread only
+void Region_Command( int op, int half, int all );
+
+// fills the current texture or every texture with a pattern, edit thread only
+void Generate_Pattern( int type, int all );
+
+// applies a layer operation to the current texture, returns 1 if its flattened texels changed.
+// edit thread only
+int Layer_Command( int op );
+
+// applies a brush operation, edit thread only
+void Brush_Command( int op, int steps );
+
+// applies a region operation to one texel array
+int Transform_Texels( uint32_t *texels, region_op_type *op );
+
+// applies a region operation to one texture of a batch
+int Transform_Texture( int index, void *data );
+
+// hands a snapshot of the textures to the autosave thread, edit thread only
+void Autosave();
+
 //====================================================================
 //  MAIN
 //====================================================================
@@ -151,10 +515,46 @@ int main( int argc, char *argv[] )
             Generate_Texture();
             break;
 
+        case 3:
+            return( Verify_Files( &av[2], ac - 2 ) ? 0 : 1 );
+
+        case 4:
+            return( Benchmark( ( ac > 2 ) ? itoa( av[2] ) : BENCH_FRAMES ) ? 0 : 1 );
+
+        case 5:
+            return( Generate_File( itoa( av[4] ), GEN_Find( av[5] ), ( ac > 6 ) ? itoa( av[6] ) : 0 ) ? 0 : 1 );
+
+        case 6:
+            return( Export_Atlas(   av[3], ( ac > 4 ) ? itoa( av[4] ) : ATL_PAGE_SIZE,
+                                    ( ac > 5 ) ? itoa( av[5] ) : ATL_PADDING,
+                                    ( ac > 6 ) ? itoa( av[6] ) : 0 ) ? 0 : 1 );
+
+        case 7:
+            return( Benchmark_Kernels( ( ac > 2 ) ? itoa( av[2] ) : BENCH_ROUNDS ) ? 0 : 1 );
+
+        case 8:
+            return Compare_Files( av[2], av[3] );
+
+        case 9:
+            return Merge_Files( av[2], av[3], av[4], av[5] );
+
+        case 10:
+            return( Export_Light_Tables( av[2], ( ac > 3 ) ? itoa( av[3] ) : SHD_LEVELS ) ? 0 : 1 );
+
+        case 11:
+            return( Optimize_Palette( av[3], av[4], ( ac > 5 ) ? itoa( av[5] ) : PAL_COLORS ) ? 0 : 1 );
+
+        case 12:
+            return( Print_Usage() ? 0 : 1 );
+
+        case 13:
+            return( Replay_Trace( av[3], ( ac > 4 ) ? av[4] : NULL ) ? 0 : 1 );
+
         default:
             break;
     }
 
+    kernels = KRN_Select( TEX_SIZE );
 
     // create display window
     if( GRA_Create_Display( "TexEdit", SCREEN_WIDTH, SCREEN_HEIGHT, RES_WIDTH, RES_HEIGHT ) == 0 )
@@ -168,7 +568,7 @@ int main( int argc, char *argv[] )
         UTI_Fatal_Error( "Unable to load font data" );
     }
  
-    if( GRA_Generate_Palette() == 0 )
+    if( Init_Palette() == 0 )
     {
         UTI_Fatal_Error( "Unable to generate palette" );
     }
@@ -179,47 +579,74 @@ int main( int argc, char *argv[] )
     }
 
     Get_Current_Texture();
+    Recount_Usage();
 
-    // loop control
-    int running = 1;
-    while( running )
+    if( Start_Thumbnails() == 0 )
     {
-        // clear the screen
-        GRA_Clear_Screen();
-       
-        Mouse_Input();
+        UTI_Fatal_Error( "Unable to start thumbnail thread" );
+    }
 
-        Draw_Tools();
+    if( Open_Live_Link() == 0 )
+    {
+        UTI_Fatal_Error( "Unable to open live link" );
+    }
 
-        Draw_Current_Texture();
+    // the trace starts from the textures as they are now, which -r checks it is given
+    if( trace_name != NULL && GRA_Record_Input( trace_name, Hash_Set() ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to record input" );
+    }
 
-        // Refresh Window
-        GRA_Refresh_Window();    
+    // start editing and drawing on their own thread
+    edit_queue = THR_Create_Queue( EDIT_QUEUE_SIZE, sizeof( edit_cmd_type ) );
+    brush = BRS_Create();
+    atomic_store( &editing, 1 );
+
+    if( ASV_Start( filename ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start autosave thread" );
+    }
+
+    thr_thread_type *edit_thread = THR_Create_Thread( Edit_Thread, "edit", NULL );
+    if( edit_thread == NULL )
+    {
+        UTI_Fatal_Error( "Unable to start edit thread" );
+    }
 
+    // loop control, this thread only reads input and shows finished frames
+    int running = 1;
+    while( running )
+    {
+        // collect input and pass it on to the edit thread
         running = GRA_Check_Quit();
 
+        Mouse_Input();
 
-        if( mouse_locked )
-        {
-            if( mouse_timer > 0 )
-            {
-                mouse_timer--;
-            }
-            else
-            {
-                mouse_locked = 0;
-            }
-        }
+        // Refresh Window
+        GRA_Present_Frame();
 
-        GRA_Delay( 5 );
+        GRA_Delay( 1 );
     }
 
-    Save_Textures();
+    // let the edit thread finish any commands still queued
+    atomic_store( &editing, 0 );
+    THR_Wait_Thread( edit_thread );
+    THR_Destroy_Queue( edit_queue );
+
+    // the autosave is only kept if the real save failed
+    ASV_Stop( Save_Textures() );
+
+    THM_Stop();
+
+    LNK_Close( live_link );
 
     Free_Textures();
 
     GRA_Close();
 
+    SHD_Free( &light_tables );
+    GRA_Free_Palette();
+
     return 0;
 }
 
@@ -239,79 +666,83 @@ uint32_t                        *textures[MAX_TEXTURES];    // list of texture p
 uint32_t                        texp = 0;                   // current texture
 uint32_t                        texn = 0;                   // number of textures (current top of stack)
 
+static uint32_t                 *blank_texture = NULL;      // shared by all new textures
 
-// saves current textures to a file
-int Save_Textures()
-{
-    FILE *file;
+static lyr_stack_type           *layers[MAX_TEXTURES];      // NULL for flat textures
 
-    file = fopen( filename, "w" );
-    if( file == NULL )
-    {
-        UTI_Print_Error( "Unable to create file" );
-        return 0;
-    }
+// how many texels of each palette index every texture and the whole set use. the current
+// texture's counts follow every texel written, and set_usage catches up with them at the end
+// of each batch of edits from set_counted, the counts it last caught up with
+static uint32_t                 usage[MAX_TEXTURES][PAL_COLORS];
+static uint64_t                 set_usage[PAL_COLORS];
+static uint32_t                 set_counted[PAL_COLORS];
 
-    // create the file header
-    char filetype[4] = "TXTR";
-    fwrite( filetype, 4, 1, file );
-    fwrite( &TEX_SIZE, sizeof( uint32_t ), 1, file );
-    fwrite( &texn, sizeof( uint32_t ), 1, file );
 
-    int i = 0;
-    while( i < texn )
-    {
-        fwrite( textures[i], sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE, 1, file );
-        i++;
-    }
+// saves current textures to a file, identical textures are only stored once
+int Save_Textures()
+{
+    txr_set_type set = { TEX_SIZE, texn, textures };
+    LYR_Add_To_Set( &set, layers, texn );
 
-    fclose( file );
+    int ok = TXR_Save_File( filename, &set );
 
-    return 1;
+    // the textures are only borrowed, so just the layers are let go
+    set.count = 0;
+    set.textures = NULL;
+    TXR_Free_Set( &set );
+
+    return ok;
 }
 
-// load textures from a file
+// load textures from a file, identical textures share memory
 int Load_Textures()
 {
-    FILE *file = NULL;
-    char file_check[5];
+    txr_set_type set;
 
-    file = fopen( filename, "r" );
-    if( file == NULL )
+    if( TXR_Load_File( filename, &set ) == 0 )
     {
-        UTI_Print_Error( "Unable to open file" );
         return 0;
     }
 
-    fread( file_check, 4, 1, file );
-    file_check[4] = '\0';
-
-    if( strcmp( file_check, "TXTR" ) != 0 )
+    if( set.count > MAX_TEXTURES )
     {
-        UTI_Print_Error( "Cannot open file, invalid file type" );
+        UTI_Print_Error( "Cannot open file, too many textures" );
+        TXR_Free_Set( &set );
         return 0;
     }
 
-    fread( &TEX_SIZE, 4, 1, file );
-    fread( &texn, 4, 1, file );
+    TEX_SIZE = set.tex_size;
+    texn = set.count;
+    memcpy( textures, set.textures, sizeof( uint32_t * ) * texn );
 
-    printf( "File '%s' opened: %d textures, %dx%d\n", filename, texn, TEX_SIZE, TEX_SIZE );
-    
-    int i = 0;
-    while( i < texn )
+    // the textures are kept and the layers referenced by their stacks
+    set.count = 0;
+    int ok = LYR_Take_From_Set( &set, layers );
+    TXR_Free_Set( &set );
+
+    if( ok == 0 )
     {
-        textures[i] = UTI_EC_Malloc( sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE );
-        fread( textures[i], sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE, 1, file );
-        i++;
+        Free_Textures();
+        return 0;
+    }
+
+    // count how many distinct texel arrays the textures ended up using
+    int i, j, unique = 0;
+    for( i = 0; i < texn; i++ )
+    {
+        for( j = 0; j < i && textures[j] != textures[i]; j++ );
+        unique += ( j == i );
     }
 
-    current_texture = textures[0];
+    UTI_Log( UTI_LOG_INFO, "File '%s' opened: %d textures (%d unique), %dx%d", filename, texn, unique,
+             TEX_SIZE, TEX_SIZE );
 
-    PIXEL_SIZE = TXR_EDIT_W / TEX_SIZE;
+    texp = 0;
+    Get_Current_Texture();
 
-    printf( "Textures read\n" );
+    PIXEL_SIZE = TXR_EDIT_W / TEX_SIZE;
 
-    fclose( file );
+    UTI_Log( UTI_LOG_DEBUG, "Textures read" );
 
     return 1;
 }
@@ -321,6 +752,7 @@ void Init_Textures()
     int i = 0;
     while( i < MAX_TEXTURES )
     {
+        layers[i] = NULL;
         textures[i++] = NULL;
     }
     
@@ -336,23 +768,40 @@ int Generate_Texture()
         return 0;
     }
 
-    textures[texn] = UTI_EC_Malloc( sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE );
+    // all blank textures share one texel array until they are drawn on
+    if( blank_texture == NULL )
+    {
+        blank_texture = TXR_Create( TEX_SIZE );
+    }
+
+    textures[texn] = TXR_Retain( blank_texture );
+
+    THM_Set_Texture( texn, textures[texn] );
+
+    Count_Texture( texn, NULL );
 
-    // make texture blank
     int i;
-    for( i = 0; i < (TEX_SIZE * TEX_SIZE); i++ )
+    for( i = 0; i < PAL_COLORS; i++ )
     {
-        textures[texn][i] = 0;          // 0 is black on the palette
+        set_usage[i] += usage[texn][i];
     }
 
     texn++;
     return 1;
 }
 
-// for initialization
+// points current_texture at the texels edits go to, the active layer of a layered texture
 void Get_Current_Texture()
 {
-    current_texture = textures[texp];
+    if( layers[texp] != NULL )
+    {
+        current_texture = layers[texp]->layer[layers[texp]->active].texels;
+    }
+    else
+    {
+        current_texture = textures[texp];
+    }
+
     return;
 }
 
@@ -372,9 +821,9 @@ int Get_Next_Texture()
     }
 
 
-    current_texture = textures[texp];
-    
-    printf( "Current Texture = %d\n", texp );
+    Select_Texture( texp );
+
+    UTI_Log( UTI_LOG_DEBUG, "Current Texture = %d", texp );
     return 1;
 }
 
@@ -387,12 +836,33 @@ int Get_Prev_Texture()
         return 0;
     }
 
-    current_texture = textures[--texp];
+    Select_Texture( texp - 1 );
 
-    printf( "Current Texture = %d\n", texp );
+    UTI_Log( UTI_LOG_DEBUG, "Current Texture = %d", texp );
     return 1;
 }
 
+// select the texture at index for editing, it must exist. the strip scrolls to keep it in view
+void Select_Texture( int index )
+{
+    texp = index;
+    Get_Current_Texture();
+
+    // edits to the last texture have already been added to the set's counts
+    memcpy( set_counted, usage[texp], sizeof( set_counted ) );
+
+    if( texp < strip_first )
+    {
+        Scroll_Strip( texp );
+    }
+    else if( texp >= strip_first + STRIP_COUNT )
+    {
+        Scroll_Strip( texp - STRIP_COUNT + 1 );
+    }
+
+    return;
+}
+
 // draw current texture to the editing window
 void Draw_Current_Texture()
 {
@@ -401,211 +871,2280 @@ void Draw_Current_Texture()
         return;
     }
 
-    int i, j;
-    for( i = 0; i < TEX_SIZE; i++ )
+    // the light level preview takes the place of the texture
+    if( light_preview )
+    {
+        SHD_Preview( &light_tables, textures[texp], TEX_SIZE, edit_view, TXR_EDIT_W );
+        GRA_Draw_Indexed_Image( TXR_EDIT_X, TXR_EDIT_Y, TXR_EDIT_W, TXR_EDIT_H, edit_view );
+        return;
+    }
+
+    // show the shape being dragged out on top of the texture, on a layered texture it is drawn
+    // on the active layer and the layers flattened again
+    uint32_t *texels = textures[texp];
+    if( Stroke_Is_Shape() )
     {
-        for( j = 0; j < TEX_SIZE; j++ )
+        memcpy( stroke_preview, current_texture, sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE );
+        Draw_Shape( stroke_preview );
+        texels = stroke_preview;
+
+        if( layers[texp] != NULL )
         {
-            GRA_Draw_Filled_Rectangle( (TXR_EDIT_X+i*PIXEL_SIZE), (TXR_EDIT_Y+j*PIXEL_SIZE), PIXEL_SIZE, PIXEL_SIZE, GRA_Get_Palette_Color(current_texture[j*TEX_SIZE+i]) );
+            LYR_Composite_With( layers[texp], layered_preview, layers[texp]->active, stroke_preview );
+            texels = layered_preview;
         }
     }
-    return;
-}
 
-// frees memory taken by textures
-void Free_Textures()
-{
-    int i = 0;
-    while( i < texn )
+    // scale the texels up to the edit area and draw them as one image
+    int scale = PIXEL_SIZE;
+    if( scale < 1 )
     {
-        UTI_EC_Free( textures[i] );
-        i++;
+        return;
     }
 
+    KRN_Blit( kernels, texels, TEX_SIZE, scale, edit_view );
+    GRA_Draw_Indexed_Image( TXR_EDIT_X, TXR_EDIT_Y, TEX_SIZE * scale, TEX_SIZE * scale, edit_view );
+
+    // outline the selection
+    if( select_w > 0 )
+    {
+        GRA_Draw_Hollow_Rectangle(  TXR_EDIT_X + select_x * PIXEL_SIZE, TXR_EDIT_Y + select_y * PIXEL_SIZE,
+                                    select_w * PIXEL_SIZE, select_h * PIXEL_SIZE, GRA_Match_Color( 255, 255, 255 ) );
+    }
     return;
 }
 
-//============================
-//  GUI
-//============================
-
-// draws the GUI to the screen
-void Draw_Tools()
+// gives a texture its own texel array if it is sharing one
+void Unshare_Texture( int index )
 {
+    if( !TXR_Shared( textures[index] ) )
+    {
+        return;
+    }
 
-    uint32_t WHITE = GRA_Create_Color( 255, 255, 255, 255 );
-
-    // Draw Edit Area and Palette Area
-    GRA_Draw_Hollow_Rectangle( TXR_EDIT_X-1, TXR_EDIT_Y-1, TXR_EDIT_W+1, TXR_EDIT_H+2, WHITE );
-    GRA_Draw_Hollow_Rectangle( PAL_AREA_X-1, PAL_AREA_Y-1, PAL_AREA_W+1, PAL_AREA_H+2, WHITE );
-
-    GRA_Simple_Text( "Texture", 32, 16, WHITE, 0, 0 );
-    GRA_Simple_Text( "Palette", 356, 16, WHITE, 0, 0 );
+    uint32_t *shared = textures[index];
 
-    // Draw Color Selections
-    GRA_Draw_Hollow_Rectangle( SELECTED_COLOR_X-1, SELECTED_COLOR_Y-1,  SELECTED_COLOR_W+1, SELECTED_COLOR_H+2, WHITE );
-    GRA_Draw_Hollow_Rectangle( ERASE_COLOR_X-1, ERASE_COLOR_Y-1,  ERASE_COLOR_W+1, ERASE_COLOR_H+2, WHITE );
+    textures[index] = TXR_Copy( shared );
 
-    GRA_Draw_Filled_Rectangle( SELECTED_COLOR_X, SELECTED_COLOR_Y, SELECTED_COLOR_W, SELECTED_COLOR_H, GRA_Get_Palette_Color( selected_color ) );
-    GRA_Draw_Filled_Rectangle( ERASE_COLOR_X, ERASE_COLOR_Y, ERASE_COLOR_W, ERASE_COLOR_H, GRA_Get_Palette_Color( erase_color ) );
+    // the thumbnail thread has to stop reading the old array before it is released
+    THM_Set_Texture( index, textures[index] );
+    TXR_Release( shared );
 
-    GRA_Simple_Text( "Selected Colour", 72, SELECTED_COLOR_Y + 8, WHITE, 0, 0 );
-    GRA_Simple_Text( "Erase Colour",    72, ERASE_COLOR_Y + 8, WHITE, 0, 0 );
- 
-    // draw texture selection arrows
-    GRA_Draw_Hollow_Rectangle( TXR_SELECT_LEFT_X, TXR_SELECT_LEFT_Y, TXR_SELECT_W, TXR_SELECT_H, WHITE );
-    GRA_Draw_Hollow_Rectangle( TXR_SELECT_RIGHT_X, TXR_SELECT_RIGHT_Y, TXR_SELECT_W, TXR_SELECT_H, WHITE );
+    return;
+}
 
-    GRA_Simple_Text( "<", TXR_SELECT_LEFT_X + 8, TXR_SELECT_LEFT_Y + 2, WHITE, 0, 0 );
-    GRA_Simple_Text( ">", TXR_SELECT_RIGHT_X + 8, TXR_SELECT_RIGHT_Y + 2, WHITE, 0, 0 );
+// gives the current texture its own texel array if it is sharing one, call before editing. a
+// layered texture needs its active layer unsharing too, as that is what gets drawn on
+void Unshare_Current_Texture()
+{
+    Unshare_Texture( texp );
 
-    // TODO tidy
-    int i = 0, j;
-    for( i = 0; i < 16; i++ )
+    if( layers[texp] != NULL )
     {
-        for( j = 0; j < 16; j++ )
-        {
-            GRA_Draw_Filled_Rectangle( PAL_AREA_X+i*16, PAL_AREA_Y+j*16, 16, 16, GRA_Get_Palette_Color(i*16+j) );
-        }
+        LYR_Unshare( layers[texp], layers[texp]->active );
     }
+
+    Get_Current_Texture();
+
     return;
 }
 
-//============================
-//  CONTROL AND INPUT
-//============================
-
-#include <ctype.h>
+// marks texels (x1, y1) to (x2, y2) of the current texture as edited, so the tiles they are in
+// get flattened again at the end of the batch. flat textures have nothing to do
+void Mark_Edited( int x1, int y1, int x2, int y2 )
+{
+    if( layers[texp] != NULL )
+    {
+        LYR_Mark_Dirty( layers[texp], x1, y1, x2, y2 );
+    }
 
-static int ac = 0;
-static char **av = NULL;
+    return;
+}
 
-int itoa( char *str )
+// brings the current texture up to date after a batch of edits, flattening the tiles of its
+// layers that were drawn on
+void Finish_Edits()
 {
-    int len = strlen( str );
-    int i;
-    int n = 0;
-    for( i = 0; i < len; i++ )
+    if( layers[texp] != NULL )
     {
-        if( !isdigit( str[i] ) )
+        LYR_Composite( layers[texp], textures[texp], usage[texp] );
+
+        // removing a layer can leave one that was never drawn on active
+        if( !TXR_Shared( current_texture ) )
         {
-            return -1;
+            TXR_Update_Hash( current_texture );
         }
-        
-        n = n * 10 + ( str[i] - '0' );
     }
 
-    return n;
+    TXR_Update_Hash( textures[texp] );
+    THM_Texture_Changed( texp );
+    Sync_Set_Usage();
+
+    return;
 }
 
-// handle command line arguments
-int Parse_Args( int argc, char *argv[] )
+// makes every texel array in use safe to write to the same way in all the textures using it.
+// a shared array is swapped for one new copy, so textures sharing it go on sharing. bodies is
+// filled with the distinct arrays and their number is returned
+int Unshare_Bodies( uint32_t **bodies )
 {
-    // get command line args
-    ac = argc;
-    av = argv;
+    int i, j, b, count = 0;
+    uint32_t *shared, *copy;
 
-    if( ac < 2 )
+    for( i = 0; i < texn; i++ )
     {
-        printf( "Usage: %s <command> <filename> <size>\n", av[0] );
-        printf( "Where  <command> = -o to open an existing file or -n to open a new file\n" );
-        printf( "       <size>    = texture size in pixels, only needed when opening new files\n" );
-        return 0;
-    }
+        for( b = 0; b < count && bodies[b] != textures[i]; b++ );
+        if( b < count )
+        {
+            continue;
+        }
 
-    if( ( strcmp( av[1], "-o" ) == 0 ) && ac > 2 )
+        if( TXR_Shared( textures[i] ) )
+        {
+            shared = textures[i];
+            copy = TXR_Copy( shared );
+
+            for( j = i; j < texn; j++ )
+            {
+                if( textures[j] == shared )
+                {
+                    textures[j] = TXR_Retain( copy );
+                    THM_Set_Texture( j, copy );
+                    TXR_Release( shared );
+                }
+            }
+
+            // the textures hold all the references now
+            TXR_Release( copy );
+        }
+
+        bodies[count++] = textures[i];
+    }
+
+    Get_Current_Texture();
+
+    return count;
+}
+
+// counts the palette indices used by every texture in parallel, and totals them for the set
+void Recount_Usage()
+{
+    THR_Parallel_For( texn, Count_Texture, NULL );
+
+    int i, j;
+    memset( set_usage, 0, sizeof( set_usage ) );
+    for( i = 0; i < texn; i++ )
+    {
+        for( j = 0; j < PAL_COLORS; j++ )
+        {
+            set_usage[j] += usage[i][j];
+        }
+    }
+
+    memcpy( set_counted, usage[texp], sizeof( set_counted ) );
+
+    return;
+}
+
+// counts the palette indices used by one texture, on one of the count threads
+int Count_Texture( int index, void *data )
+{
+    memset( usage[index], 0, sizeof( usage[index] ) );
+    PAL_Count_Region( textures[index], TEX_SIZE, 0, 0, TEX_SIZE, TEX_SIZE, usage[index], 1 );
+
+    return 1;
+}
+
+// brings the set's palette index counts up to date with the current texture's, which only
+// takes the 256 differences from when they were last brought up to date
+void Sync_Set_Usage()
+{
+    int i;
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        set_usage[i] += (int64_t)usage[texp][i] - (int64_t)set_counted[i];
+    }
+
+    memcpy( set_counted, usage[texp], sizeof( set_counted ) );
+
+    return;
+}
+
+// checks every .txr file in paths (directories are searched) in parallel, no window is opened.
+// returns 1 if every file passed
+int Verify_Files( char **paths, int count )
+{
+    int found, ok;
+    char **files = UTI_Find_Files( paths, count, ".txr", &found );
+
+    uint32_t start = GRA_Get_Ticks();
+    ok = THR_Parallel_For( found, Verify_File, files );
+
+    printf( "Checked %d files in %ums: %s\n", found, GRA_Get_Ticks() - start,
+            ok ? "all passed" : "FAILURES FOUND" );
+
+    UTI_Free_Files( files, found );
+
+    return ok;
+}
+
+// checks one file of the list being verified
+int Verify_File( int index, void *data )
+{
+    char **files = data;
+    const char *problem = NULL;
+    int has_crc, ok;
+
+    ok = TXR_Verify_File( files[index], &problem, &has_crc );
+
+    if( !ok )
+    {
+        printf( "FAILED  %s: %s\n", files[index], problem );
+    }
+    else
+    {
+        printf( "ok      %s%s\n", files[index], has_crc ? "" : " (no checksums)" );
+    }
+
+    return ok;
+}
+
+// makes a new file of count textures filled with a pattern, no window is opened. the pattern
+// is matched to the palette the editor would use
+int Generate_File( int count, int type, uint32_t seed )
+{
+    if( Init_Palette() == 0 )
+    {
+        return 0;
+    }
+
+    for( texn = 0; texn < count; texn++ )
+    {
+        textures[texn] = TXR_Create( TEX_SIZE );
+    }
+
+    uint32_t start = GRA_Get_Ticks();
+    int i, ok = GEN_Textures( textures, texn, TEX_SIZE, type, seed );
+
+    for( i = 0; i < texn; i++ )
+    {
+        TXR_Update_Hash( textures[i] );
+    }
+
+    printf( "Generated %d %dx%d '%s' textures in %ums\n", texn, TEX_SIZE, TEX_SIZE,
+            GEN_Get_Name( type ), GRA_Get_Ticks() - start );
+
+    ok = ok && Save_Textures();
+
+    Free_Textures();
+    GRA_Free_Palette();
+
+    return ok;
+}
+
+// packs the textures of the open file into an atlas for the game, no window is opened. mips
+// are matched to the palette the editor uses
+int Export_Atlas( char *atlas_name, int page_size, int padding, int mips )
+{
+    if( Load_Textures() == 0 || Init_Palette() == 0 )
+    {
+        return 0;
+    }
+
+    uint32_t start = GRA_Get_Ticks();
+    int ok = ATL_Export( atlas_name, textures, texn, TEX_SIZE, page_size, padding, mips );
+
+    printf( "Atlas '%s' %s in %ums\n", atlas_name, ok ? "written" : "FAILED",
+            GRA_Get_Ticks() - start );
+
+    Free_Textures();
+    GRA_Free_Palette();
+
+    return ok;
+}
+
+// lists the textures that differ between two files, no window is opened
+int Compare_Files( char *file_a, char *file_b )
+{
+    uint32_t start = GRA_Get_Ticks();
+    int changed, ok = DIF_Compare( file_a, file_b, &changed );
+
+    if( ok )
+    {
+        printf( "Compared in %ums\n", GRA_Get_Ticks() - start );
+    }
+
+    return( ok == 0 ) ? 2 : ( changed > 0 );
+}
+
+// merges the changes made to base in ours and theirs into output, no window is opened
+int Merge_Files( char *base, char *ours, char *theirs, char *output )
+{
+    uint32_t start = GRA_Get_Ticks();
+    int conflicts, ok = DIF_Merge( base, ours, theirs, output, &conflicts );
+
+    printf( "Merge into '%s' %s in %ums\n", output, ok ? "written" : "FAILED",
+            GRA_Get_Ticks() - start );
+
+    return( ok == 0 ) ? 2 : ( conflicts > 0 );
+}
+
+// writes the light level colour maps and blend table for the palette, no window is opened.
+// they are made from the palette the editor uses
+int Export_Light_Tables( char *tables_name, int levels )
+{
+    if( Init_Palette() == 0 )
+    {
+        return 0;
+    }
+
+    shd_tables_type tables;
+
+    uint32_t start = GRA_Get_Ticks();
+    int ok = SHD_Build( &tables, levels ) && SHD_Save( tables_name, &tables );
+
+    printf( "Light tables '%s' (%d levels) %s in %ums\n", tables_name, levels,
+            ok ? "written" : "FAILED", GRA_Get_Ticks() - start );
+
+    SHD_Free( &tables );
+    GRA_Free_Palette();
+
+    return ok;
+}
+
+// fits the palette to the textures and layers of the open file, no window is opened. the
+// remapped textures are saved to output and the palette to new_palette, which is then given
+// to the other commands with -P
+int Optimize_Palette( char *output, char *new_palette, int colors )
+{
+    txr_set_type set;
+
+    if( Init_Palette() == 0 || TXR_Load_File( filename, &set ) == 0 )
+    {
+        GRA_Free_Palette();
+        return 0;
+    }
+
+    uint32_t start = GRA_Get_Ticks();
+    int used = PAL_Optimize( &set, colors );
+
+    printf( "Palette fitted to %d textures in %ums, %d entries used\n", set.count,
+            GRA_Get_Ticks() - start, used );
+
+    int ok = ( used > 0 ) && TXR_Save_File( output, &set ) && GRA_Save_Palette( new_palette );
+
+    TXR_Free_Set( &set );
+    GRA_Free_Palette();
+
+    return ok;
+}
+
+// lists the palette entries the textures of the open file use, no window is opened. each one
+// in use is given with its texel count and how many textures use it, then the free ones
+int Print_Usage()
+{
+    if( Load_Textures() == 0 )
+    {
+        return 0;
+    }
+
+    uint32_t start = GRA_Get_Ticks();
+    Recount_Usage();
+    uint32_t counted = GRA_Get_Ticks() - start;
+
+    int i, j, users, unused = 0;
+    printf( "index      texels  textures\n" );
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        for( j = 0, users = 0; j < texn; j++ )
+        {
+            users += ( usage[j][i] > 0 );
+        }
+
+        if( set_usage[i] > 0 )
+        {
+            printf( "%5d  %10llu  %8d\n", i, (unsigned long long)set_usage[i], users );
+        }
+        unused += ( set_usage[i] == 0 );
+    }
+
+    printf( "%d of %d palette entries unused:", unused, PAL_COLORS );
+    for( i = 0; i < PAL_COLORS; i++ )
+    {
+        if( set_usage[i] == 0 )
+        {
+            printf( " %d", i );
+        }
+    }
+    printf( "\nCounted %d textures in %ums\n", texn, counted );
+
+    Free_Textures();
+
+    return 1;
+}
+
+// plays back an input trace recorded with -R against the textures in the open file, which
+// is not changed. there is no window and no edit thread: each recorded GRA_Check_Quit call's
+// events are turned into edit commands, applied and the frame drawn, all on this thread and
+// as fast as they go. how long each frame took is reported, then a hash of the textures that
+// the same trace gives every time
+int Replay_Trace( char *trace, char *timings )
+{
+    if( Load_Textures() == 0 )
+    {
+        return 0;
+    }
+
+    kernels = KRN_Select( TEX_SIZE );
+
+    // the same start as main, so the recorded input lands on the same textures
+    GRA_Set_Backend( "offscreen" );
+    if( GRA_Create_Display( "TexEdit", SCREEN_WIDTH, SCREEN_HEIGHT, RES_WIDTH, RES_HEIGHT ) == 0 ||
+        GRA_Load_Font( "data/font" ) == 0 || Init_Palette() == 0 || Generate_Texture() == 0 )
+    {
+        Free_Textures();
+        GRA_Close();
+        GRA_Free_Palette();
+        return 0;
+    }
+
+    Get_Current_Texture();
+    Recount_Usage();
+
+    uint64_t context;
+    int ok = Start_Thumbnails() && GRA_Replay_Input( trace, &context );
+    if( ok && context != Hash_Set() )
+    {
+        UTI_Print_Error( "Trace was recorded starting from other textures" );
+        ok = 0;
+    }
+
+    edit_queue = THR_Create_Queue( EDIT_QUEUE_SIZE, sizeof( edit_cmd_type ) );
+    brush = BRS_Create();
+    replaying = 1;
+
+    uint32_t *edit_times = NULL, *draw_times = NULL;
+    int frames = 0, size = 0, running = ok;
+    uint64_t start, edited, drawn, total = GRA_Get_Microseconds();
+
+    while( running )
+    {
+        running = GRA_Check_Quit();
+
+        start = GRA_Get_Microseconds();
+
+        Mouse_Input();
+        Process_Commands();
+
+        edited = GRA_Get_Microseconds();
+
+        GRA_Clear_Screen();
+        Draw_Tools();
+        Draw_Current_Texture();
+        GRA_Submit_Frame();
+        GRA_Present_Frame();
+
+        drawn = GRA_Get_Microseconds();
+
+        if( frames == size )
+        {
+            size = ( size ) ? size * 2 : 1024;
+            edit_times = UTI_EC_Tag_Realloc( UTI_MEM_SCRATCH, edit_times, sizeof( uint32_t ) * size );
+            draw_times = UTI_EC_Tag_Realloc( UTI_MEM_SCRATCH, draw_times, sizeof( uint32_t ) * size );
+        }
+        edit_times[frames] = edited - start;
+        draw_times[frames] = drawn - edited;
+        frames++;
+    }
+
+    total = GRA_Get_Microseconds() - total;
+
+    FILE *file = NULL;
+    if( ok && timings != NULL && ( file = fopen( timings, "w" ) ) == NULL )
+    {
+        UTI_Print_Error( "Unable to create timings file" );
+        ok = 0;
+    }
+
+    if( ok )
+    {
+        // written before the times are sorted for the summary
+        int i;
+        for( i = 0; file != NULL && i < frames; i++ )
+        {
+            fprintf( file, "%d,%u,%u\n", i, edit_times[i], draw_times[i] );
+        }
+
+        printf( "%d frames played back in %.3fms\n", frames, total / 1000.0 );
+        Print_Frame_Times( "edit", edit_times, frames );
+        Print_Frame_Times( "draw", draw_times, frames );
+        printf( "Texture set hash %016llx\n", (unsigned long long)Hash_Set() );
+    }
+
+    if( file != NULL && fclose( file ) != 0 )
+    {
+        UTI_Print_Error( "Unable to write timings file" );
+        ok = 0;
+    }
+
+    UTI_EC_Free( edit_times );
+    UTI_EC_Free( draw_times );
+
+    replaying = 0;
+    THR_Destroy_Queue( edit_queue );
+    THM_Stop();
+    Free_Textures();
+    GRA_Close();
+    SHD_Free( &light_tables );
+    GRA_Free_Palette();
+
+    return ok;
+}
+
+// prints the average, median, 95th percentile and worst of count frame times, which are
+// sorted in the process
+void Print_Frame_Times( char *name, uint32_t *times, int count )
+{
+    if( count == 0 )
+    {
+        return;
+    }
+
+    uint64_t sum = 0;
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        sum += times[i];
+    }
+
+    qsort( times, count, sizeof( uint32_t ), Compare_Times );
+
+    printf( "%s  average %7.3fms  median %7.3fms  95th %7.3fms  worst %7.3fms\n", name,
+            sum / 1000.0 / count, times[count / 2] / 1000.0, times[count * 95 / 100] / 1000.0,
+            times[count - 1] / 1000.0 );
+
+    return;
+}
+
+int Compare_Times( const void *a, const void *b )
+{
+    uint32_t ta = *(const uint32_t *)a, tb = *(const uint32_t *)b;
+
+    return( ta > tb ) - ( ta < tb );
+}
+
+// returns a hash of the texels of every texture and layer and the settings of the layers,
+// worked out afresh rather than trusting the stored hashes
+uint64_t Hash_Set()
+{
+    uint64_t *hashes = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint64_t ) *
+                                          ( texn * ( LYR_MAX_LAYERS * 2 + 2 ) + 1 ) );
+    int i, l, n = 0, texels = TEX_SIZE * TEX_SIZE;
+
+    hashes[n++] = texn;
+    for( i = 0; i < texn; i++ )
+    {
+        hashes[n++] = TXR_Hash_Texels( textures[i], texels );
+        hashes[n++] = ( layers[i] != NULL ) ? layers[i]->count * 0x100 + layers[i]->active : 0;
+
+        for( l = 0; layers[i] != NULL && l < layers[i]->count; l++ )
+        {
+            hashes[n++] = TXR_Hash_Texels( layers[i]->layer[l].texels, texels );
+            hashes[n++] = (uint64_t)layers[i]->layer[l].transparent << 1 | layers[i]->layer[l].visible;
+        }
+    }
+
+    uint64_t hash = TXR_Hash_Texels( (uint32_t *)hashes, n * 2 );
+    UTI_EC_Free( hashes );
+
+    return hash;
+}
+
+// loads the palette given with -P, or generates the one the editor has always used
+int Init_Palette()
+{
+    return( palette_name != NULL ) ? GRA_Load_Palette( palette_name ) : GRA_Generate_Palette();
+}
+
+// opens the live link given with -L, if there is one, with a slot for every texture there can
+// be, and publishes the textures to it
+int Open_Live_Link()
+{
+    if( link_name == NULL )
+    {
+        return 1;
+    }
+
+    if( ( live_link = LNK_Open( link_name, TEX_SIZE, MAX_TEXTURES ) ) == NULL )
+    {
+        return 0;
+    }
+
+    LNK_Publish( live_link, textures, texn );
+
+    return 1;
+}
+
+// start building thumbnails of all textures, new textures are added as they are generated
+int Start_Thumbnails()
+{
+    if( THM_Start( MAX_TEXTURES, TEX_SIZE ) == 0 )
+    {
+        return 0;
+    }
+
+    int i;
+    for( i = 0; i < texn; i++ )
+    {
+        THM_Set_Texture( i, textures[i] );
+    }
+    THM_Set_Visible( strip_first, STRIP_COUNT );
+
+    return 1;
+}
+
+// frees memory taken by textures
+void Free_Textures()
+{
+    int i = 0;
+    while( i < texn )
+    {
+        LYR_Free( layers[i] );
+        layers[i] = NULL;
+        TXR_Release( textures[i] );
+        i++;
+    }
+
+    TXR_Release( blank_texture );
+
+    UTI_EC_Free( stroke_preview );
+    UTI_EC_Free( layered_preview );
+    UTI_EC_Free( clipboard );
+
+    BRS_Free( brush );
+    brush = NULL;
+
+    return;
+}
+
+//============================
+//  GUI
+//============================
+
+// draws the GUI to the screen
+void Draw_Tools()
+{
+
+    uint32_t WHITE = GRA_Match_Color( 255, 255, 255 );
+
+    // Draw Edit Area and Palette Area
+    GRA_Draw_Hollow_Rectangle( TXR_EDIT_X-1, TXR_EDIT_Y-1, TXR_EDIT_W+1, TXR_EDIT_H+2, WHITE );
+    GRA_Draw_Hollow_Rectangle( PAL_AREA_X-1, PAL_AREA_Y-1, PAL_AREA_W+1, PAL_AREA_H+2, WHITE );
+
+    GRA_Simple_Text( "Texture", 32, 16, WHITE, 0, 0 );
+
+    // which layer is being drawn on
+    char layer_text[32];
+    if( layers[texp] != NULL )
+    {
+        snprintf( layer_text, sizeof( layer_text ), "Layer %d/%d%s", layers[texp]->active + 1,
+                  layers[texp]->count, layers[texp]->layer[layers[texp]->active].visible ? "" : " hidden" );
+        GRA_Simple_Text( layer_text, 104, 16, WHITE, 0, 0 );
+    }
+    GRA_Simple_Text( "Palette", 356, 16, WHITE, 0, 0 );
+
+    // Draw Color Selections
+    GRA_Draw_Hollow_Rectangle( SELECTED_COLOR_X-1, SELECTED_COLOR_Y-1,  SELECTED_COLOR_W+1, SELECTED_COLOR_H+2, WHITE );
+    GRA_Draw_Hollow_Rectangle( ERASE_COLOR_X-1, ERASE_COLOR_Y-1,  ERASE_COLOR_W+1, ERASE_COLOR_H+2, WHITE );
+
+    GRA_Draw_Filled_Rectangle( SELECTED_COLOR_X, SELECTED_COLOR_Y, SELECTED_COLOR_W, SELECTED_COLOR_H, GRA_Get_Palette_Color( selected_color ) );
+    GRA_Draw_Filled_Rectangle( ERASE_COLOR_X, ERASE_COLOR_Y, ERASE_COLOR_W, ERASE_COLOR_H, GRA_Get_Palette_Color( erase_color ) );
+
+    GRA_Simple_Text( "Selected Colour", 72, SELECTED_COLOR_Y + 8, WHITE, 0, 0 );
+    GRA_Simple_Text( "Erase Colour",    72, ERASE_COLOR_Y + 8, WHITE, 0, 0 );
+ 
+    // draw texture selection arrows
+    GRA_Draw_Hollow_Rectangle( TXR_SELECT_LEFT_X, TXR_SELECT_LEFT_Y, TXR_SELECT_W, TXR_SELECT_H, WHITE );
+    GRA_Draw_Hollow_Rectangle( TXR_SELECT_RIGHT_X, TXR_SELECT_RIGHT_Y, TXR_SELECT_W, TXR_SELECT_H, WHITE );
+
+    GRA_Simple_Text( "<", TXR_SELECT_LEFT_X + 8, TXR_SELECT_LEFT_Y + 2, WHITE, 0, 0 );
+    GRA_Simple_Text( ">", TXR_SELECT_RIGHT_X + 8, TXR_SELECT_RIGHT_Y + 2, WHITE, 0, 0 );
+
+    // draw tool buttons, the current tool and the solid toggle are highlighted
+    int b, bx, by, on;
+    for( b = 0; b < TOOL_BUTTON_COUNT; b++ )
+    {
+        bx = TOOL_AREA_X + ( b % TOOL_BUTTONS_PER_ROW ) * ( TOOL_BUTTON_W + TOOL_BUTTON_GAP );
+        by = TOOL_AREA_Y + ( b / TOOL_BUTTONS_PER_ROW ) * ( TOOL_BUTTON_H + TOOL_BUTTON_GAP );
+        on = ( b == current_tool ) || ( b == SOLID_BUTTON && solid_shapes );
+
+        if( on )
+        {
+            GRA_Draw_Filled_Rectangle( bx, by, TOOL_BUTTON_W, TOOL_BUTTON_H, WHITE );
+        }
+        GRA_Draw_Hollow_Rectangle( bx, by, TOOL_BUTTON_W, TOOL_BUTTON_H, WHITE );
+        GRA_Simple_Text( tool_names[b], bx + 2, by + 2, ( on ) ? 0 : WHITE, 0, 0 );
+    }
+
+    // what the pencil draws with
+    static const char *shape_names[BRS_SHAPES] = { "Square", "Round", "Stamp" };
+    char brush_text[48];
+    if( brush->shape == BRS_STAMP )
+    {
+        snprintf( brush_text, sizeof( brush_text ), "Brush Stamp %dx%d", brush->stamp_w, brush->stamp_h );
+    }
+    else
+    {
+        snprintf( brush_text, sizeof( brush_text ), "Brush %s %d%s", shape_names[brush->shape],
+                  brush->size, ( brush->pattern != NULL ) ? " pattern" : "" );
+    }
+    if( brush->dither > 0 )
+    {
+        snprintf( brush_text + strlen( brush_text ), sizeof( brush_text ) - strlen( brush_text ),
+                  " dither %d", brush->dither );
+    }
+    by = TOOL_AREA_Y + ( TOOL_BUTTON_COUNT + TOOL_BUTTONS_PER_ROW - 1 ) / TOOL_BUTTONS_PER_ROW *
+         ( TOOL_BUTTON_H + TOOL_BUTTON_GAP );
+    GRA_Simple_Text( brush_text, TOOL_AREA_X, by + 2, WHITE, 0, 0 );
+
+    Draw_Thumbnails();
+
+    // colours the current texture doesn't use are dimmed, and those no texture uses more so
+    int i = 0, j, index, dim;
+    uint8_t red, green, blue;
+    for( i = 0; i < 16; i++ )
+    {
+        for( j = 0; j < 16; j++ )
+        {
+            index = i*16+j;
+            dim = ( set_usage[index] == 0 ) ? 4 : ( usage[texp][index] == 0 ) ? 2 : 1;
+            GRA_Get_Palette_RGB( index, &red, &green, &blue );
+            GRA_Draw_Filled_Rectangle( PAL_AREA_X+i*16, PAL_AREA_Y+j*16, 16, 16,
+                                       ( dim == 1 ) ? GRA_Get_Palette_Color( index ) :
+                                                      GRA_Match_Color( red / dim, green / dim, blue / dim ) );
+        }
+    }
+    return;
+}
+
+// draws the thumbnail strip, the texture being edited is outlined in white
+void Draw_Thumbnails()
+{
+    uint32_t WHITE = GRA_Match_Color( 255, 255, 255 );
+    uint32_t GREY = GRA_Match_Color( 96, 96, 96 );
+
+    GRA_Draw_Hollow_Rectangle( STRIP_X, STRIP_UP_Y, THUMB_SIZE, TXR_SELECT_H, WHITE );
+    GRA_Draw_Hollow_Rectangle( STRIP_X, STRIP_DOWN_Y, THUMB_SIZE, TXR_SELECT_H, WHITE );
+
+    GRA_Simple_Text( "^", STRIP_X + 12, STRIP_UP_Y + 2, WHITE, 0, 0 );
+    GRA_Simple_Text( "v", STRIP_X + 12, STRIP_DOWN_Y + 2, WHITE, 0, 0 );
+
+    int slot, index, y;
+    for( slot = 0; slot < STRIP_COUNT; slot++ )
+    {
+        index = strip_first + slot;
+        if( index >= texn )
+        {
+            break;
+        }
+
+        y = STRIP_Y + slot * ( THUMB_SIZE + STRIP_GAP );
+
+        // thumbnails not built yet are left blank
+        THM_Draw( index, STRIP_X, y );
+        GRA_Draw_Hollow_Rectangle(  STRIP_X-1, y-1, THUMB_SIZE+1, THUMB_SIZE+1,
+                                    ( index == texp ) ? WHITE : GREY );
+    }
+
+    return;
+}
+
+// scrolls the thumbnail strip so it starts at texture first
+void Scroll_Strip( int first )
+{
+    if( first > (int)texn - STRIP_COUNT )   first = texn - STRIP_COUNT;
+    if( first < 0 )                         first = 0;
+
+    if( first != strip_first )
+    {
+        strip_first = first;
+        THM_Set_Visible( strip_first, STRIP_COUNT );
+    }
+
+    return;
+}
+
+//============================
+//  BENCHMARK
+//============================
+
+// times drawing and showing frames with every display backend. a frame is drawn the same way
+// the edit thread draws one, so the draw time is the same whatever the backend and the present
+// time shows what each backend costs
+int Benchmark( int frames )
+{
+    TEX_SIZE = 64;
+    PIXEL_SIZE = TXR_EDIT_W / TEX_SIZE;
+    kernels = KRN_Select( TEX_SIZE );
+
+    if( GRA_Generate_Palette() == 0 || Generate_Texture() == 0 )
+    {
+        return 0;
+    }
+
+    Get_Current_Texture();
+    Unshare_Current_Texture();
+
+    // something other than a blank texture to draw
+    int i;
+    for( i = 0; i < TEX_SIZE * TEX_SIZE; i++ )
+    {
+        current_texture[i] = ( i * 7 + i / TEX_SIZE ) & 0xff;
+    }
+
+    printf( "%d frames of %dx%d in a %dx%d window\n", frames, RES_WIDTH, RES_HEIGHT,
+            SCREEN_WIDTH, SCREEN_HEIGHT );
+
+    char *name;
+    int backend;
+    uint64_t start, drawn, draw_time, present_time;
+    for( backend = 0; ( name = GRA_Get_Backend_Name( backend ) ) != NULL; backend++ )
+    {
+        GRA_Set_Backend( name );
+        if( GRA_Create_Display( "TexEdit", SCREEN_WIDTH, SCREEN_HEIGHT, RES_WIDTH, RES_HEIGHT ) == 0 ||
+            GRA_Load_Font( "data/font" ) == 0 )
+        {
+            printf( "%-10s  unavailable\n", name );
+            GRA_Close();
+            continue;
+        }
+
+        draw_time = present_time = 0;
+        for( i = 0; i < frames && GRA_Check_Quit(); i++ )
+        {
+            start = GRA_Get_Microseconds();
+
+            GRA_Clear_Screen();
+            Draw_Tools();
+            Draw_Current_Texture();
+            GRA_Submit_Frame();
+
+            drawn = GRA_Get_Microseconds();
+
+            GRA_Present_Frame();
+
+            draw_time += drawn - start;
+            present_time += GRA_Get_Microseconds() - drawn;
+        }
+
+        if( i > 0 )
+        {
+            printf( "%-10s  draw %7.3fms  present %7.3fms  per frame\n", name,
+                    draw_time / 1000.0 / i, present_time / 1000.0 / i );
+        }
+
+        GRA_Close();
+    }
+
+    UTI_Memory_Report();
+
+    Free_Textures();
+    GRA_Free_Palette();
+
+    return 1;
+}
+
+// returns the average microseconds taken by rounds calls of one kernel. the texture is
+// flipped or rotated in place, which doesn't matter for the timing
+double Time_Kernel( const krn_table_type *k, int kernel, uint32_t *texels, int size,
+                    uint8_t *dest, int rounds )
+{
+    uint64_t start = GRA_Get_Microseconds();
+
+    int i;
+    for( i = 0; i < rounds; i++ )
+    {
+        switch( kernel )
+        {
+            case 0: KRN_Blit( k, texels, size, TXR_EDIT_W / size, dest );   break;
+            case 1: KRN_Reduce( k, texels, size, 2, dest );                 break;
+            case 2: KRN_Flip_Horizontal( k, texels, size );                 break;
+            default: KRN_Rotate( k, texels, size, 1 );                      break;
+        }
+    }
+
+    return (double)( GRA_Get_Microseconds() - start ) / rounds;
+}
+
+// times the specialized kernels against the generic ones for every size that has them, and
+// checks they give the same results. returns 0 if any of them don't
+int Benchmark_Kernels( int rounds )
+{
+    static char *kernel_names[] = { "blit", "reduce", "flip", "rotate" };
+
+    uint32_t *texels = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH,
+                                          sizeof( uint32_t ) * MAX_TEX_WIDTH * MAX_TEX_HEIGHT );
+    uint32_t *check = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH,
+                                         sizeof( uint32_t ) * MAX_TEX_WIDTH * MAX_TEX_HEIGHT );
+    uint8_t *dest = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, TXR_EDIT_W * TXR_EDIT_H );
+    uint8_t *check_dest = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, TXR_EDIT_W * TXR_EDIT_H );
+
+    printf( "%-6s %-8s %12s %12s %8s\n", "size", "kernel", "generic us", "special us", "speedup" );
+
+    int size, kernel, i, ok = 1, same;
+    const krn_table_type *special;
+    double generic_time, special_time;
+    for( size = 8; size <= MAX_TEX_WIDTH; size *= 2 )
+    {
+        special = KRN_Select( size );
+
+        for( kernel = 0; kernel < 4; kernel++ )
+        {
+            for( i = 0; i < size * size; i++ )
+            {
+                texels[i] = check[i] = ( i * 7 + i / size ) & 0xff;
+            }
+
+            // one round each way must give the same texels
+            memset( dest, 0, TXR_EDIT_W * TXR_EDIT_H );
+            memset( check_dest, 0, TXR_EDIT_W * TXR_EDIT_H );
+            Time_Kernel( KRN_Generic(), kernel, check, size, check_dest, 1 );
+            Time_Kernel( special, kernel, texels, size, dest, 1 );
+
+            same = memcmp( texels, check, sizeof( uint32_t ) * size * size ) == 0 &&
+                   memcmp( dest, check_dest, TXR_EDIT_W * TXR_EDIT_H ) == 0;
+            ok = ok && same;
+
+            generic_time = Time_Kernel( KRN_Generic(), kernel, texels, size, dest, rounds );
+            special_time = Time_Kernel( special, kernel, texels, size, dest, rounds );
+
+            printf( "%-6d %-8s %12.3f %12.3f %7.2fx%s\n", size, kernel_names[kernel], generic_time,
+                    special_time, generic_time / special_time, same ? "" : "  MISMATCH" );
+        }
+    }
+
+    UTI_EC_Free( texels );
+    UTI_EC_Free( check );
+    UTI_EC_Free( dest );
+    UTI_EC_Free( check_dest );
+
+    return ok;
+}
+
+//============================
+//  CONTROL AND INPUT
+//============================
+
+#include <ctype.h>
+
+int itoa( char *str )
+{
+    int len = strlen( str );
+    int i;
+    int n = 0;
+    for( i = 0; i < len; i++ )
+    {
+        if( !isdigit( str[i] ) )
+        {
+            return -1;
+        }
+        
+        n = n * 10 + ( str[i] - '0' );
+    }
+
+    return n;
+}
+
+// handle command line arguments
+int Parse_Args( int argc, char *argv[] )
+{
+    // get command line args
+    ac = argc;
+    av = argv;
+
+    // display and log options go at the end so the commands keep their places
+    while( ac > 2 )
+    {
+        if( ac > 3 && strcmp( av[ac - 2], "-l" ) == 0 )
+        {
+            if( UTI_Log_Find_Level( av[ac - 1] ) == -1 )
+            {
+                return 0;
+            }
+            UTI_Log_Set_Level( UTI_Log_Find_Level( av[ac - 1] ) );
+            ac -= 2;
+        }
+        else if( strcmp( av[ac - 1], "-8" ) == 0 )
+        {
+            GRA_Set_Indexed_Display( 1 );
+            ac--;
+        }
+        else if( ac > 3 && strcmp( av[ac - 2], "-P" ) == 0 )
+        {
+            palette_name = av[ac - 1];
+            ac -= 2;
+        }
+        else if( ac > 3 && strcmp( av[ac - 2], "-R" ) == 0 )
+        {
+            trace_name = av[ac - 1];
+            ac -= 2;
+        }
+        else if( ac > 3 && strcmp( av[ac - 2], "-L" ) == 0 )
+        {
+            link_name = av[ac - 1];
+            ac -= 2;
+        }
+        else if( ac > 3 && strcmp( av[ac - 2], "-d" ) == 0 )
+        {
+            if( GRA_Set_Backend( av[ac - 1] ) == 0 )
+            {
+                return 0;
+            }
+            ac -= 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if( ac < 2 )
+    {
+        printf( "Usage: %s <command> <filename> <size>\n", av[0] );
+        printf( "Where  <command> = -o to open an existing file or -n to open a new file\n" );
+        printf( "       <size>    = texture size in pixels, only needed when opening new files\n" );
+        printf( "       adding -8 at the end draws the screen in 8 bit palette indices\n" );
+        printf( "       adding -d <backend> at the end shows frames with another backend:\n" );
+        printf( "       surface (the default), renderer or offscreen\n" );
+        printf( "       adding -l <level> at the end sets how much is logged: error, warn,\n" );
+        printf( "       info or debug (the default)\n" );
+        printf( "       adding -P <palette> at the end uses a palette file made by -p rather\n" );
+        printf( "       than the generated palette, for every command\n" );
+        printf( "       adding -L <name> at the end publishes the textures to shared memory\n" );
+        printf( "       as they are edited, for a running game to map, see linkView\n" );
+        printf( "       adding -R <trace> at the end records all input to trace for -r\n" );
+        printf( "   or: %s -v <file or directory> ...\n", av[0] );
+        printf( "       checks the checksums of .txr files without opening a window\n" );
+        printf( "   or: %s -b [frames]\n", av[0] );
+        printf( "       times drawing and showing frames with every backend\n" );
+        printf( "   or: %s -g <filename> <size> <count> <pattern> [seed]\n", av[0] );
+        printf( "       makes a new file of count generated textures, the patterns are\n" );
+        printf( "       noise, perlin, bricks, tiles, wood and marble. size is a power of\n" );
+        printf( "       two from 8 to %d, the sizes the editor opens\n", MAX_TEX_WIDTH );
+        printf( "   or: %s -k [rounds]\n", av[0] );
+        printf( "       times the kernels specialized for each texture size\n" );
+        printf( "   or: %s -a <filename> <atlas> [page size] [padding] [mips]\n", av[0] );
+        printf( "       packs the textures into an atlas file for the game, mips = 1 adds\n" );
+        printf( "       mipmaps. pages are 1024 with 2 texels of padding by default\n" );
+        printf( "   or: %s -c <file a> <file b>\n", av[0] );
+        printf( "       lists the textures that differ between two files and where\n" );
+        printf( "   or: %s -m <base> <ours> <theirs> <output>\n", av[0] );
+        printf( "       merges the changes made to base in ours and theirs into output,\n" );
+        printf( "       texels changed differently in both keep ours and are listed.\n" );
+        printf( "       layers are flattened, output has none\n" );
+        printf( "   or: %s -s <tables> [levels]\n", av[0] );
+        printf( "       writes the light level colour maps (32 by default) and the blend\n" );
+        printf( "       table the game shades the palette with\n" );
+        printf( "   or: %s -u <filename>\n", av[0] );
+        printf( "       lists the palette entries the textures use and the ones that are free\n" );
+        printf( "   or: %s -p <filename> <output> <palette> [colors]\n", av[0] );
+        printf( "       fits a palette of up to 256 colours to the textures, saving it and\n" );
+        printf( "       the textures remapped to it\n" );
+        printf( "   or: %s -r <filename> <trace> [timings]\n", av[0] );
+        printf( "       plays back input recorded with -R from filename, without a window,\n" );
+        printf( "       and reports the frame times and a hash of the textures at the end.\n" );
+        printf( "       timings gets the time of every frame. filename is not changed\n" );
+        return 0;
+    }
+
+    if( ( strcmp( av[1], "-o" ) == 0 ) && ac > 2 )
     {
         filename = av[2];
         return 1;
     }
 
-    if( ( strcmp( av[1], "-n" ) == 0 ) && ac > 3 )
+    if( ( strcmp( av[1], "-n" ) == 0 ) && ac > 3 )
+    {
+        filename = av[2];
+        TEX_SIZE = itoa( av[3] );
+        if( TEX_SIZE == -1 )
+        {
+            return 0;
+        }
+        PIXEL_SIZE = TXR_EDIT_W / TEX_SIZE;
+        UTI_Log( UTI_LOG_DEBUG, "TEX_SIZE = %d, PIXEL_SIZE = %g", TEX_SIZE, PIXEL_SIZE );
+        return 2;
+    }
+
+    if( ( strcmp( av[1], "-v" ) == 0 ) && ac > 2 )
+    {
+        return 3;
+    }
+
+    if( strcmp( av[1], "-b" ) == 0 )
+    {
+        return( ac > 2 && itoa( av[2] ) <= 0 ) ? 0 : 4;
+    }
+
+    if( ( strcmp( av[1], "-g" ) == 0 ) && ac > 5 )
+    {
+        filename = av[2];
+        TEX_SIZE = itoa( av[3] );
+
+        // only sizes the editor can open, which also keeps the file under TXR_MAX_SIZE and
+        // the textures made at once to MAX_TEXTURES x 256KB
+        if( TEX_SIZE < 8 || TEX_SIZE > MAX_TEX_WIDTH || ( TEX_SIZE & ( TEX_SIZE - 1 ) ) != 0 ||
+            itoa( av[4] ) <= 0 || itoa( av[4] ) > MAX_TEXTURES ||
+            GEN_Find( av[5] ) == -1 || ( ac > 6 && itoa( av[6] ) == -1 ) )
+        {
+            return 0;
+        }
+        return 5;
+    }
+
+    if( strcmp( av[1], "-k" ) == 0 )
+    {
+        return( ac > 2 && itoa( av[2] ) <= 0 ) ? 0 : 7;
+    }
+
+    if( ( strcmp( av[1], "-c" ) == 0 ) && ac > 3 )
+    {
+        return 8;
+    }
+
+    if( ( strcmp( av[1], "-m" ) == 0 ) && ac > 5 )
+    {
+        return 9;
+    }
+
+    if( ( strcmp( av[1], "-u" ) == 0 ) && ac > 2 )
+    {
+        filename = av[2];
+        return 12;
+    }
+
+    if( ( strcmp( av[1], "-r" ) == 0 ) && ac > 3 )
+    {
+        filename = av[2];
+        return 13;
+    }
+
+    if( ( strcmp( av[1], "-p" ) == 0 ) && ac > 4 )
+    {
+        filename = av[2];
+        return( ac > 5 && ( itoa( av[5] ) <= 0 || itoa( av[5] ) > PAL_COLORS ) ) ? 0 : 11;
+    }
+
+    if( ( strcmp( av[1], "-s" ) == 0 ) && ac > 2 )
+    {
+        return( ac > 3 && ( itoa( av[3] ) <= 0 || itoa( av[3] ) > SHD_MAX_LEVELS ) ) ? 0 : 10;
+    }
+
+    if( ( strcmp( av[1], "-a" ) == 0 ) && ac > 3 )
+    {
+        filename = av[2];
+        if( ( ac > 4 && itoa( av[4] ) <= 0 ) || ( ac > 5 && itoa( av[5] ) == -1 ) ||
+            ( ac > 6 && itoa( av[6] ) == -1 ) )
+        {
+            return 0;
+        }
+        return 6;
+    }
+
+    return 0;
+}
+
+// converts a mouse position in window coordinates to screen resolution coordinates
+void Mouse_To_Screen( int mousex, int mousey, int *m_res_x, int *m_res_y )
+{
+    *m_res_x = floor( mousex / SCREEN_FACTOR_X );
+    *m_res_y = floor( mousey / SCREEN_FACTOR_Y );
+
+    return;
+}
+
+// converts screen coordinates to texel coordinates on the current texture, returns 1 if the
+// point is inside the texture edit area. points outside still give a texel (possibly off the
+// texture) so strokes can be clipped against the texture edge
+int Screen_To_Texel( int m_res_x, int m_res_y, int *tex_x, int *tex_y )
+{
+    *tex_x = floor( ( m_res_x - TXR_EDIT_X ) / PIXEL_SIZE );
+    *tex_y = floor( ( m_res_y - TXR_EDIT_Y ) / PIXEL_SIZE );
+
+    return( ( m_res_x > TXR_EDIT_X ) && ( m_res_x < TXR_EDIT_X + TXR_EDIT_W ) &&
+            ( m_res_y > TXR_EDIT_Y ) && ( m_res_y < TXR_EDIT_Y + TXR_EDIT_H ) );
+}
+
+// reads every mouse event since the last frame and turns it into edit commands, so fast
+// strokes are drawn without gaps no matter how long the edit thread takes over a frame.
+// window thread only
+void Mouse_Input()
+{
+    gra_event_type event;
+    int m_res_x, m_res_y;
+
+    while( GRA_Next_Event( &event ) )
+    {
+        if( event.type == GRA_EVENT_KEY_DOWN )
+        {
+            Key_Press( event.key, event.button );
+            continue;
+        }
+
+        Mouse_To_Screen( event.x, event.y, &m_res_x, &m_res_y );
+
+        switch( event.type )
+        {
+            case GRA_EVENT_WHEEL:
+                Mouse_Wheel( m_res_x, m_res_y, event.wheel );
+                break;
+
+            case GRA_EVENT_BUTTON_DOWN:
+                Mouse_Press( m_res_x, m_res_y, event.button );
+                break;
+
+            case GRA_EVENT_MOTION:
+                Mouse_Drag( m_res_x, m_res_y, event.button );
+                break;
+
+            case GRA_EVENT_BUTTON_UP:
+                // only the button that started a stroke can finish it
+                if( input_stroke_button != 0 && event.button == input_stroke_button )
+                {
+                    Send_Command( CMD_STROKE_END, 0, 0, 0 );
+                    input_stroke_button = 0;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return;
+}
+
+// returns the palette index at screen coordinates, or -1 if outside the palette area
+int Palette_Color_At( int m_res_x, int m_res_y )
+{
+    if( ( m_res_x > PAL_AREA_X ) && ( m_res_x < PAL_AREA_X + PAL_AREA_W ) && 
+        ( m_res_y > PAL_AREA_Y ) && ( m_res_y < PAL_AREA_Y + PAL_AREA_H ) )
+    {
+        int x_offset = ( m_res_x - PAL_AREA_X ) / 16;       // 16 is width of palette 'pixel'
+        int y_offset = ( m_res_y - PAL_AREA_Y ) / 16;
+
+        return( x_offset * 16 + y_offset );
+    }
+
+    return -1;
+}
+
+// returns the tool button at screen coordinates, or -1 if there isn't one
+int Tool_Button_At( int m_res_x, int m_res_y )
+{
+    int b, bx, by;
+    for( b = 0; b < TOOL_BUTTON_COUNT; b++ )
+    {
+        bx = TOOL_AREA_X + ( b % TOOL_BUTTONS_PER_ROW ) * ( TOOL_BUTTON_W + TOOL_BUTTON_GAP );
+        by = TOOL_AREA_Y + ( b / TOOL_BUTTONS_PER_ROW ) * ( TOOL_BUTTON_H + TOOL_BUTTON_GAP );
+
+        if( ( m_res_x > bx ) && ( m_res_x < bx + TOOL_BUTTON_W ) &&
+            ( m_res_y > by ) && ( m_res_y < by + TOOL_BUTTON_H ) )
+        {
+            return b;
+        }
+    }
+
+    return -1;
+}
+
+// returns the thumbnail slot at screen coordinates, or -1 if there isn't one
+int Strip_Slot_At( int m_res_x, int m_res_y )
+{
+    if( ( m_res_x > STRIP_X ) && ( m_res_x < STRIP_X + THUMB_SIZE ) &&
+        ( m_res_y > STRIP_Y ) && ( m_res_y < STRIP_DOWN_Y ) )
+    {
+        return( ( m_res_y - STRIP_Y ) / ( THUMB_SIZE + STRIP_GAP ) );
+    }
+
+    return -1;
+}
+
+// handles the mouse wheel, scrolling the wheel over the strip scrolls it and over the edit
+// area changes the brush size
+void Mouse_Wheel( int m_res_x, int m_res_y, int wheel )
+{
+    int x_offset, y_offset;
+
+    if( Screen_To_Texel( m_res_x, m_res_y, &x_offset, &y_offset ) )
+    {
+        Send_Command( CMD_BRUSH, BRUSH_SIZE, wheel, 0 );
+    }
+
+    if( ( m_res_x > STRIP_X ) && ( m_res_x < STRIP_X + THUMB_SIZE ) &&
+        ( m_res_y > STRIP_UP_Y ) && ( m_res_y < STRIP_DOWN_Y + TXR_SELECT_H ) )
+    {
+        Send_Command( CMD_SCROLL_STRIP, -wheel, 0, 0 );
+    }
+
+    return;
+}
+
+// handles a mouse button being pressed at screen coordinates (m_res_x, m_res_y)
+void Mouse_Press( int m_res_x, int m_res_y, int m_button )
+{
+    if( m_button == 0 || input_stroke_button != 0 )
+    {
+        return;
+    }
+
+    int x_offset, y_offset, color, b;
+
+    // check if mouse is in palette area
+    if( ( color = Palette_Color_At( m_res_x, m_res_y ) ) != -1 )
+    {
+        Send_Command( CMD_PICK_COLOR, color, 0, m_button );
+    }
+
+    // check if mouse is in texture edit area
+    if( Screen_To_Texel( m_res_x, m_res_y, &x_offset, &y_offset ) )
+    {
+        Send_Command( CMD_STROKE_BEGIN, x_offset, y_offset, m_button );
+        input_stroke_button = m_button;
+    }
+
+    // check if mouse is on buttons
+    if( ( m_res_x > TXR_SELECT_LEFT_X ) && ( m_res_x < TXR_SELECT_LEFT_X + TXR_SELECT_W ) &&
+        ( m_res_y > TXR_SELECT_LEFT_Y ) && ( m_res_y < TXR_SELECT_LEFT_Y + TXR_SELECT_H ) )
+    {
+        Send_Command( CMD_PREV_TEXTURE, 0, 0, 0 );
+    }
+
+    if( ( m_res_x > TXR_SELECT_RIGHT_X ) && ( m_res_x < TXR_SELECT_RIGHT_X + TXR_SELECT_W ) &&
+        ( m_res_y > TXR_SELECT_RIGHT_Y ) && ( m_res_y < TXR_SELECT_RIGHT_Y + TXR_SELECT_H ) )
+    {
+        Send_Command( CMD_NEXT_TEXTURE, 0, 0, 0 );
+    }
+
+    if( ( b = Tool_Button_At( m_res_x, m_res_y ) ) != -1 )
+    {
+        Send_Command( CMD_TOOL_BUTTON, b, 0, 0 );
+    }
+
+    // check if mouse is on the thumbnail strip
+    if( ( b = Strip_Slot_At( m_res_x, m_res_y ) ) != -1 )
+    {
+        Send_Command( CMD_SELECT_TEXTURE, b, 0, 0 );
+    }
+
+    if( ( m_res_x > STRIP_X ) && ( m_res_x < STRIP_X + THUMB_SIZE ) &&
+        ( m_res_y > STRIP_UP_Y ) && ( m_res_y < STRIP_UP_Y + TXR_SELECT_H ) )
+    {
+        Send_Command( CMD_SCROLL_STRIP, -1, 0, 0 );
+    }
+
+    if( ( m_res_x > STRIP_X ) && ( m_res_x < STRIP_X + THUMB_SIZE ) &&
+        ( m_res_y > STRIP_DOWN_Y ) && ( m_res_y < STRIP_DOWN_Y + TXR_SELECT_H ) )
+    {
+        Send_Command( CMD_SCROLL_STRIP, 1, 0, 0 );
+    }
+
+    return;
+}
+
+// handles the mouse moving to screen coordinates (m_res_x, m_res_y) with m_button held down
+void Mouse_Drag( int m_res_x, int m_res_y, int m_button )
+{
+    int x_offset, y_offset, color;
+
+    if( input_stroke_button != 0 )
+    {
+        Screen_To_Texel( m_res_x, m_res_y, &x_offset, &y_offset );
+        Send_Command( CMD_STROKE_MOVE, x_offset, y_offset, 0 );
+        return;
+    }
+
+    // dragging over the palette keeps picking colours
+    if( m_button != 0 && ( color = Palette_Color_At( m_res_x, m_res_y ) ) != -1 )
+    {
+        Send_Command( CMD_PICK_COLOR, color, 0, m_button );
+    }
+
+    return;
+}
+
+// handles a key being pressed with the GRA_MOD_ modifier keys in mods. the keys are region,
+// layer and brush operations, see the REGION_, LAYER_ and BRUSH_ lists, the number keys, i for
+// the memory counts and p for the light level preview
+void Key_Press( int key, int mods )
+{
+    int op, all = ( mods & GRA_MOD_SHIFT ) != 0, ctrl = ( mods & GRA_MOD_CTRL ) != 0;
+
+    // i prints how much memory everything is using
+    if( key == 'i' )
+    {
+        UTI_Memory_Report();
+        return;
+    }
+
+    if( key == 'p' )
+    {
+        Send_Command( CMD_LIGHT_PREVIEW, 0, 0, 0 );
+        return;
+    }
+
+    // the number keys fill with the generated patterns
+    if( key >= '1' && key < '1' + GEN_COUNT )
+    {
+        Send_Command( CMD_GENERATE, key - '1', 0, all );
+        return;
+    }
+
+    switch( key )
+    {
+        case 'l':           op = LAYER_ADD;                             break;
+        case 'j':           op = LAYER_DOWN;                            break;
+        case 'k':           op = LAYER_UP;                              break;
+        case 'o':           op = LAYER_SHOW;                            break;
+        case 't':           op = LAYER_TRANSPARENT;                     break;
+        case 'x':           op = LAYER_REMOVE;                          break;
+        case 'f':           op = LAYER_FLATTEN;                         break;
+        default:            op = -1;                                    break;
+    }
+
+    if( op != -1 )
+    {
+        Send_Command( CMD_LAYER, op, 0, 0 );
+        return;
+    }
+
+    switch( key )
+    {
+        case '[':           op = BRUSH_SIZE;    all = -1;               break;
+        case ']':           op = BRUSH_SIZE;    all = 1;                break;
+        case 'b':           op = BRUSH_SHAPE;                           break;
+        case 's':           op = BRUSH_STAMP;                           break;
+        case 'n':           op = BRUSH_PATTERN;                         break;
+        case 'd':           op = BRUSH_DITHER;                          break;
+        default:            op = -1;                                    break;
+    }
+
+    if( op != -1 )
+    {
+        Send_Command( CMD_BRUSH, op, all, 0 );
+        return;
+    }
+
+    switch( key )
+    {
+        case 'c':           op = ( ctrl ) ? REGION_COPY : -1;           break;
+        case 'v':           op = ( ctrl ) ? REGION_PASTE : REGION_FLIP_V;   break;
+        case 'a':           op = REGION_SELECT_ALL;                     break;
+        case 'h':           op = REGION_FLIP_H;                         break;
+        case 'r':           op = REGION_ROTATE_CW;                      break;
+        case 'e':           op = REGION_ROTATE_CCW;                     break;
+        case 'm':           op = REGION_REMAP;                          break;
+        case GRA_KEY_LEFT:  op = REGION_SHIFT_LEFT;                     break;
+        case GRA_KEY_RIGHT: op = REGION_SHIFT_RIGHT;                    break;
+        case GRA_KEY_UP:    op = REGION_SHIFT_UP;                       break;
+        case GRA_KEY_DOWN:  op = REGION_SHIFT_DOWN;                     break;
+        default:            op = -1;                                    break;
+    }
+
+    if( op != -1 )
+    {
+        Send_Command( CMD_REGION, op, ctrl, all );
+    }
+
+    return;
+}
+
+// sends an edit command to the edit thread. if the queue is full the edit thread is far
+// behind, so wait for it rather than lose part of a stroke
+void Send_Command( int type, int x, int y, int button )
+{
+    edit_cmd_type cmd = { type, x, y, button };
+
+    // when playing back there is no edit thread, so make room by applying what is queued
+    while( THR_Queue_Push( edit_queue, &cmd ) == 0 )
+    {
+        if( replaying )
+        {
+            Process_Commands();
+        }
+        else
+        {
+            GRA_Delay( 1 );
+        }
+    }
+
+    return;
+}
+
+// applies all edit commands waiting on the queue, edit thread only
+void Process_Commands()
+{
+    edit_cmd_type cmd;
+    int edited = 0, handled = 0;
+
+    while( THR_Queue_Pop( edit_queue, &cmd ) )
+    {
+        handled = 1;
+
+        // the texture is about to change, so finish off the edits to the old one
+        if( edited && ( cmd.type == CMD_PREV_TEXTURE || cmd.type == CMD_NEXT_TEXTURE ||
+                        cmd.type == CMD_SELECT_TEXTURE ) )
+        {
+            Finish_Edits();
+            edited = 0;
+        }
+
+        // flat textures count every texel drawn, layered ones as they are flattened
+        RAS_Count_Usage( ( layers[texp] == NULL ) ? usage[texp] : NULL );
+
+        switch( cmd.type )
+        {
+            case CMD_PICK_COLOR:
+                if( cmd.button == 1 )
+                {
+                    selected_color = cmd.x;
+                }
+                else if( cmd.button == 2 )
+                {
+                    erase_color = cmd.x;
+                }
+                break;
+
+            // selecting doesn't change the texture
+            case CMD_STROKE_BEGIN:
+                if( current_tool != TOOL_SELECT )
+                {
+                    Unshare_Current_Texture();
+                    edited = 1;
+                }
+                Begin_Stroke( cmd.x, cmd.y, cmd.button );
+                break;
+
+            case CMD_STROKE_MOVE:
+                if( stroke_active )
+                {
+                    Continue_Stroke( cmd.x, cmd.y );
+                    edited |= ( current_tool != TOOL_SELECT );
+                }
+                break;
+
+            case CMD_STROKE_END:
+                if( stroke_active )
+                {
+                    End_Stroke();
+                    edited |= ( current_tool != TOOL_SELECT );
+                }
+                break;
+
+            case CMD_PREV_TEXTURE:
+                Get_Prev_Texture();
+                break;
+
+            case CMD_NEXT_TEXTURE:
+                Get_Next_Texture();
+                break;
+
+            case CMD_TOOL_BUTTON:
+                if( cmd.x == SOLID_BUTTON )
+                {
+                    solid_shapes = !solid_shapes;
+                }
+                else
+                {
+                    current_tool = cmd.x;
+                }
+                break;
+
+            case CMD_SELECT_TEXTURE:
+                if( strip_first + cmd.x < texn && !stroke_active )
+                {
+                    Select_Texture( strip_first + cmd.x );
+                }
+                break;
+
+            case CMD_SCROLL_STRIP:
+                Scroll_Strip( strip_first + cmd.x );
+                break;
+
+            case CMD_REGION:
+                // a stroke is drawn on the texels as they were when it started
+                if( !stroke_active )
+                {
+                    Region_Command( cmd.x, cmd.y, cmd.button );
+                    edited |= ( !cmd.button && cmd.x != REGION_COPY && cmd.x != REGION_SELECT_ALL );
+                }
+                break;
+
+            case CMD_GENERATE:
+                if( !stroke_active )
+                {
+                    Generate_Pattern( cmd.x, cmd.button );
+                    edited |= !cmd.button;
+                }
+                break;
+
+            case CMD_LAYER:
+                if( !stroke_active )
+                {
+                    edited |= Layer_Command( cmd.x );
+                }
+                break;
+
+            case CMD_LIGHT_PREVIEW:
+                if( light_tables.colormap == NULL && SHD_Build( &light_tables, SHD_LEVELS ) == 0 )
+                {
+                    break;
+                }
+                light_preview = !light_preview;
+                break;
+
+            // a stroke keeps the brush it started with
+            case CMD_BRUSH:
+                if( !stroke_active )
+                {
+                    Brush_Command( cmd.x, cmd.y );
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    RAS_Count_Usage( NULL );
+
+    // only flatten, rehash and rebuild the thumbnail once for a whole batch of edits
+    if( edited )
+    {
+        Finish_Edits();
+        unsaved_edits = 1;
+    }
+
+    // batch commands finish their own edits, so anything may have changed. only textures
+    // whose hash moved are written to the link, which is a compare each for the rest
+    if( handled && live_link != NULL )
+    {
+        LNK_Publish( live_link, textures, texn );
+    }
+
+    return;
+}
+
+// edit thread, applies edit commands and draws frames until editing is cleared. the texture
+// and tool state are only ever touched from here once the thread has started
+int Edit_Thread( void *data )
+{
+    uint32_t last_frame = 0, last_autosave = GRA_Get_Ticks();
+
+    while( atomic_load( &editing ) )
+    {
+        Process_Commands();
+
+        // a snapshot that couldn't be written leaves its edits unsaved, to try again next time
+        unsaved_edits |= ASV_Failed();
+
+        if( unsaved_edits && GRA_Get_Ticks() - last_autosave >= AUTOSAVE_TIME )
+        {
+            Autosave();
+            last_autosave = GRA_Get_Ticks();
+        }
+
+        // wait for the window thread to take the last frame, this one is drawn while it is shown
+        if( GRA_Frame_Pending() || GRA_Get_Ticks() - last_frame < FRAME_TIME )
+        {
+            GRA_Delay( 1 );
+            continue;
+        }
+
+        last_frame = GRA_Get_Ticks();
+
+        // clear the screen
+        GRA_Clear_Screen();
+
+        Draw_Tools();
+
+        Draw_Current_Texture();
+
+        GRA_Submit_Frame();
+    }
+
+    // apply anything left in the queue so no edits are lost
+    Process_Commands();
+
+    if( stroke_active )
     {
-        filename = av[2];
-        TEX_SIZE = itoa( av[3] );
-        if( TEX_SIZE == -1 )
-        {
-            return 0;
-        }
-        PIXEL_SIZE = TXR_EDIT_W / TEX_SIZE;
-        printf( "TEX_SIZE = %d, PIXEL_SIZE = %g\n", TEX_SIZE, PIXEL_SIZE );
-        return 2;
+        End_Stroke();
     }
 
     return 0;
 }
 
-// reads mouse for user input, very simple implementation
-void Mouse_Input()
+// hands a snapshot of the textures to the autosave thread, edit thread only. the snapshot
+// shares every texel array, editing carries on straight away and each texture is only copied
+// when it is next drawn on
+void Autosave()
 {
-    
-    int m_button = 0, mousex, mousey, m_res_x, m_res_y;
-    if( ( m_button = GRA_Get_Mouse_State( &mousex, &mousey ) ) != 0 )
+    txr_set_type snapshot;
+
+    TXR_Snapshot( &snapshot, textures, texn, TEX_SIZE );
+    LYR_Add_To_Set( &snapshot, layers, texn );
+
+    if( ASV_Save( &snapshot ) == 0 )
     {
-        m_res_x = floor( mousex / SCREEN_FACTOR_X );
-        m_res_y = floor( mousey / SCREEN_FACTOR_Y );
+        // still writing the last one, try again at the next autosave
+        TXR_Free_Set( &snapshot );
+        return;
+    }
 
-        // check if mouse is in palette area
-        if( ( m_res_x > PAL_AREA_X ) && ( m_res_x < PAL_AREA_X + PAL_AREA_W ) && 
-            ( m_res_y > PAL_AREA_Y ) && ( m_res_y < PAL_AREA_Y + PAL_AREA_H ) )
-        {
-            int x_offset = ( m_res_x - PAL_AREA_X ) / 16;       // 16 is width of palette 'pixel'
-            int y_offset = ( m_res_y - PAL_AREA_Y ) / 16;
-            uint32_t color = ( x_offset * 16 + y_offset );
+    // set again by ASV_Failed if the snapshot can't be written
+    unsaved_edits = 0;
+
+    // a stroke in progress draws without checking for sharing, so it needs its own copy now
+    if( stroke_active )
+    {
+        Unshare_Current_Texture();
+    }
+
+    return;
+}
+
+// starts a stroke with the current tool at texel (x, y), LMB draws with the selected colour
+// and RMB with the erase colour
+void Begin_Stroke( int x, int y, int m_button )
+{
+    stroke_active = 1;
+    stroke_button = m_button;
+    stroke_color = ( m_button == 1 ) ? selected_color : erase_color;
+
+    stroke_x1 = stroke_x2 = x;
+    stroke_y1 = stroke_y2 = y;
+
+    switch( current_tool )
+    {
+        case TOOL_PENCIL:
+            BRS_Dab( brush, current_texture, TEX_SIZE, x, y, stroke_color );
+            Mark_Edited( x + brush->left, y + brush->top, x + brush->right, y + brush->bottom );
+            break;
+
+        case TOOL_FILL:
+            RAS_Flood_Fill( current_texture, TEX_SIZE, TEX_SIZE, x, y, stroke_color );
+            Mark_Edited( 0, 0, TEX_SIZE - 1, TEX_SIZE - 1 );
+            break;
 
-            if( m_button == 1 )
+        case TOOL_SELECT:
+            Set_Selection( x, y, x, y );
+            break;
+
+        default:
+            // shape tools anchor on the first texel clicked and follow the mouse after that
+            if( stroke_preview == NULL )
             {
-                selected_color = color;
+                stroke_preview = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH,
+                                                    sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE );
             }
-            else if( m_button == 2 )
+            if( layers[texp] != NULL && layered_preview == NULL )
             {
-                erase_color = color;
+                layered_preview = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH,
+                                                     sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE );
             }
-        }
+            break;
+    }
 
-        // check if mouse is in texture edit area
-        if( ( m_res_x > TXR_EDIT_X ) && ( m_res_x < TXR_EDIT_X + TXR_EDIT_W ) &&
-            ( m_res_y > TXR_EDIT_Y ) && ( m_res_y < TXR_EDIT_Y + TXR_EDIT_H ) )
-        {
-            int x_offset = ( m_res_x - TXR_EDIT_X ) / PIXEL_SIZE;
-            int y_offset = ( m_res_y - TXR_EDIT_Y ) / PIXEL_SIZE;
-            
-            if( m_button == 1 )
+    return;
+}
+
+// continues the stroke to texel (x, y). the pencil dabs the brush along a line from the last
+// mouse sample so no texels are skipped however far the mouse moved between samples
+void Continue_Stroke( int x, int y )
+{
+    if( current_tool == TOOL_PENCIL )
+    {
+        BRS_Line( brush, current_texture, TEX_SIZE, stroke_x2, stroke_y2, x, y, stroke_color );
+        Mark_Edited( ( ( x < stroke_x2 ) ? x : stroke_x2 ) + brush->left,
+                     ( ( y < stroke_y2 ) ? y : stroke_y2 ) + brush->top,
+                     ( ( x > stroke_x2 ) ? x : stroke_x2 ) + brush->right,
+                     ( ( y > stroke_y2 ) ? y : stroke_y2 ) + brush->bottom );
+    }
+    else if( current_tool == TOOL_SELECT )
+    {
+        Set_Selection( stroke_x1, stroke_y1, x, y );
+    }
+
+    stroke_x2 = x;
+    stroke_y2 = y;
+
+    return;
+}
+
+// returns 1 if the stroke is a shape being dragged out by the line, rect or ellipse tools
+int Stroke_Is_Shape()
+{
+    return( stroke_active && ( current_tool == TOOL_LINE || current_tool == TOOL_RECT ||
+                               current_tool == TOOL_ELLIPSE ) );
+}
+
+// draws the shape being dragged out into the given texel array
+void Draw_Shape( uint32_t *texels )
+{
+    switch( current_tool )
+    {
+        case TOOL_LINE:
+            RAS_Line( texels, TEX_SIZE, TEX_SIZE, stroke_x1, stroke_y1, stroke_x2, stroke_y2, stroke_color );
+            break;
+
+        case TOOL_RECT:
+            RAS_Rectangle(  texels, TEX_SIZE, TEX_SIZE, stroke_x1, stroke_y1, stroke_x2, stroke_y2,
+                            stroke_color, solid_shapes );
+            break;
+
+        case TOOL_ELLIPSE:
+            RAS_Ellipse(    texels, TEX_SIZE, TEX_SIZE, stroke_x1, stroke_y1, stroke_x2, stroke_y2,
+                            stroke_color, solid_shapes );
+            break;
+
+        default:
+            break;
+    }
+
+    return;
+}
+
+// finishes the stroke when its mouse button is released, shapes are drawn at this point
+void End_Stroke()
+{
+    if( Stroke_Is_Shape() )
+    {
+        Draw_Shape( current_texture );
+        Mark_Edited( stroke_x1, stroke_y1, stroke_x2, stroke_y2 );
+    }
+
+    stroke_active = 0;
+
+    return;
+}
+
+// sets the selection to the rectangle with corners (x1, y1) and (x2, y2), clipped to the
+// texture
+void Set_Selection( int x1, int y1, int x2, int y2 )
+{
+    select_x = ( x1 < x2 ) ? x1 : x2;
+    select_y = ( y1 < y2 ) ? y1 : y2;
+    select_w = abs( x2 - x1 ) + 1;
+    select_h = abs( y2 - y1 ) + 1;
+
+    if( RGN_Clip( TEX_SIZE, &select_x, &select_y, &select_w, &select_h ) == 0 )
+    {
+        select_w = select_h = 0;
+    }
+
+    return;
+}
+
+// applies a region operation to the selection, or the whole texture if nothing is selected.
+// with all set the same operation is applied to every texture, spread over all the cores.
+// edit thread only
+void Region_Command( int op, int half, int all )
+{
+    region_op_type region = { op, 0, 0, TEX_SIZE, TEX_SIZE, half };
+
+    if( select_w > 0 )
+    {
+        region.x = select_x;
+        region.y = select_y;
+        region.w = select_w;
+        region.h = select_h;
+    }
+
+    int i;
+    switch( op )
+    {
+        case REGION_SELECT_ALL:
+            select_w = select_h = 0;
+            return;
+
+        case REGION_COPY:
+            clipboard = UTI_EC_Tag_Realloc( UTI_MEM_TEXTURE,
+                                            clipboard, sizeof( uint32_t ) * region.w * region.h );
+            clip_w = region.w;
+            clip_h = region.h;
+            RGN_Copy( current_texture, TEX_SIZE, region.x, region.y, region.w, region.h, clipboard );
+            return;
+
+        case REGION_PASTE:
+            if( clipboard == NULL )
+            {
+                UTI_Print_Error( "Nothing to paste" );
+                return;
+            }
+            break;
+
+        case REGION_ROTATE_CW:
+        case REGION_ROTATE_CCW:
+            if( region.w != region.h )
             {
-                current_texture[y_offset * TEX_SIZE + x_offset] = selected_color;
+                UTI_Print_Error( "Only a square selection can be rotated" );
+                return;
             }
-            else if( m_button == 2 )
+            break;
+
+        case REGION_REMAP:
+            for( i = 0; i < RGN_MAP_SIZE; i++ )
             {
-                current_texture[y_offset * TEX_SIZE + x_offset] = erase_color;
+                region.map[i] = i;
             }
+            region.map[selected_color] = erase_color;
+            region.map[erase_color] = selected_color;
+            break;
+
+        default:
+            break;
+    }
+
+    // pastes and remaps are the only operations that change which colours are used
+    int changed_w = ( op == REGION_PASTE ) ? clip_w : region.w;
+    int changed_h = ( op == REGION_PASTE ) ? clip_h : region.h;
+    int recount = ( op == REGION_PASTE || op == REGION_REMAP );
+
+    if( !all )
+    {
+        Unshare_Current_Texture();
+
+        if( recount && layers[texp] == NULL )
+        {
+            PAL_Count_Region( current_texture, TEX_SIZE, region.x, region.y, changed_w, changed_h,
+                              usage[texp], -1 );
         }
 
-        // check if mouse is on buttons
+        Transform_Texels( current_texture, &region );
 
-        
-        if( mouse_locked )
+        if( recount && layers[texp] == NULL )
         {
-            return;
+            PAL_Count_Region( current_texture, TEX_SIZE, region.x, region.y, changed_w, changed_h,
+                              usage[texp], 1 );
         }
 
-        if( ( m_res_x > TXR_SELECT_LEFT_X ) && ( m_res_x < TXR_SELECT_LEFT_X + TXR_SELECT_W ) &&
-            ( m_res_y > TXR_SELECT_LEFT_Y ) && ( m_res_y < TXR_SELECT_LEFT_Y + TXR_SELECT_H ) )
+        Mark_Edited( region.x, region.y, region.x + changed_w - 1, region.y + changed_h - 1 );
+        return;
+    }
+
+    // textures sharing an array only need it transforming once
+    region.bodies = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t * ) * texn );
+    int count = Unshare_Bodies( region.bodies );
+
+    uint64_t start = GRA_Get_Microseconds();
+    THR_Parallel_For( count, Transform_Texture, &region );
+
+    // layered textures have the operation applied to their active layer instead, and are
+    // flattened again into texel arrays of their own
+    for( i = 0; i < texn; i++ )
+    {
+        if( layers[i] != NULL )
         {
-            Get_Prev_Texture();
+            Unshare_Texture( i );
+            Transform_Texels( LYR_Unshare( layers[i], layers[i]->active ), &region );
+            LYR_Update_Hashes( layers[i] );
+            LYR_Mark_All( layers[i] );
+            LYR_Composite( layers[i], textures[i], usage[i] );
+            TXR_Update_Hash( textures[i] );
         }
+    }
+    Get_Current_Texture();
+
+    if( recount )
+    {
+        Recount_Usage();
+    }
+
+    UTI_Log( UTI_LOG_DEBUG, "Transformed %d textures (%d distinct) in %.3fms", texn, count,
+             ( GRA_Get_Microseconds() - start ) / 1000.0 );
+
+    for( i = 0; i < texn; i++ )
+    {
+        THM_Texture_Changed( i );
+    }
+
+    UTI_EC_Free( region.bodies );
+    unsaved_edits = 1;
+
+    return;
+}
+
+// fills the current texture or every texture with a pattern, edit thread only. every texture
+// is completely replaced, so a batch makes new texel arrays rather than unsharing the old ones
+void Generate_Pattern( int type, int all )
+{
+    uint32_t seed = generate_seed++;
 
-        if( ( m_res_x > TXR_SELECT_RIGHT_X ) && ( m_res_x < TXR_SELECT_RIGHT_X + TXR_SELECT_W ) &&
-            ( m_res_y > TXR_SELECT_RIGHT_Y ) && ( m_res_y < TXR_SELECT_RIGHT_Y + TXR_SELECT_H ) )
+    if( !all )
+    {
+        Unshare_Current_Texture();
+        GEN_Texture( current_texture, TEX_SIZE, type, seed );
+        Mark_Edited( 0, 0, TEX_SIZE - 1, TEX_SIZE - 1 );
+
+        if( layers[texp] == NULL )
         {
-            Get_Next_Texture();
+            Count_Texture( texp, NULL );
         }
+        return;
+    }
+
+    uint32_t **fresh = UTI_EC_Tag_Malloc( UTI_MEM_SCRATCH, sizeof( uint32_t * ) * texn ), *old;
+
+    int i;
+    for( i = 0; i < texn; i++ )
+    {
+        fresh[i] = TXR_Create( TEX_SIZE );
+    }
+
+    uint64_t start = GRA_Get_Microseconds();
+    GEN_Textures( fresh, texn, TEX_SIZE, type, seed );
+
+    UTI_Log( UTI_LOG_DEBUG, "Generated %d '%s' textures in %.3fms", texn, GEN_Get_Name( type ),
+             ( GRA_Get_Microseconds() - start ) / 1000.0 );
+
+    for( i = 0; i < texn; i++ )
+    {
+        TXR_Update_Hash( fresh[i] );
+
+        old = textures[i];
+        textures[i] = fresh[i];
+        THM_Set_Texture( i, textures[i] );
+        TXR_Release( old );
+
+        // the pattern covers every layer
+        LYR_Free( layers[i] );
+        layers[i] = NULL;
+    }
+
+    Get_Current_Texture();
+    Recount_Usage();
+
+    UTI_EC_Free( fresh );
+    unsaved_edits = 1;
+
+    return;
+}
+
+// applies a layer operation to the current texture, edit thread only. returns 1 if its
+// flattened texels changed and need working out again
+int Layer_Command( int op )
+{
+    lyr_stack_type *stack = layers[texp];
+    int changed;
+
+    if( stack == NULL && op != LAYER_ADD )
+    {
+        UTI_Print_Error( "Texture has no layers" );
+        return 0;
+    }
+
+    switch( op )
+    {
+        // the texture so far becomes the bottom layer
+        case LAYER_ADD:
+            if( stack == NULL )
+            {
+                stack = layers[texp] = LYR_Create( textures[texp] );
+            }
+            if( LYR_Add( stack, erase_color ) == 0 )
+            {
+                return 0;
+            }
+            unsaved_edits = 1;
+            break;
+
+        case LAYER_DOWN:
+            stack->active -= ( stack->active > 0 );
+            break;
 
+        case LAYER_UP:
+            stack->active += ( stack->active < stack->count - 1 );
+            break;
 
-        mouse_locked = 1;
-        mouse_timer = 5;
+        case LAYER_SHOW:
+            Unshare_Current_Texture();
+            stack->layer[stack->active].visible = !stack->layer[stack->active].visible;
+            LYR_Mark_All( stack );
+            return 1;
+
+        case LAYER_TRANSPARENT:
+            Unshare_Current_Texture();
+            stack->layer[stack->active].transparent = erase_color;
+            LYR_Mark_All( stack );
+            return 1;
+
+        case LAYER_REMOVE:
+            Unshare_Current_Texture();
+            if( LYR_Remove( stack ) == 0 )
+            {
+                return 0;
+            }
+            Get_Current_Texture();
+            return 1;
+
+        // the texture's texels are the layers flattened, apart from tiles edited earlier in
+        // this batch, which are only flattened when it finishes
+        case LAYER_FLATTEN:
+            changed = ( LYR_Composite( stack, textures[texp], usage[texp] ) > 0 );
+            LYR_Free( stack );
+            layers[texp] = NULL;
+            unsaved_edits = 1;
+            Get_Current_Texture();
+            return changed;
 
+        default:
+            break;
     }
 
+    Get_Current_Texture();
+
+    return 0;
+}
+
+// applies a brush operation, edit thread only. steps is how many sizes BRUSH_SIZE grows the
+// brush by, or shrinks it by if negative
+void Brush_Command( int op, int steps )
+{
+    int shape;
+
+    switch( op )
+    {
+        case BRUSH_SIZE:
+            BRS_Set_Shape( brush, brush->shape, brush->size + steps );
+            break;
+
+        // stamps are only in the cycle once one has been taken
+        case BRUSH_SHAPE:
+            shape = ( brush->shape + 1 ) % BRS_SHAPES;
+            shape = ( shape == BRS_STAMP && brush->stamp == NULL ) ? BRS_SQUARE : shape;
+            BRS_Set_Shape( brush, shape, brush->size );
+            break;
+
+        case BRUSH_STAMP:
+            if( select_w > 0 )
+            {
+                BRS_Take_Stamp( brush, current_texture, TEX_SIZE, select_x, select_y, select_w,
+                                select_h, erase_color );
+            }
+            else
+            {
+                BRS_Take_Stamp( brush, current_texture, TEX_SIZE, 0, 0, TEX_SIZE, TEX_SIZE, erase_color );
+            }
+            break;
+
+        case BRUSH_PATTERN:
+            if( brush->pattern != NULL )
+            {
+                BRS_Set_Pattern( brush, NULL, 0, 0 );
+            }
+            else if( clipboard == NULL )
+            {
+                UTI_Print_Error( "Copy a region to draw it as a pattern" );
+            }
+            else
+            {
+                BRS_Set_Pattern( brush, clipboard, clip_w, clip_h );
+            }
+            break;
+
+        case BRUSH_DITHER:
+            BRS_Set_Dither( brush, ( brush->dither + 1 ) % BRS_DITHER_LEVELS );
+            break;
+
+        default:
+            break;
+    }
 
     return;
 }
+
+// applies a region operation to one texel array, it must not be shared
+int Transform_Texels( uint32_t *texels, region_op_type *op )
+{
+    int step_x = ( op->half ) ? op->w / 2 : 1;
+    int step_y = ( op->half ) ? op->h / 2 : 1;
+
+    // whole textures have kernels specialized for their size
+    if( op->x == 0 && op->y == 0 && op->w == TEX_SIZE && op->h == TEX_SIZE )
+    {
+        switch( op->op )
+        {
+            case REGION_FLIP_H:
+                KRN_Flip_Horizontal( kernels, texels, TEX_SIZE );
+                return 1;
+
+            case REGION_ROTATE_CW:
+                KRN_Rotate( kernels, texels, TEX_SIZE, 1 );
+                return 1;
+
+            case REGION_ROTATE_CCW:
+                KRN_Rotate( kernels, texels, TEX_SIZE, -1 );
+                return 1;
+
+            default:
+                break;
+        }
+    }
+
+    switch( op->op )
+    {
+        case REGION_PASTE:
+            RGN_Paste( texels, TEX_SIZE, op->x, op->y, clipboard, clip_w, clip_h );
+            break;
+
+        case REGION_FLIP_H:
+            RGN_Flip_Horizontal( texels, TEX_SIZE, op->x, op->y, op->w, op->h );
+            break;
+
+        case REGION_FLIP_V:
+            RGN_Flip_Vertical( texels, TEX_SIZE, op->x, op->y, op->w, op->h );
+            break;
+
+        case REGION_ROTATE_CW:
+            return RGN_Rotate( texels, TEX_SIZE, op->x, op->y, op->w, 1 );
+
+        case REGION_ROTATE_CCW:
+            return RGN_Rotate( texels, TEX_SIZE, op->x, op->y, op->w, -1 );
+
+        case REGION_SHIFT_LEFT:
+            RGN_Wrap_Shift( texels, TEX_SIZE, op->x, op->y, op->w, op->h, -step_x, 0 );
+            break;
+
+        case REGION_SHIFT_RIGHT:
+            RGN_Wrap_Shift( texels, TEX_SIZE, op->x, op->y, op->w, op->h, step_x, 0 );
+            break;
+
+        case REGION_SHIFT_UP:
+            RGN_Wrap_Shift( texels, TEX_SIZE, op->x, op->y, op->w, op->h, 0, -step_y );
+            break;
+
+        case REGION_SHIFT_DOWN:
+            RGN_Wrap_Shift( texels, TEX_SIZE, op->x, op->y, op->w, op->h, 0, step_y );
+            break;
+
+        case REGION_REMAP:
+            RGN_Remap( texels, TEX_SIZE, op->x, op->y, op->w, op->h, op->map );
+            break;
+
+        default:
+            break;
+    }
+
+    return 1;
+}
+
+// applies a region operation to one texel array of a batch, on one of the batch threads
+int Transform_Texture( int index, void *data )
+{
+    region_op_type *op = data;
+
+    int ok = Transform_Texels( op->bodies[index], op );
+    TXR_Update_Hash( op->bodies[index] );
+
+    return ok;
+}
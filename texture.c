@@ -0,0 +1,1059 @@
+/*
+    texture.c
+    texture storage and .txr files
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "utility.h"
+#include "texture.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// header kept in front of every texel array. it is 16 bytes so the texels stay 16 byte
+// aligned for vector loads
+struct txr_body_s               {
+                                    atomic_int  refs;
+                                    int         tex_size;
+                                    uint64_t    hash;
+
+                                    uint32_t    texels[];
+                                };
+typedef struct txr_body_s txr_body_type;
+
+// hash constants, taken from xxhash
+#define PRIME32_1               0x9E3779B1u
+#define PRIME32_2               0x85EBCA77u
+#define PRIME64_1               0x9E3779B185EBCA87ull
+#define PRIME64_2               0xC2B2AE3D27D4EB4Full
+
+#define HASH_LANES              8
+
+// number of uint32_t values in the file header, after the 4 byte file type
+#define HEADER_SIZE             4
+
+// number of uint32_t values describing each layer in a file
+#define LAYER_SIZE              4
+
+// most buffers one writev call accepts, limits.h only defines it for X/Open
+#ifndef IOV_MAX
+#   define IOV_MAX              1024
+#endif
+
+// everything in a .txr file apart from the texels
+struct txr_layout_s             {
+                                    int         version;
+                                    int         tex_size;
+                                    int         count;
+                                    int         bodies;
+
+                                    uint32_t    *index;     // body used by each texture
+                                    uint32_t    *crc;       // checksum of each body, NULL if
+                                                            // the file is too old to have them
+                                    uint32_t    layer_count;
+                                    uint32_t    *layers;    // LAYER_SIZE values per layer
+                                };
+typedef struct txr_layout_s txr_layout_type;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns the header of a texel array
+static txr_body_type *Body( uint32_t *texels )
+{
+    return (txr_body_type *)( (uint8_t *)texels - offsetof( txr_body_type, texels ) );
+}
+
+
+// returns the number of bytes in a tex_size x tex_size texture
+static size_t Texture_Bytes( int tex_size )
+{
+    return sizeof( uint32_t ) * tex_size * tex_size;
+}
+
+
+// spreads the bits of a 64 bit value, used to finish off hashes
+static uint64_t Mix64( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= PRIME64_1;
+    h ^= h >> 29;
+    h *= PRIME64_2;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+// returns the checksum covering the file type, header, index and body checksums
+static uint32_t Header_CRC( uint32_t *header, txr_layout_type *layout )
+{
+    uint32_t crc = UTI_CRC32C( 0, "TXR2", 4 );
+
+    crc = UTI_CRC32C( crc, header, sizeof( uint32_t ) * HEADER_SIZE );
+    crc = UTI_CRC32C( crc, layout->index, sizeof( uint32_t ) * layout->count );
+
+    if( layout->version >= 4 )
+    {
+        crc = UTI_CRC32C( crc, &layout->layer_count, sizeof( uint32_t ) );
+        crc = UTI_CRC32C( crc, layout->layers, sizeof( uint32_t ) * LAYER_SIZE * layout->layer_count );
+    }
+
+    crc = UTI_CRC32C( crc, layout->crc, sizeof( uint32_t ) * layout->bodies );
+
+    return crc;
+}
+
+
+// returns 1 if a file of version with the header values given could fit in file_size bytes.
+// the layer table is left out until layer_count has been read. everything is worked out in 64
+// bits, so no header value can make it wrap
+static int Layout_Fits( uint64_t file_size, uint32_t version, uint32_t tex_size, uint32_t count,
+                        uint32_t bodies, uint64_t layer_count )
+{
+    uint64_t bytes = 4 + sizeof( uint32_t ) * HEADER_SIZE;
+
+    if( version == 1 )
+    {
+        bytes = 4 + sizeof( uint32_t ) * 2;
+    }
+    else
+    {
+        bytes += sizeof( uint32_t ) * (uint64_t)count;
+    }
+
+    if( version >= 4 )
+    {
+        bytes += sizeof( uint32_t ) * ( 1 + LAYER_SIZE * layer_count );
+    }
+
+    if( version >= 3 )
+    {
+        bytes += sizeof( uint32_t ) * ( (uint64_t)bodies + 1 );
+    }
+
+    bytes += Texture_Bytes( tex_size ) * (uint64_t)bodies;
+
+    return( bytes <= file_size );
+}
+
+
+// reads the header, index and checksums of a .txr file, leaving the file at the first texture.
+// older files are given an index of one body per texture and no checksums. nothing is
+// allocated for the header's counts until they are known to fit in the file. on failure
+// problem is set to what was wrong with the file
+static int Read_Layout( FILE *file, txr_layout_type *layout, const char **problem )
+{
+    uint32_t header[HEADER_SIZE];
+    char file_check[4];
+    struct stat info;
+    int i;
+
+    memset( layout, 0, sizeof( txr_layout_type ) );
+
+    if( fstat( fileno( file ), &info ) != 0 )
+    {
+        *problem = "unable to open file";
+        return 0;
+    }
+
+    if( fread( file_check, 4, 1, file ) != 1 )
+    {
+        *problem = "invalid file type";
+        return 0;
+    }
+
+    if( memcmp( file_check, "TXTR", 4 ) == 0 )
+    {
+        // "TXTR" tex_size count, then every texture in full
+        if( fread( &header[1], sizeof( uint32_t ), 2, file ) != 2 )
+        {
+            *problem = "file header is incomplete";
+            return 0;
+        }
+        header[0] = 1;
+        header[3] = header[2];
+    }
+    else if( memcmp( file_check, "TXR2", 4 ) == 0 )
+    {
+        if( fread( header, sizeof( uint32_t ), HEADER_SIZE, file ) != HEADER_SIZE )
+        {
+            *problem = "file header is incomplete";
+            return 0;
+        }
+    }
+    else
+    {
+        *problem = "invalid file type";
+        return 0;
+    }
+
+    if( header[0] > TXR_VERSION )
+    {
+        *problem = "file was made by a newer version";
+        return 0;
+    }
+
+    // bodies are checked against the count once the layers are known, each of which can have
+    // its own
+    if( header[1] == 0 || header[1] > TXR_MAX_SIZE || header[2] >= INT_MAX || header[3] >= INT_MAX ||
+        !Layout_Fits( info.st_size, header[0], header[1], header[2], header[3], 0 ) )
+    {
+        *problem = "file header is corrupt";
+        return 0;
+    }
+
+    layout->version = header[0];
+    layout->tex_size = header[1];
+    layout->count = header[2];
+    layout->bodies = header[3];
+
+    layout->index = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( layout->count + 1 ) );
+
+    if( layout->version == 1 )
+    {
+        for( i = 0; i < layout->count; i++ )
+        {
+            layout->index[i] = i;
+        }
+
+        return 1;
+    }
+
+    if( fread( layout->index, sizeof( uint32_t ), layout->count, file ) != layout->count )
+    {
+        *problem = "file is truncated";
+        return 0;
+    }
+
+    if( layout->version >= 4 )
+    {
+        if( fread( &layout->layer_count, sizeof( uint32_t ), 1, file ) != 1 )
+        {
+            *problem = "file is truncated";
+            return 0;
+        }
+
+        if( layout->layer_count > (uint64_t)layout->count * TXR_MAX_LAYERS ||
+            !Layout_Fits( info.st_size, header[0], header[1], header[2], header[3], layout->layer_count ) )
+        {
+            *problem = "file header is corrupt";
+            return 0;
+        }
+
+        size_t values = LAYER_SIZE * layout->layer_count;
+        layout->layers = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( values + 1 ) );
+
+        if( fread( layout->layers, sizeof( uint32_t ), values, file ) != values )
+        {
+            *problem = "file is truncated";
+            return 0;
+        }
+    }
+
+    // every texture and every layer can have a body of its own, but no more than that
+    if( layout->bodies > layout->count + (int64_t)layout->layer_count )
+    {
+        *problem = "file header is corrupt";
+        return 0;
+    }
+
+    if( layout->version >= 3 )
+    {
+        // checksums of the bodies, then one covering everything before it
+        uint32_t header_crc;
+        layout->crc = UTI_EC_Tag_Malloc( UTI_MEM_FILE,
+                                         sizeof( uint32_t ) * ( layout->bodies + 1 ) );
+
+        if( fread( layout->crc, sizeof( uint32_t ), layout->bodies, file ) != layout->bodies ||
+            fread( &header_crc, sizeof( uint32_t ), 1, file ) != 1 )
+        {
+            *problem = "file is truncated";
+            return 0;
+        }
+
+        if( Header_CRC( header, layout ) != header_crc )
+        {
+            *problem = "file header failed its checksum";
+            return 0;
+        }
+    }
+
+    for( i = 0; i < layout->count; i++ )
+    {
+        if( layout->index[i] >= layout->bodies )
+        {
+            *problem = "file index is corrupt";
+            return 0;
+        }
+    }
+
+    // layers come texture by texture, and each texture has a few at most
+    uint32_t *layer, run = 0;
+    for( i = 0; i < layout->layer_count; i++ )
+    {
+        layer = &layout->layers[i * LAYER_SIZE];
+        run = ( i > 0 && layer[0] == layer[-LAYER_SIZE] ) ? run + 1 : 1;
+
+        if( layer[0] >= layout->count || layer[1] >= layout->bodies ||
+            ( i > 0 && layer[0] < layer[-LAYER_SIZE] ) || run > TXR_MAX_LAYERS )
+        {
+            *problem = "file layers are corrupt";
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// frees the index and checksums read by Read_Layout
+static void Free_Layout( txr_layout_type *layout )
+{
+    UTI_EC_Free( layout->index );
+    UTI_EC_Free( layout->crc );
+    UTI_EC_Free( layout->layers );
+    layout->index = NULL;
+    layout->crc = NULL;
+    layout->layers = NULL;
+
+    return;
+}
+
+
+// reads the next body of a file into texels and checks it against its checksum if the file
+// has them. on failure problem is set to what was wrong
+static int Read_Body( FILE *file, txr_layout_type *layout, int body, uint32_t *texels,
+                      const char **problem )
+{
+    size_t bytes = Texture_Bytes( layout->tex_size );
+
+    if( fread( texels, bytes, 1, file ) != 1 )
+    {
+        *problem = "file is truncated";
+        return 0;
+    }
+
+    // checked straight after the read while the texels are still in cache
+    if( layout->crc != NULL && UTI_CRC32C( 0, texels, bytes ) != layout->crc[body] )
+    {
+        *problem = "texture failed its checksum";
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// writes all of iov to fd, carrying on after partial writes. writev takes at most IOV_MAX
+// buffers, so very large sets take more than one call
+static int Write_Vector( int fd, struct iovec *iov, int count )
+{
+    ssize_t written;
+    int batch;
+
+    while( count > 0 )
+    {
+        batch = ( count < IOV_MAX ) ? count : IOV_MAX;
+
+        written = writev( fd, iov, batch );
+        if( written < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            return 0;
+        }
+
+        // skip the buffers that were written in full, then trim the one cut short
+        while( count > 0 && written >= (ssize_t)iov->iov_len )
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if( count > 0 )
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 1;
+}
+
+
+// writes iov to "filename.tmp", syncs it to disk and renames it over filename. the old file is
+// only replaced once the new one is complete. iov is modified
+static int Write_File_Safely( char *filename, struct iovec *iov, int count )
+{
+    char *temp_name = UTI_EC_Tag_Malloc( UTI_MEM_FILE, strlen( filename ) + 5 );
+    sprintf( temp_name, "%s.tmp", filename );
+
+    // keep the permissions of the file being replaced
+    struct stat info;
+    mode_t mode = 0644;
+    if( stat( filename, &info ) == 0 )
+    {
+        mode = info.st_mode & 0777;
+    }
+
+    int fd = open( temp_name, O_WRONLY | O_CREAT | O_TRUNC, mode );
+    if( fd < 0 )
+    {
+        UTI_Print_Error( "Unable to create file" );
+        UTI_EC_Free( temp_name );
+        return 0;
+    }
+
+    int ok = Write_Vector( fd, iov, count );
+    ok = ok && ( fsync( fd ) == 0 );
+    ok = ( close( fd ) == 0 ) && ok;
+    ok = ok && ( rename( temp_name, filename ) == 0 );
+
+    if( !ok )
+    {
+        UTI_Print_Error( "Unable to write file" );
+        unlink( temp_name );
+        UTI_EC_Free( temp_name );
+        return 0;
+    }
+
+    UTI_EC_Free( temp_name );
+
+    // sync the directory too so the rename itself survives a crash
+    char *dir_name = UTI_EC_Tag_Malloc( UTI_MEM_FILE, strlen( filename ) + 1 );
+    strcpy( dir_name, filename );
+    char *slash = strrchr( dir_name, '/' );
+    if( slash == NULL )
+    {
+        strcpy( dir_name, "." );
+    }
+    else
+    {
+        slash[( slash == dir_name ) ? 1 : 0] = '\0';
+    }
+
+    if( ( fd = open( dir_name, O_RDONLY ) ) >= 0 )
+    {
+        fsync( fd );
+        close( fd );
+    }
+
+    UTI_EC_Free( dir_name );
+
+    return 1;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+//=======================
+//  TEXTURES
+//=======================
+
+// creates a blank (all 0) texture with one reference
+uint32_t *TXR_Create( int tex_size )
+{
+    txr_body_type *body = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE,
+                                             sizeof( txr_body_type ) + Texture_Bytes( tex_size ) );
+
+    atomic_init( &body->refs, 1 );
+    body->tex_size = tex_size;
+    memset( body->texels, 0, Texture_Bytes( tex_size ) );       // 0 is black on the palette
+    body->hash = TXR_Hash_Texels( body->texels, tex_size * tex_size );
+
+    return body->texels;
+}
+
+
+// creates a new texture with one reference holding a copy of texels
+uint32_t *TXR_Copy( uint32_t *texels )
+{
+    txr_body_type *src = Body( texels );
+    txr_body_type *body = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE,
+                                             sizeof( txr_body_type ) + Texture_Bytes( src->tex_size ) );
+
+    atomic_init( &body->refs, 1 );
+    body->tex_size = src->tex_size;
+    body->hash = src->hash;
+    memcpy( body->texels, src->texels, Texture_Bytes( src->tex_size ) );
+
+    return body->texels;
+}
+
+
+// adds a reference to a texture, returns texels
+uint32_t *TXR_Retain( uint32_t *texels )
+{
+    atomic_fetch_add_explicit( &Body( texels )->refs, 1, memory_order_relaxed );
+
+    return texels;
+}
+
+
+// drops a reference to a texture, freeing it when there are none left
+void TXR_Release( uint32_t *texels )
+{
+    if( texels == NULL )
+    {
+        return;
+    }
+
+    txr_body_type *body = Body( texels );
+
+    // acq_rel so every write made through other references is finished before the free
+    if( atomic_fetch_sub_explicit( &body->refs, 1, memory_order_acq_rel ) == 1 )
+    {
+        UTI_EC_Free( body );
+    }
+
+    return;
+}
+
+
+// returns 1 if more than one reference is held to the texture
+int TXR_Shared( uint32_t *texels )
+{
+    return( atomic_load_explicit( &Body( texels )->refs, memory_order_acquire ) > 1 );
+}
+
+
+// returns the width (and height) of a texture
+int TXR_Size( uint32_t *texels )
+{
+    return Body( texels )->tex_size;
+}
+
+
+//=======================
+//  HASHING
+//=======================
+
+// returns a 64 bit hash of count texels. each lane runs an xxhash32 style round over every
+// HASH_LANES'th texel, the lanes don't depend on each other so the inner loop becomes a
+// couple of vector multiplies per block
+uint64_t TXR_Hash_Texels( const uint32_t *texels, int count )
+{
+    uint32_t lane[HASH_LANES];
+    uint32_t v;
+    int i, l;
+
+    for( l = 0; l < HASH_LANES; l++ )
+    {
+        lane[l] = PRIME32_1 + l * PRIME32_2;
+    }
+
+    int blocks = count - ( count % HASH_LANES );
+    for( i = 0; i < blocks; i += HASH_LANES )
+    {
+        for( l = 0; l < HASH_LANES; l++ )
+        {
+            v = lane[l] + texels[i + l] * PRIME32_2;
+            v = ( v << 13 ) | ( v >> 19 );
+            lane[l] = v * PRIME32_1;
+        }
+    }
+
+    // left over texels
+    for( l = 0; i < count; i++, l++ )
+    {
+        v = lane[l] + texels[i] * PRIME32_2;
+        v = ( v << 13 ) | ( v >> 19 );
+        lane[l] = v * PRIME32_1;
+    }
+
+    // fold the lanes down to 64 bits
+    uint64_t h = (uint64_t)count * PRIME64_2;
+    for( l = 0; l < HASH_LANES; l++ )
+    {
+        h = Mix64( h ^ ( lane[l] + ( (uint64_t)l << 32 ) ) );
+    }
+
+    return h;
+}
+
+
+// recalculates the stored hash of a texture, call after writing to it
+void TXR_Update_Hash( uint32_t *texels )
+{
+    txr_body_type *body = Body( texels );
+    body->hash = TXR_Hash_Texels( texels, body->tex_size * body->tex_size );
+
+    return;
+}
+
+
+// returns the stored hash of a texture
+uint64_t TXR_Get_Hash( uint32_t *texels )
+{
+    return Body( texels )->hash;
+}
+
+
+// works out which textures have identical content. uses an open addressed hash table keyed
+// on the stored hashes, matching hashes are confirmed by comparing the texels
+int TXR_Find_Duplicates( uint32_t **textures, int count, uint32_t *index, uint32_t *body_first )
+{
+    // table holds texture numbers + 1, 0 is an empty slot. kept at most half full
+    int size = 16;
+    while( size < count * 2 )
+    {
+        size <<= 1;
+    }
+
+    uint32_t *table = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * size );
+    memset( table, 0, sizeof( uint32_t ) * size );
+
+    int i, slot, bodies = 0, first;
+    uint64_t hash;
+    for( i = 0; i < count; i++ )
+    {
+        hash = TXR_Get_Hash( textures[i] );
+        slot = hash & ( size - 1 );
+
+        while( table[slot] != 0 )
+        {
+            first = table[slot] - 1;
+            if( textures[first] == textures[i] ||
+                ( TXR_Get_Hash( textures[first] ) == hash &&
+                  memcmp( textures[first], textures[i], Texture_Bytes( TXR_Size( textures[i] ) ) ) == 0 ) )
+            {
+                break;
+            }
+            slot = ( slot + 1 ) & ( size - 1 );
+        }
+
+        if( table[slot] == 0 )
+        {
+            // first time this content has been seen
+            table[slot] = i + 1;
+            if( body_first != NULL )
+            {
+                body_first[bodies] = i;
+            }
+            index[i] = bodies++;
+        }
+        else
+        {
+            index[i] = index[table[slot] - 1];
+        }
+    }
+
+    UTI_EC_Free( table );
+
+    return bodies;
+}
+
+
+// makes textures with identical content share one texel array
+int TXR_Share_Duplicates( uint32_t **textures, int count )
+{
+    uint32_t *index = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( count + 1 ) );
+    uint32_t *first = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( count + 1 ) );
+
+    int bodies = TXR_Find_Duplicates( textures, count, index, first );
+
+    int i;
+    uint32_t *shared;
+    for( i = 0; i < count; i++ )
+    {
+        shared = textures[first[index[i]]];
+        if( shared != textures[i] )
+        {
+            TXR_Release( textures[i] );
+            textures[i] = TXR_Retain( shared );
+        }
+    }
+
+    UTI_EC_Free( index );
+    UTI_EC_Free( first );
+
+    return bodies;
+}
+
+
+//=======================
+//  FILES
+//=======================
+
+// loads a .txr file into set, identical textures share memory
+int TXR_Load_File( char *filename, txr_set_type *set )
+{
+    FILE *file = NULL;
+    txr_layout_type layout;
+    const char *problem = NULL;
+    int i;
+
+    file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open file" );
+        return 0;
+    }
+
+    if( Read_Layout( file, &layout, &problem ) == 0 )
+    {
+        UTI_Print_Error( problem );
+        Free_Layout( &layout );
+        fclose( file );
+        return 0;
+    }
+
+    uint32_t **body = UTI_EC_Tag_Malloc( UTI_MEM_FILE,
+                                         sizeof( uint32_t * ) * ( layout.bodies + 1 ) );
+    for( i = 0; i < layout.bodies; i++ )
+    {
+        body[i] = TXR_Create( layout.tex_size );
+        if( Read_Body( file, &layout, i, body[i], &problem ) == 0 )
+        {
+            break;
+        }
+        TXR_Update_Hash( body[i] );
+    }
+
+    fclose( file );
+
+    if( problem != NULL )
+    {
+        UTI_Log( UTI_LOG_ERROR, "%s, texture %d", problem, i );
+        while( i >= 0 )
+        {
+            TXR_Release( body[i--] );
+        }
+        UTI_EC_Free( body );
+        Free_Layout( &layout );
+        return 0;
+    }
+
+    // hand out the bodies, then drop the references held by the body list
+    uint32_t **textures = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE,
+                                             sizeof( uint32_t * ) * ( layout.count + 1 ) );
+    for( i = 0; i < layout.count; i++ )
+    {
+        textures[i] = TXR_Retain( body[layout.index[i]] );
+    }
+
+    // the layers hold their own references to the bodies
+    txr_layer_type *layers = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE,
+                                                sizeof( txr_layer_type ) * ( layout.layer_count + 1 ) );
+    uint32_t *layer;
+    for( i = 0; i < layout.layer_count; i++ )
+    {
+        layer = &layout.layers[i * LAYER_SIZE];
+        layers[i].texture = layer[0];
+        layers[i].texels = TXR_Retain( body[layer[1]] );
+        layers[i].visible = ( layer[2] != 0 );
+        layers[i].transparent = layer[3];
+    }
+
+    for( i = 0; i < layout.bodies; i++ )
+    {
+        TXR_Release( body[i] );
+    }
+
+    // older files stored duplicates in full
+    if( layout.version == 1 )
+    {
+        TXR_Share_Duplicates( textures, layout.count );
+    }
+
+    set->tex_size = layout.tex_size;
+    set->count = layout.count;
+    set->textures = textures;
+    set->layer_count = layout.layer_count;
+    set->layers = layers;
+
+    UTI_EC_Free( body );
+    Free_Layout( &layout );
+
+    return 1;
+}
+
+
+// checks a .txr file is complete and every checksum matches, without keeping the textures
+int TXR_Verify_File( char *filename, const char **problem, int *has_crc )
+{
+    FILE *file = NULL;
+    txr_layout_type layout;
+    int ok, i;
+
+    *has_crc = 0;
+
+    file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        *problem = "unable to open file";
+        return 0;
+    }
+
+    ok = Read_Layout( file, &layout, problem );
+
+    if( ok )
+    {
+        uint32_t *texels = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE, Texture_Bytes( layout.tex_size ) );
+        for( i = 0; i < layout.bodies && ok; i++ )
+        {
+            ok = Read_Body( file, &layout, i, texels, problem );
+        }
+        UTI_EC_Free( texels );
+
+        *has_crc = ( layout.crc != NULL );
+    }
+
+    Free_Layout( &layout );
+    fclose( file );
+
+    return ok;
+}
+
+
+// saves set to a .txr file, storing each distinct texture once. the file is written to a
+// temporary file first and renamed over the old one, so a failed save never damages it
+int TXR_Save_File( char *filename, txr_set_type *set )
+{
+    txr_layout_type layout;
+    int i, arrays = set->count + set->layer_count;
+
+    // the layers' texel arrays are stored as bodies alongside the textures, so a layer the
+    // same as its flattened texture (or any other) costs nothing
+    uint32_t **all = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t * ) * ( arrays + 1 ) );
+    uint32_t *index = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( arrays + 1 ) );
+    uint32_t *first = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( arrays + 1 ) );
+
+    memcpy( all, set->textures, sizeof( uint32_t * ) * set->count );
+    for( i = 0; i < set->layer_count; i++ )
+    {
+        all[set->count + i] = set->layers[i].texels;
+    }
+
+    layout.version = TXR_VERSION;
+    layout.tex_size = set->tex_size;
+    layout.count = set->count;
+    layout.index = index;
+    layout.bodies = TXR_Find_Duplicates( all, arrays, index, first );
+    layout.crc = UTI_EC_Tag_Malloc( UTI_MEM_FILE, sizeof( uint32_t ) * ( layout.bodies + 1 ) );
+    layout.layer_count = set->layer_count;
+    layout.layers = UTI_EC_Tag_Malloc( UTI_MEM_FILE,
+                                       sizeof( uint32_t ) * ( LAYER_SIZE * set->layer_count + 1 ) );
+
+    for( i = 0; i < set->layer_count; i++ )
+    {
+        layout.layers[i * LAYER_SIZE] = set->layers[i].texture;
+        layout.layers[i * LAYER_SIZE + 1] = index[set->count + i];
+        layout.layers[i * LAYER_SIZE + 2] = set->layers[i].visible;
+        layout.layers[i * LAYER_SIZE + 3] = set->layers[i].transparent;
+    }
+
+    size_t bytes = Texture_Bytes( set->tex_size );
+    for( i = 0; i < layout.bodies; i++ )
+    {
+        layout.crc[i] = UTI_CRC32C( 0, all[first[i]], bytes );
+    }
+
+    // create the file header
+    uint32_t header[HEADER_SIZE] = { TXR_VERSION, set->tex_size, set->count, layout.bodies };
+    uint32_t header_crc = Header_CRC( header, &layout );
+
+    // everything in front of the texels is gathered into one buffer
+    size_t layer_bytes = sizeof( uint32_t ) * ( 1 + LAYER_SIZE * set->layer_count );
+    size_t front_size = 4 + sizeof( uint32_t ) * ( HEADER_SIZE + set->count + layout.bodies + 1 ) +
+                        layer_bytes;
+    uint8_t *front = UTI_EC_Tag_Malloc( UTI_MEM_FILE, front_size ), *pos = front;
+
+    memcpy( pos, "TXR2", 4 );
+    pos += 4;
+    memcpy( pos, header, sizeof( uint32_t ) * HEADER_SIZE );
+    pos += sizeof( uint32_t ) * HEADER_SIZE;
+    memcpy( pos, layout.index, sizeof( uint32_t ) * set->count );
+    pos += sizeof( uint32_t ) * set->count;
+    memcpy( pos, &layout.layer_count, sizeof( uint32_t ) );
+    memcpy( pos + sizeof( uint32_t ), layout.layers, layer_bytes - sizeof( uint32_t ) );
+    pos += layer_bytes;
+    memcpy( pos, layout.crc, sizeof( uint32_t ) * layout.bodies );
+    pos += sizeof( uint32_t ) * layout.bodies;
+    memcpy( pos, &header_crc, sizeof( uint32_t ) );
+
+    // then the file is one vectored write straight from the texel arrays
+    struct iovec *iov = UTI_EC_Tag_Malloc( UTI_MEM_FILE,
+                                           sizeof( struct iovec ) * ( layout.bodies + 1 ) );
+    iov[0].iov_base = front;
+    iov[0].iov_len = front_size;
+    for( i = 0; i < layout.bodies; i++ )
+    {
+        iov[i + 1].iov_base = all[first[i]];
+        iov[i + 1].iov_len = bytes;
+    }
+
+    int ok = Write_File_Safely( filename, iov, layout.bodies + 1 );
+
+    UTI_EC_Free( iov );
+    UTI_EC_Free( front );
+    UTI_EC_Free( first );
+    UTI_EC_Free( all );
+    Free_Layout( &layout );
+
+    return ok;
+}
+
+
+// fills set with a copy of a texture list that shares the texel arrays
+void TXR_Snapshot( txr_set_type *set, uint32_t **textures, int count, int tex_size )
+{
+    set->tex_size = tex_size;
+    set->count = count;
+    set->textures = UTI_EC_Tag_Malloc( UTI_MEM_TEXTURE, sizeof( uint32_t * ) * ( count + 1 ) );
+    set->layer_count = 0;
+    set->layers = NULL;
+
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        set->textures[i] = TXR_Retain( textures[i] );
+    }
+
+    return;
+}
+
+
+// releases all textures in a set and frees its texture list
+void TXR_Free_Set( txr_set_type *set )
+{
+    int i;
+    for( i = 0; i < set->count; i++ )
+    {
+        TXR_Release( set->textures[i] );
+    }
+
+    for( i = 0; i < set->layer_count; i++ )
+    {
+        TXR_Release( set->layers[i].texels );
+    }
+
+    UTI_EC_Free( set->textures );
+    UTI_EC_Free( set->layers );
+    set->textures = NULL;
+    set->layers = NULL;
+    set->count = set->layer_count = 0;
+
+    return;
+}
+
+
+// opens a .txr file for reading single textures, only the header and index are read
+int TXR_Open_Reader( char *filename, txr_reader_type *reader, const char **problem )
+{
+    txr_layout_type layout;
+
+    memset( reader, 0, sizeof( txr_reader_type ) );
+    reader->fd = -1;
+
+    FILE *file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        *problem = "unable to open file";
+        return 0;
+    }
+
+    if( Read_Layout( file, &layout, problem ) == 0 )
+    {
+        Free_Layout( &layout );
+        fclose( file );
+        return 0;
+    }
+
+    // the textures are read with pread, which leaves the file position alone so any number of
+    // threads can share the descriptor
+    reader->fd = dup( fileno( file ) );
+    reader->bodies_offset = ftell( file );
+    fclose( file );
+
+    if( reader->fd == -1 || reader->bodies_offset == -1 )
+    {
+        *problem = "unable to open file";
+        Free_Layout( &layout );
+        TXR_Close_Reader( reader );
+        return 0;
+    }
+
+    reader->tex_size = layout.tex_size;
+    reader->count = layout.count;
+    reader->layer_count = layout.layer_count;
+    reader->index = layout.index;
+    reader->crc = layout.crc;
+
+    // readers only give the flattened textures
+    UTI_EC_Free( layout.layers );
+
+    return 1;
+}
+
+
+// reads texture index of an open file into texels and checks its checksum
+int TXR_Read_Texture( txr_reader_type *reader, int index, uint32_t *texels, const char **problem )
+{
+    size_t bytes = Texture_Bytes( reader->tex_size ), done = 0;
+    uint32_t body = reader->index[index];
+    off_t offset = reader->bodies_offset + (off_t)body * bytes;
+    ssize_t got;
+
+    while( done < bytes )
+    {
+        got = pread( reader->fd, (uint8_t *)texels + done, bytes - done, offset + done );
+        if( got <= 0 )
+        {
+            if( got == -1 && errno == EINTR )
+            {
+                continue;
+            }
+
+            *problem = "file is truncated";
+            return 0;
+        }
+        done += got;
+    }
+
+    if( reader->crc != NULL && UTI_CRC32C( 0, texels, bytes ) != reader->crc[body] )
+    {
+        *problem = "texture failed its checksum";
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// closes a file opened with TXR_Open_Reader
+void TXR_Close_Reader( txr_reader_type *reader )
+{
+    if( reader->fd != -1 )
+    {
+        close( reader->fd );
+    }
+
+    UTI_EC_Free( reader->index );
+    UTI_EC_Free( reader->crc );
+    memset( reader, 0, sizeof( txr_reader_type ) );
+    reader->fd = -1;
+
+    return;
+}
@@ -0,0 +1,184 @@
+/*
+    texture.h
+    texture storage and .txr files.
+
+    every texture is a TEX_SIZE x TEX_SIZE array of uint32_t palette indices. the arrays are
+    allocated with a small header in front holding a reference count and a hash of the texels,
+    but everything outside of this module just sees the texel pointer. textures with the same
+    content share one array: anything about to write to a texture must check TXR_Shared and
+    swap in a TXR_Copy first.
+
+    file format, all values uint32_t in machine byte order:
+        "TXR2"  version  tex_size  count  bodies
+        index[count]                        - which body each texture uses
+        layer_count
+        layer_count x ( texture  body  visible  transparent )
+                                            - the layers of layered textures, texture by
+                                              texture and bottom first, see layers.h
+        crc[bodies]                         - CRC32C of each body
+        header crc                          - CRC32C of everything above
+        bodies x tex_size^2 texels          - each distinct texture is only stored once
+
+    the index always gives the flattened textures, so layers can be ignored by anything that
+    only wants to look at them. layers arrived with version 4 and version 2 files have no
+    checksums. the older "TXTR" format ( "TXTR" tex_size count, then count textures ) can
+    still be loaded too
+*/
+
+#ifndef __texture_h__
+#define __texture_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define TXR_VERSION             4
+
+#define TXR_MAX_SIZE            4096        // largest texture size a file may hold
+#define TXR_MAX_LAYERS          8           // most layers one texture may have
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// one layer of a layered texture
+struct txr_layer_s              {
+                                    int         texture;
+                                    int         visible;
+                                    uint32_t    transparent;
+
+                                    uint32_t    *texels;
+                                };
+typedef struct txr_layer_s txr_layer_type;
+
+struct txr_set_s                {
+                                    int         tex_size;
+                                    int         count;
+
+                                    uint32_t    **textures;     // count texel arrays
+
+                                    int         layer_count;    // layers of layered textures,
+                                    txr_layer_type  *layers;    // texture by texture
+                                };
+typedef struct txr_set_s txr_set_type;
+
+// a .txr file open for reading textures one at a time, in any order and from any thread
+struct txr_reader_s             {
+                                    int         fd;
+                                    int         tex_size;
+                                    int         count;
+                                    int         layer_count;    // layers the file has, which
+                                                                // aren't read
+
+                                    uint32_t    *index;     // body used by each texture
+                                    uint32_t    *crc;       // NULL for files without checksums
+                                    long        bodies_offset;
+                                };
+typedef struct txr_reader_s txr_reader_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+//=======================
+//  TEXTURES
+//=======================
+
+// creates a blank (all 0) texture with one reference
+uint32_t *TXR_Create( int tex_size );
+
+
+// creates a new texture with one reference holding a copy of texels
+uint32_t *TXR_Copy( uint32_t *texels );
+
+
+// adds a reference to a texture, returns texels
+uint32_t *TXR_Retain( uint32_t *texels );
+
+
+// drops a reference to a texture, freeing it when there are none left. ignores NULL
+void TXR_Release( uint32_t *texels );
+
+
+// returns 1 if more than one reference is held to the texture, so it must not be written to
+int TXR_Shared( uint32_t *texels );
+
+
+// returns the width (and height) of a texture
+int TXR_Size( uint32_t *texels );
+
+
+//=======================
+//  HASHING
+//=======================
+
+// returns a 64 bit hash of count texels. works on several independent lanes at once so the
+// compiler can vectorize it
+uint64_t TXR_Hash_Texels( const uint32_t *texels, int count );
+
+
+// recalculates the stored hash of a texture, call after writing to it
+void TXR_Update_Hash( uint32_t *texels );
+
+
+// returns the stored hash of a texture
+uint64_t TXR_Get_Hash( uint32_t *texels );
+
+
+// works out which textures have identical content. index[i] is set to the body number for
+// texture i, bodies being numbered in order of first use, and body_first[b] (if not NULL) to
+// the first texture using body b. returns the number of bodies
+int TXR_Find_Duplicates( uint32_t **textures, int count, uint32_t *index, uint32_t *body_first );
+
+
+// makes textures with identical content share one texel array, returns the number of
+// distinct arrays left
+int TXR_Share_Duplicates( uint32_t **textures, int count );
+
+
+//=======================
+//  FILES
+//=======================
+
+// loads a .txr file into set, identical textures share memory
+int TXR_Load_File( char *filename, txr_set_type *set );
+
+
+// checks a .txr file is complete and every checksum matches, without keeping the textures.
+// on failure problem is set to what was wrong. has_crc is set to 0 for files too old to have
+// checksums, which can only be checked for being complete
+int TXR_Verify_File( char *filename, const char **problem, int *has_crc );
+
+
+// saves set to a .txr file, storing each distinct texture once
+int TXR_Save_File( char *filename, txr_set_type *set );
+
+
+// fills set with a copy of a texture list that shares the texel arrays, so it costs one
+// reference per texture. the copy stays as it is while the originals are edited, as long as
+// writers follow the TXR_Shared rule. the set has no layers
+void TXR_Snapshot( txr_set_type *set, uint32_t **textures, int count, int tex_size );
+
+
+// releases all textures and layers in a set and frees its lists
+void TXR_Free_Set( txr_set_type *set );
+
+
+// opens a .txr file for reading single textures with TXR_Read_Texture, only the header and
+// index are read. on failure problem is set to what was wrong
+int TXR_Open_Reader( char *filename, txr_reader_type *reader, const char **problem );
+
+
+// reads texture index of an open file into texels and checks its checksum. safe to call from
+// several threads at once. on failure problem is set to what was wrong
+int TXR_Read_Texture( txr_reader_type *reader, int index, uint32_t *texels, const char **problem );
+
+
+// closes a file opened with TXR_Open_Reader
+void TXR_Close_Reader( txr_reader_type *reader );
+
+#endif  // __texture_h__
@@ -0,0 +1,234 @@
+/*
+    thread.c
+    small threading helpers built on SDL threads
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// keeps the producer and consumer counters on separate cache lines so the two threads don't
+// keep stealing the line from each other
+#define CACHE_LINE              64
+
+// head and tail count up forever (wrapping at 2^32), the slot used is the count masked by the
+// queue size. they are equal when the queue is empty and size apart when it is full
+struct thr_queue_s              {
+                                    atomic_uint head;       // next slot to write, producer only
+                                    char        pad1[CACHE_LINE - sizeof( atomic_uint )];
+
+                                    atomic_uint tail;       // next slot to read, consumer only
+                                    char        pad2[CACHE_LINE - sizeof( atomic_uint )];
+
+                                    unsigned    size;
+                                    unsigned    mask;
+                                    int         item_size;
+                                    uint8_t     *items;
+                                };
+
+// work shared by the threads of THR_Parallel_For, each thread takes the next index until
+// they run out
+struct parallel_for_s           {
+                                    atomic_int  next;
+                                    atomic_int  failed;
+                                    int         count;
+
+                                    int         (*func)( int, void * );
+                                    void        *data;
+                                };
+typedef struct parallel_for_s parallel_for_type;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// worker thread for THR_Parallel_For
+static int Parallel_For_Thread( void *data )
+{
+    parallel_for_type *work = data;
+    int i;
+
+    while( ( i = atomic_fetch_add( &work->next, 1 ) ) < work->count )
+    {
+        if( work->func( i, work->data ) == 0 )
+        {
+            atomic_store( &work->failed, 1 );
+        }
+    }
+
+    return 0;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+//=======================
+//  THREADS
+//=======================
+
+// starts func( data ) on a new thread, returns NULL on failure
+thr_thread_type *THR_Create_Thread( int (*func)( void * ), char *name, void *data )
+{
+    SDL_Thread *thread = SDL_CreateThread( func, name, data );
+    if( thread == NULL )
+    {
+        UTI_Print_Error( "Unable to create thread" );
+        GRA_Print_SDL_Error();
+    }
+
+    return thread;
+}
+
+
+// waits for a thread to finish, returns the value returned by its function
+int THR_Wait_Thread( thr_thread_type *thread )
+{
+    int status = 0;
+    SDL_WaitThread( thread, &status );
+
+    return status;
+}
+
+
+// returns the number of cpu cores
+int THR_CPU_Count()
+{
+    return SDL_GetCPUCount();
+}
+
+
+// calls func( i, data ) for every i from 0 to count - 1, spread over one thread per core
+int THR_Parallel_For( int count, int (*func)( int, void * ), void *data )
+{
+    parallel_for_type work;
+    int threads = THR_CPU_Count(), i;
+
+    atomic_init( &work.next, 0 );
+    atomic_init( &work.failed, 0 );
+    work.count = count;
+    work.func = func;
+    work.data = data;
+
+    if( threads > count )
+    {
+        threads = count;
+    }
+
+    // this thread works too, so one fewer is started
+    thr_thread_type **thread = UTI_EC_Tag_Malloc( UTI_MEM_THREAD, sizeof( thr_thread_type * ) * ( threads + 1 ) );
+    for( i = 0; i < threads - 1; i++ )
+    {
+        thread[i] = THR_Create_Thread( Parallel_For_Thread, "parallel", &work );
+    }
+
+    Parallel_For_Thread( &work );
+
+    for( i = 0; i < threads - 1; i++ )
+    {
+        if( thread[i] != NULL )
+        {
+            THR_Wait_Thread( thread[i] );
+        }
+    }
+
+    UTI_EC_Free( thread );
+
+    return( atomic_load( &work.failed ) == 0 );
+}
+
+
+//=======================
+//  QUEUES
+//=======================
+
+// creates a queue holding up to size items of item_size bytes
+thr_queue_type *THR_Create_Queue( int size, int item_size )
+{
+    thr_queue_type *queue = UTI_EC_Tag_Malloc( UTI_MEM_THREAD, sizeof( thr_queue_type ) );
+
+    // round size up to a power of 2 so slots can be found with a mask
+    queue->size = 1;
+    while( queue->size < size )
+    {
+        queue->size <<= 1;
+    }
+
+    queue->mask = queue->size - 1;
+    queue->item_size = item_size;
+    queue->items = UTI_EC_Tag_Malloc( UTI_MEM_THREAD, queue->size * item_size );
+
+    atomic_init( &queue->head, 0 );
+    atomic_init( &queue->tail, 0 );
+
+    return queue;
+}
+
+
+// frees a queue, neither thread may be using it
+void THR_Destroy_Queue( thr_queue_type *queue )
+{
+    if( queue == NULL )
+    {
+        return;
+    }
+
+    UTI_EC_Free( queue->items );
+    UTI_EC_Free( queue );
+
+    return;
+}
+
+
+// copies item onto the end of the queue, producer thread only
+int THR_Queue_Push( thr_queue_type *queue, const void *item )
+{
+    unsigned head = atomic_load_explicit( &queue->head, memory_order_relaxed );
+    unsigned tail = atomic_load_explicit( &queue->tail, memory_order_acquire );
+
+    if( head - tail == queue->size )
+    {
+        return 0;
+    }
+
+    memcpy( &queue->items[( head & queue->mask ) * queue->item_size], item, queue->item_size );
+
+    // publish the item, the release makes sure the copy is seen before the new head
+    atomic_store_explicit( &queue->head, head + 1, memory_order_release );
+
+    return 1;
+}
+
+
+// copies the oldest item off the queue into item, consumer thread only
+int THR_Queue_Pop( thr_queue_type *queue, void *item )
+{
+    unsigned tail = atomic_load_explicit( &queue->tail, memory_order_relaxed );
+    unsigned head = atomic_load_explicit( &queue->head, memory_order_acquire );
+
+    if( head == tail )
+    {
+        return 0;
+    }
+
+    memcpy( item, &queue->items[( tail & queue->mask ) * queue->item_size], queue->item_size );
+
+    // hand the slot back to the producer once the copy is done
+    atomic_store_explicit( &queue->tail, tail + 1, memory_order_release );
+
+    return 1;
+}
@@ -0,0 +1,68 @@
+/*
+    thread.h
+    small threading helpers built on SDL threads, plus a lock-free queue for passing fixed
+    size items from one thread to another
+*/
+
+#ifndef __thread_h__
+#define __thread_h__
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+typedef struct SDL_Thread thr_thread_type;
+
+// single producer / single consumer ring buffer. exactly one thread may push and exactly
+// one other thread may pop, neither ever blocks or takes a lock
+typedef struct thr_queue_s thr_queue_type;
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+//=======================
+//  THREADS
+//=======================
+
+// starts func( data ) on a new thread, returns NULL on failure
+thr_thread_type *THR_Create_Thread( int (*func)( void * ), char *name, void *data );
+
+
+// waits for a thread to finish, returns the value returned by its function
+int THR_Wait_Thread( thr_thread_type *thread );
+
+
+// returns the number of cpu cores
+int THR_CPU_Count();
+
+
+// calls func( i, data ) for every i from 0 to count - 1, spread over one thread per core.
+// calls may run in any order and at the same time. returns 1 if every call returned 1
+int THR_Parallel_For( int count, int (*func)( int, void * ), void *data );
+
+
+//=======================
+//  QUEUES
+//=======================
+
+// creates a queue holding up to size items of item_size bytes, size is rounded up to a power
+// of 2
+thr_queue_type *THR_Create_Queue( int size, int item_size );
+
+
+// frees a queue, neither thread may be using it
+void THR_Destroy_Queue( thr_queue_type *queue );
+
+
+// copies item onto the end of the queue, producer thread only. returns 0 if the queue is full
+int THR_Queue_Push( thr_queue_type *queue, const void *item );
+
+
+// copies the oldest item off the queue into item, consumer thread only. returns 0 if the
+// queue is empty
+int THR_Queue_Pop( thr_queue_type *queue, void *item );
+
+#endif  // __thread_h__
@@ -0,0 +1,291 @@
+/*
+    thumbs.c
+    small previews of every texture, built on a background thread
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "thread.h"
+#include "thumbs.h"
+#include "kernels.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// everything below is shared with the thumbnail thread and protected by thumb_lock. the
+// texels themselves are edited without the lock, a thumbnail built part way through an edit
+// is simply rebuilt when THM_Texture_Changed bumps the revision
+static SDL_mutex            *thumb_lock         = NULL;
+static SDL_cond             *thumb_wake         = NULL;         // signalled when there is work
+static thr_thread_type      *thumb_thread       = NULL;
+static int                  thumb_running       = 0;
+
+static int                  thumb_max           = 0;            // number of texture slots
+static int                  thumb_tex_size      = 0;
+static const krn_table_type *thumb_kernels      = NULL;         // kernels for thumb_tex_size
+
+static uint32_t             **thumb_source      = NULL;         // texels of each texture
+static uint32_t             *thumb_revision     = NULL;         // bumped on every change
+static uint32_t             *thumb_built        = NULL;         // revision each thumbnail shows
+static uint8_t              *thumb_ready        = NULL;         // 1 once a thumbnail exists
+static uint8_t              *thumb_pixels       = NULL;         // THUMB_SIZE^2 per texture
+
+static int                  visible_first       = 0;
+static int                  visible_count       = 0;
+
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns 1 if the texture at index needs its thumbnail (re)built, thumb_lock must be held
+static int Thumb_Stale( int index )
+{
+    return( thumb_source[index] != NULL &&
+            ( !thumb_ready[index] || thumb_built[index] != thumb_revision[index] ) );
+}
+
+
+// finds the next thumbnail to build, visible ones first. returns -1 if they are all up to
+// date, thumb_lock must be held
+static int Next_Stale_Thumb()
+{
+    int i;
+    for( i = visible_first; i < visible_first + visible_count && i < thumb_max; i++ )
+    {
+        if( Thumb_Stale( i ) )
+        {
+            return i;
+        }
+    }
+
+    for( i = 0; i < thumb_max; i++ )
+    {
+        if( Thumb_Stale( i ) )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+// point samples the texels of texture index down (or up) to THUMB_SIZE x THUMB_SIZE. the
+// textures are palette indexed so neighbouring texels can't be blended, sampling keeps the
+// colours exact. sizes that divide evenly use the size's own kernels. thumb_lock must be held
+static void Build_Thumb( int index )
+{
+    uint32_t *src = thumb_source[index];
+    uint8_t *dest = &thumb_pixels[index * THUMB_SIZE * THUMB_SIZE];
+
+    int x, y;
+    uint32_t *row;
+    if( thumb_tex_size % THUMB_SIZE == 0 )
+    {
+        KRN_Reduce( thumb_kernels, src, thumb_tex_size, thumb_tex_size / THUMB_SIZE, dest );
+    }
+    else if( THUMB_SIZE % thumb_tex_size == 0 )
+    {
+        KRN_Blit( thumb_kernels, src, thumb_tex_size, THUMB_SIZE / thumb_tex_size, dest );
+    }
+    else
+    {
+        for( y = 0; y < THUMB_SIZE; y++ )
+        {
+            row = &src[( y * thumb_tex_size / THUMB_SIZE ) * thumb_tex_size];
+            for( x = 0; x < THUMB_SIZE; x++ )
+            {
+                dest[y * THUMB_SIZE + x] = row[x * thumb_tex_size / THUMB_SIZE];
+            }
+        }
+    }
+
+    thumb_built[index] = thumb_revision[index];
+    thumb_ready[index] = 1;
+
+    return;
+}
+
+
+// thumbnail thread, builds stale thumbnails and sleeps when there are none
+static int Thumb_Thread( void *data )
+{
+    int index;
+
+    SDL_LockMutex( thumb_lock );
+    while( thumb_running )
+    {
+        if( ( index = Next_Stale_Thumb() ) == -1 )
+        {
+            SDL_CondWait( thumb_wake, thumb_lock );
+            continue;
+        }
+
+        Build_Thumb( index );
+
+        // give the other threads a chance at the lock between thumbnails
+        SDL_UnlockMutex( thumb_lock );
+        SDL_LockMutex( thumb_lock );
+    }
+    SDL_UnlockMutex( thumb_lock );
+
+    return 0;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// starts the thumbnail thread for up to max_textures textures of tex_size x tex_size
+int THM_Start( int max_textures, int tex_size )
+{
+    thumb_max = max_textures;
+    thumb_tex_size = tex_size;
+    thumb_kernels = KRN_Select( tex_size );
+
+    thumb_source    = UTI_EC_Tag_Malloc( UTI_MEM_THUMBNAIL, sizeof( uint32_t * ) * max_textures );
+    thumb_revision  = UTI_EC_Tag_Malloc( UTI_MEM_THUMBNAIL, sizeof( uint32_t ) * max_textures );
+    thumb_built     = UTI_EC_Tag_Malloc( UTI_MEM_THUMBNAIL, sizeof( uint32_t ) * max_textures );
+    thumb_ready     = UTI_EC_Tag_Malloc( UTI_MEM_THUMBNAIL, max_textures );
+    thumb_pixels    = UTI_EC_Tag_Malloc( UTI_MEM_THUMBNAIL, max_textures * THUMB_SIZE * THUMB_SIZE );
+
+    memset( thumb_source, 0, sizeof( uint32_t * ) * max_textures );
+    memset( thumb_revision, 0, sizeof( uint32_t ) * max_textures );
+    memset( thumb_built, 0, sizeof( uint32_t ) * max_textures );
+    memset( thumb_ready, 0, max_textures );
+
+    thumb_lock = SDL_CreateMutex();
+    thumb_wake = SDL_CreateCond();
+    if( thumb_lock == NULL || thumb_wake == NULL )
+    {
+        UTI_Print_Error( "Unable to create thumbnail lock" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    thumb_running = 1;
+    thumb_thread = THR_Create_Thread( Thumb_Thread, "thumbs", NULL );
+    if( thumb_thread == NULL )
+    {
+        thumb_running = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// stops the thumbnail thread and frees the thumbnails
+void THM_Stop()
+{
+    if( thumb_thread != NULL )
+    {
+        SDL_LockMutex( thumb_lock );
+        thumb_running = 0;
+        SDL_CondSignal( thumb_wake );
+        SDL_UnlockMutex( thumb_lock );
+
+        THR_Wait_Thread( thumb_thread );
+        thumb_thread = NULL;
+    }
+
+    SDL_DestroyCond( thumb_wake );
+    thumb_wake = NULL;
+    SDL_DestroyMutex( thumb_lock );
+    thumb_lock = NULL;
+
+    UTI_EC_Free( thumb_source );
+    UTI_EC_Free( thumb_revision );
+    UTI_EC_Free( thumb_built );
+    UTI_EC_Free( thumb_ready );
+    UTI_EC_Free( thumb_pixels );
+    thumb_source = NULL;
+    thumb_max = 0;
+
+    return;
+}
+
+
+// tells the thumbnail thread the texture at index now uses texels
+void THM_Set_Texture( int index, uint32_t *texels )
+{
+    if( thumb_lock == NULL || index < 0 || index >= thumb_max )
+    {
+        return;
+    }
+
+    SDL_LockMutex( thumb_lock );
+    thumb_source[index] = texels;
+    thumb_revision[index]++;
+    SDL_CondSignal( thumb_wake );
+    SDL_UnlockMutex( thumb_lock );
+
+    return;
+}
+
+
+// tells the thumbnail thread the texture at index has been edited
+void THM_Texture_Changed( int index )
+{
+    if( thumb_lock == NULL || index < 0 || index >= thumb_max )
+    {
+        return;
+    }
+
+    SDL_LockMutex( thumb_lock );
+    thumb_revision[index]++;
+    SDL_CondSignal( thumb_wake );
+    SDL_UnlockMutex( thumb_lock );
+
+    return;
+}
+
+
+// sets which textures are on screen, their thumbnails are built before any others
+void THM_Set_Visible( int first, int count )
+{
+    if( thumb_lock == NULL )
+    {
+        return;
+    }
+
+    SDL_LockMutex( thumb_lock );
+    visible_first = first;
+    visible_count = count;
+    SDL_CondSignal( thumb_wake );
+    SDL_UnlockMutex( thumb_lock );
+
+    return;
+}
+
+
+// draws the thumbnail for the texture at index with its top left corner at (x, y)
+int THM_Draw( int index, int x, int y )
+{
+    if( thumb_lock == NULL || index < 0 || index >= thumb_max )
+    {
+        return 0;
+    }
+
+    int ready;
+
+    SDL_LockMutex( thumb_lock );
+    if( ( ready = thumb_ready[index] ) )
+    {
+        GRA_Draw_Indexed_Image( x, y, THUMB_SIZE, THUMB_SIZE,
+                                &thumb_pixels[index * THUMB_SIZE * THUMB_SIZE] );
+    }
+    SDL_UnlockMutex( thumb_lock );
+
+    return ready;
+}
@@ -0,0 +1,50 @@
+/*
+    thumbs.h
+    small previews of every texture, used by the thumbnail strip. previews are built on a
+    background thread and cached, and only rebuilt when their texture has changed, so drawing
+    the strip is just a copy of the cached images
+*/
+
+#ifndef __thumbs_h__
+#define __thumbs_h__
+
+#include <stdint.h>
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+#define THUMB_SIZE              32          // thumbnails are THUMB_SIZE x THUMB_SIZE pixels
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// starts the thumbnail thread for up to max_textures textures of tex_size x tex_size
+int THM_Start( int max_textures, int tex_size );
+
+
+// stops the thumbnail thread and frees the thumbnails
+void THM_Stop();
+
+
+// tells the thumbnail thread the texture at index now uses texels (NULL if it doesn't exist).
+// once this returns the thread no longer reads the old texels, so they can be freed
+void THM_Set_Texture( int index, uint32_t *texels );
+
+
+// tells the thumbnail thread the texture at index has been edited and needs a new thumbnail
+void THM_Texture_Changed( int index );
+
+
+// sets which textures are on screen, their thumbnails are built before any others
+void THM_Set_Visible( int first, int count );
+
+
+// draws the thumbnail for the texture at index with its top left corner at (x, y), returns 0
+// if it hasn't been built yet
+int THM_Draw( int index, int x, int y );
+
+#endif  // __thumbs_h__
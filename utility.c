@@ -5,17 +5,490 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#if defined( __x86_64__ )
+#   include <nmmintrin.h>
+#endif
 
 #include "utility.h"
 
+// reversed CRC32C (Castagnoli) polynomial
+#define CRC32C_POLY             0x82F63B78u
+
+// crc_table[0] is the usual byte at a time table, crc_table[k] gives the effect of a byte
+// followed by k zero bytes, so 8 bytes can be folded in with 8 independent lookups
+static uint32_t                 crc_table[8][256];
+static int                      crc_hardware = 0;
+static once_flag                crc_once = ONCE_FLAG_INIT;
+
+// the log ring, a bounded queue any thread can add to without locking. a slot's sequence says
+// whose turn it is: the writer of message n waits for n, the reader for n + 1
+#define LOG_SLOTS               1024        // a power of two
+#define LOG_TEXT_SIZE           244         // longest message, with its prefix and newline
+#define LOG_WRITE_SIZE          16384       // bytes of messages written to the terminal at once
+#define LOG_IDLE_NS             2000000     // how long the log thread sleeps with nothing to do
+
+struct log_slot_s               {
+                                    _Atomic size_t  sequence;
+                                    int             length;
+                                    char            text[LOG_TEXT_SIZE];
+                                } __attribute__(( aligned( 64 ) ));
+typedef struct log_slot_s log_slot_type;
+
+_Atomic int                     uti_log_level = UTI_LOG_LEVEL;
+
+static const char               *log_level_names[UTI_LOG_LEVELS] = {
+                                    "error", "warn", "info", "debug" };
+static const char               *log_level_tags[UTI_LOG_LEVELS] = {
+                                    "[ERROR]", "[WARN]", "[INFO]", "[DEBUG]" };
+
+static log_slot_type            log_ring[LOG_SLOTS];
+static _Atomic size_t           log_head = 0;               // next message to be written
+static size_t                   log_tail = 0;               // next message to be read
+static _Atomic size_t           log_dropped = 0;            // messages lost with the ring full
+
+static once_flag                log_once = ONCE_FLAG_INIT;
+static mtx_t                    log_read_lock;              // one reader at a time
+static thrd_t                   log_thread;
+static int                      log_thread_running = 0;
+static _Atomic int              log_stop = 0;
+
+static const char               *mem_tag_names[UTI_MEM_TAGS + 1] = {
+                                    "general", "texture", "thumbnail", "framebuffer", "font",
+                                    "palette", "thread", "file", "scratch", "total" };
+
+#ifdef UTI_MEMORY_STATS
+// every counted block starts with its size and tag, taking 16 bytes so the memory after it
+// keeps malloc's alignment
+#define MEM_HEADER_SIZE         16
+
+struct mem_header_s             {
+                                    size_t      size;
+                                    int         tag;
+                                };
+typedef struct mem_header_s mem_header_type;
+
+// the counts are updated from every thread, each tag on its own cache line
+struct mem_counter_s            {
+                                    _Atomic size_t      live;
+                                    _Atomic size_t      peak;
+                                    _Atomic size_t      blocks;
+                                    _Atomic size_t      allocated;
+                                    _Atomic uint64_t    allocs;
+                                    _Atomic uint64_t    frees;
+                                } __attribute__(( aligned( 64 ) ));
+typedef struct mem_counter_s mem_counter_type;
+
+static mem_counter_type         mem_counters[UTI_MEM_TAGS];
+static struct timespec          mem_start;                  // time of the first allocation
+static once_flag                mem_once = ONCE_FLAG_INIT;
+#endif  // UTI_MEMORY_STATS
+
+// writes every message in the ring to the terminal, returns how many there were
+static int Read_Log()
+{
+    char buffer[LOG_WRITE_SIZE];
+    int used = 0, count = 0;
+    log_slot_type *slot;
+
+    mtx_lock( &log_read_lock );
+
+    size_t dropped = atomic_exchange_explicit( &log_dropped, 0, memory_order_relaxed );
+    if( dropped != 0 )
+    {
+        used = snprintf( buffer, sizeof( buffer ), "[WARN] %zu log messages lost, the log was full\n",
+                         dropped );
+    }
+
+    for( ;; )
+    {
+        slot = &log_ring[log_tail & ( LOG_SLOTS - 1 )];
+        if( atomic_load_explicit( &slot->sequence, memory_order_acquire ) != log_tail + 1 )
+        {
+            break;
+        }
+
+        if( used + slot->length > LOG_WRITE_SIZE )
+        {
+            fwrite( buffer, 1, used, stdout );
+            used = 0;
+        }
+
+        memcpy( &buffer[used], slot->text, slot->length );
+        used += slot->length;
+
+        // hand the slot back to the writers, a lap of the ring later
+        atomic_store_explicit( &slot->sequence, log_tail + LOG_SLOTS, memory_order_release );
+        log_tail++;
+        count++;
+    }
+
+    if( used > 0 )
+    {
+        fwrite( buffer, 1, used, stdout );
+        fflush( stdout );
+    }
+
+    mtx_unlock( &log_read_lock );
+
+    return count;
+}
+
+
+// writes out messages as they arrive until the program ends
+static int Log_Thread( void *data )
+{
+    struct timespec idle = { 0, LOG_IDLE_NS };
+
+    while( atomic_load( &log_stop ) == 0 )
+    {
+        if( Read_Log() == 0 )
+        {
+            thrd_sleep( &idle, NULL );
+        }
+    }
+
+    return 0;
+}
+
+
+// stops the log thread when the program ends and writes out what is left
+static void Stop_Log()
+{
+    if( log_thread_running )
+    {
+        atomic_store( &log_stop, 1 );
+        thrd_join( log_thread, NULL );
+        log_thread_running = 0;
+    }
+
+    Read_Log();
+
+    return;
+}
+
+
+// sets up the ring and starts the log thread. without the thread messages are written out
+// as they are logged
+static void Start_Log()
+{
+    size_t i;
+    for( i = 0; i < LOG_SLOTS; i++ )
+    {
+        atomic_init( &log_ring[i].sequence, i );
+    }
+
+    mtx_init( &log_read_lock, mtx_plain );
+    log_thread_running = ( thrd_create( &log_thread, Log_Thread, NULL ) == thrd_success );
+    atexit( Stop_Log );
+
+    return;
+}
+
+
 // prints error message then closes program
 void UTI_Fatal_Error( char *msg )
 {
+    UTI_Log_Flush();
+
     printf( "FATAL ERROR: %s\n", msg );
     exit( 1 );
 }
 
 
+// adds a message to the log ring, or drops it if the ring is full
+void UTI_Log_Write( int level, const char *func, const char *format, ... )
+{
+    call_once( &log_once, Start_Log );
+
+    // claim the next slot, unless the reader hasn't emptied it yet
+    size_t pos = atomic_load_explicit( &log_head, memory_order_relaxed ), sequence;
+    log_slot_type *slot;
+
+    for( ;; )
+    {
+        slot = &log_ring[pos & ( LOG_SLOTS - 1 )];
+        sequence = atomic_load_explicit( &slot->sequence, memory_order_acquire );
+
+        if( sequence == pos )
+        {
+            if( atomic_compare_exchange_weak_explicit( &log_head, &pos, pos + 1,
+                                                       memory_order_relaxed, memory_order_relaxed ) )
+            {
+                break;
+            }
+        }
+        else if( (ptrdiff_t)( sequence - pos ) < 0 )
+        {
+            atomic_fetch_add_explicit( &log_dropped, 1, memory_order_relaxed );
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit( &log_head, memory_order_relaxed );
+        }
+    }
+
+    level = ( level >= 0 && level < UTI_LOG_LEVELS ) ? level : UTI_LOG_ERROR;
+    int length = snprintf( slot->text, LOG_TEXT_SIZE, "%s <%s()>: ", log_level_tags[level], func );
+
+    va_list args;
+    va_start( args, format );
+    length += vsnprintf( &slot->text[length], LOG_TEXT_SIZE - length, format, args );
+    va_end( args );
+
+    // long messages are cut short, leaving room for the newline
+    length = ( length < LOG_TEXT_SIZE - 1 ) ? length : LOG_TEXT_SIZE - 2;
+    slot->text[length++] = '\n';
+    slot->length = length;
+
+    atomic_store_explicit( &slot->sequence, pos + 1, memory_order_release );
+
+    if( log_thread_running == 0 )
+    {
+        Read_Log();
+    }
+
+    return;
+}
+
+
+// sets the most detailed level logged
+void UTI_Log_Set_Level( int level )
+{
+    atomic_store( &uti_log_level, level );
+
+    return;
+}
+
+
+// returns the UTI_LOG_ level called name, or -1
+int UTI_Log_Find_Level( const char *name )
+{
+    int level;
+    for( level = 0; level < UTI_LOG_LEVELS; level++ )
+    {
+        if( strcmp( name, log_level_names[level] ) == 0 )
+        {
+            return level;
+        }
+    }
+
+    return -1;
+}
+
+
+// writes out every message logged so far
+void UTI_Log_Flush()
+{
+    call_once( &log_once, Start_Log );
+
+    Read_Log();
+
+    return;
+}
+
+
+#ifdef UTI_MEMORY_STATS
+// prints the memory still allocated when the program ends
+static void Report_Leaks()
+{
+    uti_mem_stats_type stats;
+    int tag;
+
+    for( tag = 0; tag < UTI_MEM_TAGS; tag++ )
+    {
+        UTI_Memory_Stats( tag, &stats );
+        if( stats.blocks != 0 )
+        {
+            printf( "[MEMORY] %zu bytes in %zu blocks of %s memory not freed at exit\n",
+                    stats.live, stats.blocks, mem_tag_names[tag] );
+        }
+    }
+
+    return;
+}
+
+
+// starts the clock for the allocation rates and sets up the leak report
+static void Init_Memory_Stats()
+{
+    timespec_get( &mem_start, TIME_UTC );
+    atexit( Report_Leaks );
+
+    return;
+}
+
+
+// counts a block of size bytes being allocated for tag
+static void Count_Alloc( int tag, size_t size )
+{
+    mem_counter_type *counter = &mem_counters[tag];
+
+    size_t live = atomic_fetch_add_explicit( &counter->live, size, memory_order_relaxed ) + size;
+    atomic_fetch_add_explicit( &counter->blocks, 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &counter->allocated, size, memory_order_relaxed );
+    atomic_fetch_add_explicit( &counter->allocs, 1, memory_order_relaxed );
+
+    size_t peak = atomic_load_explicit( &counter->peak, memory_order_relaxed );
+    while( live > peak &&
+           !atomic_compare_exchange_weak_explicit( &counter->peak, &peak, live,
+                                                   memory_order_relaxed, memory_order_relaxed ) );
+
+    return;
+}
+
+
+// counts a block of size bytes of tag being freed
+static void Count_Free( int tag, size_t size )
+{
+    mem_counter_type *counter = &mem_counters[tag];
+
+    atomic_fetch_sub_explicit( &counter->live, size, memory_order_relaxed );
+    atomic_fetch_sub_explicit( &counter->blocks, 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &counter->frees, 1, memory_order_relaxed );
+
+    return;
+}
+
+
+// error checked malloc call, counted against tag
+void *UTI_EC_Tag_Malloc( int tag, size_t size )
+{
+    return UTI_EC_Tag_Realloc( tag, NULL, size );
+}
+
+
+// error checked realloc call, the block is counted against tag afterwards
+void *UTI_EC_Tag_Realloc( int tag, void *ptr, size_t size )
+{
+    call_once( &mem_once, Init_Memory_Stats );
+
+    tag = ( tag >= 0 && tag < UTI_MEM_TAGS ) ? tag : UTI_MEM_GENERAL;
+
+    mem_header_type *header = NULL;
+    if( ptr != NULL )
+    {
+        header = (mem_header_type *)( (uint8_t *)ptr - MEM_HEADER_SIZE );
+        Count_Free( header->tag, header->size );
+    }
+
+    header = realloc( header, size + MEM_HEADER_SIZE );
+    if( header == NULL )
+    {
+        UTI_Fatal_Error( "<UTI_EC_Realloc>: Unable to allocate memory" );
+    }
+
+    header->size = size;
+    header->tag = tag;
+    Count_Alloc( tag, size );
+
+    return (uint8_t *)header + MEM_HEADER_SIZE;
+}
+
+
+// error checked malloc call
+void *UTI_EC_Malloc( size_t size )
+{
+    return UTI_EC_Tag_Realloc( UTI_MEM_GENERAL, NULL, size );
+}
+
+
+// error checked realloc call
+void *UTI_EC_Realloc( void *ptr, size_t size )
+{
+    return UTI_EC_Tag_Realloc( UTI_MEM_GENERAL, ptr, size );
+}
+
+
+// error checked free
+void UTI_EC_Free( void *ptr )
+{
+    if( ptr == NULL )
+    {
+        // if pointer is null, no action needed
+        return;
+    }
+
+    mem_header_type *header = (mem_header_type *)( (uint8_t *)ptr - MEM_HEADER_SIZE );
+    Count_Free( header->tag, header->size );
+
+    free( header );
+
+    return;
+}
+
+
+// copies the counts for tag into stats, UTI_MEM_TAGS for the totals
+int UTI_Memory_Stats( int tag, uti_mem_stats_type *stats )
+{
+    memset( stats, 0, sizeof( uti_mem_stats_type ) );
+
+    if( tag < 0 || tag > UTI_MEM_TAGS )
+    {
+        return 0;
+    }
+
+    int first = ( tag == UTI_MEM_TAGS ) ? 0 : tag, last = ( tag == UTI_MEM_TAGS ) ? tag : tag + 1, i;
+    mem_counter_type *counter;
+
+    for( i = first; i < last; i++ )
+    {
+        counter = &mem_counters[i];
+        stats->live         += atomic_load_explicit( &counter->live, memory_order_relaxed );
+        stats->peak         += atomic_load_explicit( &counter->peak, memory_order_relaxed );
+        stats->blocks       += atomic_load_explicit( &counter->blocks, memory_order_relaxed );
+        stats->allocated    += atomic_load_explicit( &counter->allocated, memory_order_relaxed );
+        stats->allocs       += atomic_load_explicit( &counter->allocs, memory_order_relaxed );
+        stats->frees        += atomic_load_explicit( &counter->frees, memory_order_relaxed );
+    }
+
+    return 1;
+}
+
+
+// prints the counts for every tag used so far
+void UTI_Memory_Report()
+{
+    struct timespec now;
+    timespec_get( &now, TIME_UTC );
+
+    double seconds = ( now.tv_sec - mem_start.tv_sec ) + ( now.tv_nsec - mem_start.tv_nsec ) / 1e9;
+    seconds = ( seconds > 0.0 ) ? seconds : 1.0;
+
+    printf( "%-12s %12s %12s %10s %12s %12s\n", "memory", "live", "peak", "blocks", "allocs/s",
+            "bytes/s" );
+
+    uti_mem_stats_type stats;
+    int tag;
+    for( tag = 0; tag <= UTI_MEM_TAGS; tag++ )
+    {
+        UTI_Memory_Stats( tag, &stats );
+        if( stats.allocs == 0 && tag != UTI_MEM_TAGS )
+        {
+            continue;
+        }
+
+        // the peaks of different tags may not have been at the same time, so their sum is
+        // only an upper bound
+        printf( "%-12s %12zu %11zu%s %10zu %12.1f %12.0f\n", mem_tag_names[tag], stats.live,
+                stats.peak, ( tag == UTI_MEM_TAGS ) ? "*" : " ", stats.blocks,
+                stats.allocs / seconds, stats.allocated / seconds );
+    }
+
+    return;
+}
+
+#else
+
 // error checked malloc call
 void *UTI_EC_Malloc( size_t size )
 {
@@ -29,6 +502,19 @@ void *UTI_EC_Malloc( size_t size )
 }
 
 
+// error checked realloc call
+void *UTI_EC_Realloc( void *ptr, size_t size )
+{
+    ptr = realloc( ptr, size );
+    if( ptr == NULL )
+    {
+        UTI_Fatal_Error( "<UTI_EC_Realloc>: Unable to allocate memory" );
+    }
+
+    return ptr;
+}
+
+
 // error checked free
 void UTI_EC_Free( void *ptr )
 {
@@ -42,3 +528,255 @@ void UTI_EC_Free( void *ptr )
 
     return;
 }
+
+
+// nothing is counted with the stats compiled out
+int UTI_Memory_Stats( int tag, uti_mem_stats_type *stats )
+{
+    memset( stats, 0, sizeof( uti_mem_stats_type ) );
+
+    return 0;
+}
+
+
+// nothing is counted with the stats compiled out
+void UTI_Memory_Report()
+{
+    printf( "Memory counting is compiled out, see UTI_MEMORY_STATS in utility.h\n" );
+
+    return;
+}
+
+#endif  // UTI_MEMORY_STATS
+
+
+// returns the name of a UTI_MEM_ tag
+const char *UTI_Memory_Tag_Name( int tag )
+{
+    return ( tag >= 0 && tag <= UTI_MEM_TAGS ) ? mem_tag_names[tag] : "unknown";
+}
+
+
+// adds a copy of name to a file list, growing it as needed
+static void Add_File( char ***files, int *found, int *space, const char *name )
+{
+    if( *found == *space )
+    {
+        *space = ( *space == 0 ) ? 64 : *space * 2;
+        *files = UTI_EC_Realloc( *files, sizeof( char * ) * *space );
+    }
+
+    ( *files )[*found] = UTI_EC_Malloc( strlen( name ) + 1 );
+    strcpy( ( *files )[*found], name );
+    ( *found )++;
+
+    return;
+}
+
+
+// adds every file under directory path ending in extension to a file list. links to files are
+// followed but links to directories aren't, so a link back up the tree can't loop
+static void Search_Directory( char ***files, int *found, int *space, const char *path,
+                              const char *extension )
+{
+    DIR *dir = opendir( path );
+    if( dir == NULL )
+    {
+        UTI_Log( UTI_LOG_ERROR, "Unable to open directory '%s'", path );
+        return;
+    }
+
+    struct dirent *entry;
+    struct stat info;
+    size_t ext_len = strlen( extension ), len;
+    int ok, link;
+
+    while( ( entry = readdir( dir ) ) != NULL )
+    {
+        if( entry->d_name[0] == '.' )
+        {
+            continue;
+        }
+
+        char *name = UTI_EC_Malloc( strlen( path ) + strlen( entry->d_name ) + 2 );
+        sprintf( name, "%s/%s", path, entry->d_name );
+
+        // a link is looked at by what it points to, broken ones are skipped
+        ok = ( lstat( name, &info ) == 0 );
+        link = ( ok && S_ISLNK( info.st_mode ) );
+        ok = ( link ) ? ( stat( name, &info ) == 0 ) : ok;
+
+        if( ok )
+        {
+            len = strlen( name );
+            if( S_ISDIR( info.st_mode ) )
+            {
+                if( link )
+                {
+                    UTI_Log( UTI_LOG_INFO, "Not following link to directory '%s'", name );
+                }
+                else
+                {
+                    Search_Directory( files, found, space, name, extension );
+                }
+            }
+            else if( len >= ext_len && strcmp( &name[len - ext_len], extension ) == 0 )
+            {
+                Add_File( files, found, space, name );
+            }
+        }
+
+        UTI_EC_Free( name );
+    }
+
+    closedir( dir );
+
+    return;
+}
+
+
+// builds the slice-by-8 tables and checks for the SSE4.2 crc32 instruction
+static void Init_CRC32C()
+{
+    uint32_t crc;
+    int i, j;
+
+    for( i = 0; i < 256; i++ )
+    {
+        crc = i;
+        for( j = 0; j < 8; j++ )
+        {
+            crc = ( crc >> 1 ) ^ ( CRC32C_POLY & -( crc & 1 ) );
+        }
+        crc_table[0][i] = crc;
+    }
+
+    for( i = 0; i < 256; i++ )
+    {
+        for( j = 1; j < 8; j++ )
+        {
+            crc_table[j][i] = ( crc_table[j - 1][i] >> 8 ) ^ crc_table[0][crc_table[j - 1][i] & 0xFF];
+        }
+    }
+
+#if defined( __x86_64__ )
+    crc_hardware = __builtin_cpu_supports( "sse4.2" );
+#endif
+
+    return;
+}
+
+
+// slice-by-8 CRC32C, crc is the running (inverted) value
+static uint32_t CRC32C_Software( uint32_t crc, const uint8_t *data, size_t size )
+{
+    uint32_t lo, hi;
+
+    while( size >= 8 )
+    {
+        memcpy( &lo, data, 4 );
+        memcpy( &hi, data + 4, 4 );
+        lo ^= crc;
+
+        crc =   crc_table[7][lo & 0xFF] ^ crc_table[6][( lo >> 8 ) & 0xFF] ^
+                crc_table[5][( lo >> 16 ) & 0xFF] ^ crc_table[4][lo >> 24] ^
+                crc_table[3][hi & 0xFF] ^ crc_table[2][( hi >> 8 ) & 0xFF] ^
+                crc_table[1][( hi >> 16 ) & 0xFF] ^ crc_table[0][hi >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while( size-- )
+    {
+        crc = ( crc >> 8 ) ^ crc_table[0][( crc ^ *data++ ) & 0xFF];
+    }
+
+    return crc;
+}
+
+
+#if defined( __x86_64__ )
+// CRC32C using the SSE4.2 crc32 instruction, 8 bytes at a time
+__attribute__(( target( "sse4.2" ) ))
+static uint32_t CRC32C_Hardware( uint32_t crc, const uint8_t *data, size_t size )
+{
+    uint64_t crc64 = crc, value;
+
+    while( size >= 8 )
+    {
+        memcpy( &value, data, 8 );
+        crc64 = _mm_crc32_u64( crc64, value );
+
+        data += 8;
+        size -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+    while( size-- )
+    {
+        crc = _mm_crc32_u8( crc, *data++ );
+    }
+
+    return crc;
+}
+#endif
+
+
+// returns the CRC32C of size bytes of data, continuing from crc (0 to start a new checksum)
+uint32_t UTI_CRC32C( uint32_t crc, const void *data, size_t size )
+{
+    call_once( &crc_once, Init_CRC32C );
+
+    crc = ~crc;
+
+#if defined( __x86_64__ )
+    if( crc_hardware )
+    {
+        return ~CRC32C_Hardware( crc, data, size );
+    }
+#endif
+
+    return ~CRC32C_Software( crc, data, size );
+}
+
+
+// makes a list of files from paths, directories are searched for files ending in extension
+char **UTI_Find_Files( char **paths, int count, char *extension, int *found )
+{
+    char **files = NULL;
+    int space = 0, i;
+    struct stat info;
+
+    *found = 0;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( stat( paths[i], &info ) == 0 && S_ISDIR( info.st_mode ) )
+        {
+            Search_Directory( &files, found, &space, paths[i], extension );
+        }
+        else
+        {
+            // missing files are kept so whoever uses the list can report them
+            Add_File( &files, found, &space, paths[i] );
+        }
+    }
+
+    return files;
+}
+
+
+// frees a list made by UTI_Find_Files
+void UTI_Free_Files( char **files, int count )
+{
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        UTI_EC_Free( files[i] );
+    }
+
+    UTI_EC_Free( files );
+
+    return;
+}
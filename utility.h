@@ -5,8 +5,16 @@
 #ifndef __utility_h__
 #define __utility_h__
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
 #define DEBUG       1
 
+// counts the memory allocated through UTI_EC_ for each UTI_MEM_ tag. comment out to compile
+// the counting out, the tagged calls then go straight to malloc
+#define UTI_MEMORY_STATS    1
+
 // check c version for __func__ or __FUNCTION__ use
 #if __STDC_VERSION__ < 199901L
 #   if __GNUC__ >= 2
@@ -16,24 +24,151 @@
 #   endif
 #endif // __STDC_VERSION__
 
-// prints error message with function name
-#define         UTI_Print_Error( A )            printf( "[ERROR] <%s()>: %s\n", __func__, A )
+// log levels, a message is kept if its level is at most both the compile time and the runtime
+// level. messages are formatted into a ring buffer and written out by a thread of their own,
+// so logging never waits for the terminal
+enum uti_log_level              {
+                                    UTI_LOG_ERROR,
+                                    UTI_LOG_WARN,
+                                    UTI_LOG_INFO,
+                                    UTI_LOG_DEBUG,
+
+                                    UTI_LOG_LEVELS
+                                };
 
-// prints debug message with function name
+// messages above this level are compiled out
 #ifdef DEBUG
-#   define          UTI_Print_Debug( A )         printf( "[DEBUG] <%s()>: %s\n", __func__, A )
-#else       
-#   define          UTI_Print_Debug( A )         NULL       // do nothing
+#   define          UTI_LOG_LEVEL               UTI_LOG_DEBUG
+#else
+#   define          UTI_LOG_LEVEL               UTI_LOG_INFO
 #endif  // DEBUG
 
+// the level set with UTI_Log_Set_Level, read with every message
+extern _Atomic int uti_log_level;
+
+// logs a printf style message with the function name if level is enabled. the arguments
+// aren't evaluated for levels that are off
+#define         UTI_Log( L, ... )                                                               \
+    do                                                                                          \
+    {                                                                                           \
+        if( (L) <= UTI_LOG_LEVEL &&                                                             \
+            (L) <= atomic_load_explicit( &uti_log_level, memory_order_relaxed ) )               \
+        {                                                                                       \
+            UTI_Log_Write( (L), __func__, __VA_ARGS__ );                                        \
+        }                                                                                       \
+    } while( 0 )
+
+// logs error message with function name
+#define         UTI_Print_Error( A )            UTI_Log( UTI_LOG_ERROR, "%s", A )
+
+// logs debug message with function name
+#define         UTI_Print_Debug( A )            UTI_Log( UTI_LOG_DEBUG, "%s", A )
+
+// put before a hot loop's definition to build an AVX2 copy of it alongside the default one,
+// the cpu's pick being made when the program loads. only x86-64 linux has the ifunc support
+// this needs, and it is left off under ThreadSanitizer, which can't handle a function being
+// picked before it has started
+#if defined( __x86_64__ ) && defined( __linux__ ) && !defined( __SANITIZE_THREAD__ )
+#   define      UTI_AVX2_CLONES                 __attribute__(( target_clones( "avx2", "default" ) ))
+#else
+#   define      UTI_AVX2_CLONES
+#endif
+
+// what memory is used for, for counting allocations
+enum uti_mem_tag                {
+                                    UTI_MEM_GENERAL,
+                                    UTI_MEM_TEXTURE,        // texels, and lists of textures
+                                    UTI_MEM_THUMBNAIL,
+                                    UTI_MEM_FRAMEBUFFER,
+                                    UTI_MEM_FONT,
+                                    UTI_MEM_PALETTE,
+                                    UTI_MEM_THREAD,         // threads and queues
+                                    UTI_MEM_FILE,           // tables for loading and saving
+                                    UTI_MEM_SCRATCH,        // working space for one operation
+
+                                    UTI_MEM_TAGS
+                                };
+
+// counts for one tag, all in bytes except blocks, allocs and frees
+struct uti_mem_stats_s          {
+                                    size_t      live;       // allocated now
+                                    size_t      peak;       // most ever allocated at once
+                                    size_t      blocks;     // allocations not yet freed
+                                    size_t      allocated;  // total ever allocated
+                                    uint64_t    allocs;     // calls to malloc and realloc
+                                    uint64_t    frees;
+                                };
+typedef struct uti_mem_stats_s uti_mem_stats_type;
+
 // prints error message then quits
 void UTI_Fatal_Error( char *msg );
 
-// error checked malloc call
+
+// adds a message to the log, use UTI_Log rather than calling this. the message is cut short
+// if it is too long, and dropped if the log is full
+void UTI_Log_Write( int level, const char *func, const char *format, ... )
+                    __attribute__(( format( printf, 3, 4 ) ));
+
+
+// sets the most detailed level logged, messages above UTI_LOG_LEVEL are still left out
+void UTI_Log_Set_Level( int level );
+
+
+// returns the UTI_LOG_ level called name (error, warn, info or debug), or -1
+int UTI_Log_Find_Level( const char *name );
+
+
+// writes out every message logged so far before returning
+void UTI_Log_Flush();
+
+// error checked malloc call, counted as UTI_MEM_GENERAL
 void *UTI_EC_Malloc( size_t size );
 
 
+// error checked realloc call, counted as UTI_MEM_GENERAL
+void *UTI_EC_Realloc( void *ptr, size_t size );
+
+
+// error checked malloc and realloc calls counting the memory against tag, one of the
+// UTI_MEM_ list. realloc moves the whole block to tag
+#ifdef UTI_MEMORY_STATS
+void *UTI_EC_Tag_Malloc( int tag, size_t size );
+void *UTI_EC_Tag_Realloc( int tag, void *ptr, size_t size );
+#else
+#   define          UTI_EC_Tag_Malloc( T, S )       UTI_EC_Malloc( S )
+#   define          UTI_EC_Tag_Realloc( T, P, S )   UTI_EC_Realloc( P, S )
+#endif  // UTI_MEMORY_STATS
+
+
 // free malloc'd memory, ignores null pointers
 void UTI_EC_Free( void *ptr );
 
+
+// copies the counts for tag into stats, tag UTI_MEM_TAGS gives the totals of every tag.
+// returns 0 if the counting is compiled out
+int UTI_Memory_Stats( int tag, uti_mem_stats_type *stats );
+
+
+// returns the name of a UTI_MEM_ tag
+const char *UTI_Memory_Tag_Name( int tag );
+
+
+// prints the counts for every tag used so far, with the allocation rate since the first
+void UTI_Memory_Report();
+
+
+// makes a list of files from paths, directories are searched (including subdirectories, but
+// not links to them) for files ending in extension. returns the list and sets found to its
+// length
+char **UTI_Find_Files( char **paths, int count, char *extension, int *found );
+
+
+// frees a list made by UTI_Find_Files
+void UTI_Free_Files( char **files, int count );
+
+
+// returns the CRC32C of size bytes of data, continuing from crc (0 to start a new checksum).
+// uses the SSE4.2 crc32 instruction when the cpu has it
+uint32_t UTI_CRC32C( uint32_t crc, const void *data, size_t size );
+
 #endif // __utility_h__